@@ -7,11 +7,12 @@ Integrates C library via ctypes wrapper and PostgreSQL for persistence
 
 from flask import Flask, request, jsonify, Response, stream_with_context
 from flask_cors import CORS
-from c_wrapper import MusicQueueWrapper
+from c_wrapper import MusicQueueWrapper, OPERATION_TYPES
 import database as db
 from models import Song, User
 from typing import Dict, List
 import os
+import atexit
 import requests
 import re
 from dotenv import load_dotenv
@@ -33,6 +34,13 @@ try:
 except Exception as e:
     print(f"⚠ Could not auto-sync local songs: {e}")
 
+# Saved search index, mapped at startup instead of re-indexing the catalog
+SEARCH_INDEX_DIR = os.getenv('SEARCH_INDEX_DIR', os.path.join(os.path.dirname(os.path.abspath(__file__)), 'search_index'))
+
+# Write-ahead log of queue changes, replayed at startup to restore the queue
+QUEUE_LOG_DIR = os.getenv('QUEUE_LOG_DIR', os.path.join(os.path.dirname(os.path.abspath(__file__)), 'queue_log'))
+queue_log_open = False
+
 # Initialize Queue Manager (with Python fallback)
 queue_manager = None
 try:
@@ -41,22 +49,58 @@ try:
     queue_manager = MusicQueueWrapper()
     print("✓ Music Queue Manager initialized")
     
-    # Load ALL songs into the heap for recommendations
+    # Undo/redo history is a fixed-size ring; the oldest operations drop off
+    if os.getenv('UNDO_HISTORY_DEPTH'):
+        queue_manager.set_history_depth(int(os.getenv('UNDO_HISTORY_DEPTH')))
+    
     try:
+        # Restore the queue from its write-ahead log first: replayed records
+        # carry the priorities of their time, and the heap is rebuilt from
+        # the current database counts below. The database snapshot seeds a
+        # log that has never been checkpointed, and stands in for the log
+        # when it cannot be opened (e.g. another worker owns it).
+        os.makedirs(QUEUE_LOG_DIR, exist_ok=True)
+        seeded = os.path.exists(os.path.join(QUEUE_LOG_DIR, 'queue.ckpt'))
+        queue_log_open = queue_manager.open_log(QUEUE_LOG_DIR)
+        if queue_log_open:
+            print(f"✓ Recovered {queue_manager.get_queue_size()} queued songs from {QUEUE_LOG_DIR}")
+        else:
+            print(f"⚠ Could not recover queue log in {QUEUE_LOG_DIR}; using database snapshot")
+        
+        # Load ALL songs into the heap for recommendations
         all_songs = db.get_all_songs()
-        for song in all_songs:
-            play_count = db.get_play_count(song.id)
-            queue_manager.update_priority(song.id, int(song.popularity or 0), play_count)
+        play_counts = db.get_all_play_counts()
+        queue_manager.build_recommendations([
+            (song.id, int(song.popularity or 0), play_counts.get(song.id, 0))
+            for song in all_songs
+        ])
         print(f"✓ Loaded {len(all_songs)} songs into recommendation heap")
         
+        # Index the whole catalog for search, not just queued songs. The saved
+        # index is mapped rather than rebuilt; songs added since it was
+        # written, or edited since (its edit log), are indexed here from the
+        # database, and then it is saved again.
+        if queue_manager.load_index(SEARCH_INDEX_DIR):
+            print(f"✓ Mapped search index from {SEARCH_INDEX_DIR}")
+        missing = [song for song in all_songs if not queue_manager.is_indexed(song.id)]
+        for song in missing:
+            queue_manager.index_song(song.id, song.title, song.artist, song.album)
+        print(f"✓ Indexed {len(missing)} of {len(all_songs)} songs for search")
+        if missing:
+            os.makedirs(SEARCH_INDEX_DIR, exist_ok=True)
+            if not queue_manager.save_index(SEARCH_INDEX_DIR):
+                print(f"⚠ Could not save search index to {SEARCH_INDEX_DIR}")
+        
         # Load queue state from database for CDLL
-        snapshot = db.load_queue_snapshot()
+        snapshot = db.load_queue_snapshot() if (not queue_log_open or not seeded) and queue_manager.get_queue_size() == 0 else None
         if snapshot:
             for item in snapshot:
                 song = db.get_song_by_id(item['song_id'])
                 if song:
                     queue_manager.add_song(item['song_id'], song.title, song.artist, int(song.popularity or 0), db.get_play_count(song.id))
             print(f"✓ Loaded {len(snapshot)} songs into active queue")
+        if queue_log_open and not seeded:
+            queue_manager.checkpoint()
     except Exception as db_e:
         print(f"⚠ Warning during queue manager initialization: {db_e}")
 except Exception as e:
@@ -73,13 +117,49 @@ except Exception as e:
 # ============================================================================
 
 def sync_queue_to_db():
-    """Sync the current queue state to database"""
+    """Persist the current queue state
+
+    With the queue log open the C core has already logged the change, at a
+    fixed size per operation, and commit_queue_log makes it durable before
+    the response goes out. Otherwise the whole queue is rewritten to the
+    database.
+    """
     if not queue_manager:
         return False
-    
+    if queue_log_open:
+        return True
+    return write_queue_snapshot()
+
+@app.after_request
+def commit_queue_log(response):
+    """Flush the queue log before answering any request that may have changed the queue"""
+    if queue_log_open and request.method != 'GET' and not queue_manager.commit_log():
+        abandon_queue_log()
+    return response
+
+def abandon_queue_log():
+    """Fall back to database snapshots once the queue log cannot be written
+
+    The log files are removed so a restart seeds the queue from the snapshot
+    instead of replaying a log that stopped short.
+    """
+    global queue_log_open
+    print(f"⚠ Queue log in {QUEUE_LOG_DIR} failed; saving the queue to the database instead")
+    queue_log_open = False
+    queue_manager.close_log()
+    for name in ('queue.ckpt', 'queue.log'):
+        try:
+            os.remove(os.path.join(QUEUE_LOG_DIR, name))
+        except FileNotFoundError:
+            pass
+        except OSError as e:
+            print(f"Error removing {name}: {e}")
+    write_queue_snapshot()
+
+def write_queue_snapshot():
+    """Write the whole queue to the database snapshot"""
     try:
-        queue_songs = queue_manager.get_queue()
-        current_song_id = queue_manager.get_current_song()
+        queue_songs, current_index = queue_manager.export_queue()
         
         queue_data = []
         for position, song_id in enumerate(queue_songs):
@@ -87,7 +167,7 @@ def sync_queue_to_db():
                 'song_id': song_id,
                 'position': position,
                 'priority': 0.0,  # TODO: Get from heap
-                'is_current': (song_id == current_song_id)
+                'is_current': (position == current_index)
             })
         
         return db.save_queue_snapshot(queue_data)
@@ -95,6 +175,39 @@ def sync_queue_to_db():
         print(f"Error syncing queue: {e}")
         return False
 
+def batch_op_error(op) -> str:
+    """Why op cannot be sent to apply_batch, or '' if it can"""
+    if not isinstance(op, dict):
+        return 'each op must be an object'
+    if op.get('op') not in OPERATION_TYPES or op.get('op') == 'batch':
+        return f"unknown op {op.get('op')!r}"
+    for field in ('song_id', 'position', 'likes', 'play_count'):
+        value = op.get(field, 0)
+        if isinstance(value, bool) or not isinstance(value, int) or not -2**31 <= value < 2**31:
+            return f'{field} must be an integer'
+    if not isinstance(op.get('forward', True), bool):
+        return 'forward must be true or false'
+    for field in ('title', 'artist'):
+        if not isinstance(op.get(field) or '', str):
+            return f'{field} must be a string'
+    return ''
+
+@atexit.register
+def close_queue_log():
+    """Flush the queue log and fold it into a checkpoint on shutdown"""
+    if queue_log_open:
+        queue_manager.checkpoint()
+        write_queue_snapshot()
+
+def log_search_edit(song_id):
+    """Note an edited or deleted song so the saved index drops it on restart"""
+    try:
+        os.makedirs(SEARCH_INDEX_DIR, exist_ok=True)
+        return queue_manager.log_index_edit(SEARCH_INDEX_DIR, song_id)
+    except Exception as e:
+        print(f"Error logging search index edit: {e}")
+        return False
+
 def calculate_priority(song: Song, user_votes: int = 0, is_premium: bool = False) -> float:
     """Calculate song priority based on formula"""
     popularity_score = song.popularity * 0.5
@@ -114,7 +227,8 @@ def health_check():
     return jsonify({
         'status': 'healthy',
         'queue_manager': queue_manager is not None,
-        'database': True
+        'database': True,
+        'allocator': queue_manager.get_pool_stats() if queue_manager else None
     })
 
 # ============================================================================
@@ -216,43 +330,30 @@ def get_songs():
 
 @app.route('/api/search', methods=['GET'])
 def search_songs():
-    """Real-time search using C Trie or database fallback"""
-    query = request.args.get('q', '').strip().lower()
+    """Real-time search using the C word index
+
+    Every word of the query must start a word of the song's title, album or
+    artist; results are ordered by priority. Case and accents are folded by
+    the index, so "beyonce" finds "Beyoncé". When nothing matches exactly,
+    the query is retried allowing a couple of typos per word.
+    """
+    query = request.args.get('q', '').strip()
     if not query:
         return jsonify({'success': True, 'results': []})
+    if not queue_manager:
+        return jsonify({'success': False, 'error': 'Search index unavailable'}), 503
     
     try:
-        # Try C Trie search first if available
-        if queue_manager:
-            try:
-                song_ids = queue_manager.search_songs(query)
-                artist_song_ids = queue_manager.search_artists(query)
-                all_ids = list(set(song_ids + artist_song_ids))
-                
-                # Fetch song details
-                results = []
-                for sid in all_ids:
-                    song = db.get_song_by_id(sid)
-                    if song:
-                        results.append(format_song(song))
-                
-                if results:
-                    return jsonify({
-                        'success': True,
-                        'results': results
-                    })
-            except Exception as e:
-                print(f"Trie search failed, using database fallback: {e}")
+        # One C call: both indexes, deduplicated and ranked by priority
+        song_ids = queue_manager.search(query)
         
-        # Fallback to database search
-        all_songs = db.get_all_songs()
+        # Fetch song details
         results = []
-        for song in all_songs:
-            if (query in song.title.lower() or 
-                query in song.artist.lower() or 
-                (song.album and query in song.album.lower())):
+        for sid in song_ids:
+            song = db.get_song_by_id(sid)
+            if song:
                 results.append(format_song(song))
-                
+        
         return jsonify({
             'success': True,
             'results': results
@@ -313,10 +414,42 @@ def create_song():
             genre=data.get('genre'),
             release_year=data.get('release_year')
         )
+        if queue_manager:
+            queue_manager.index_song(song.id, song.title, song.artist, song.album)
         return jsonify({'success': True, 'song': song.to_dict()}), 201
     except Exception as e:
         return jsonify({'success': False, 'error': str(e)}), 400
 
+@app.route('/api/songs/<int:song_id>', methods=['PUT'])
+def update_song(song_id):
+    """Edit a song's details; searches match the new title, artist and album at once"""
+    try:
+        data = request.json or {}
+        fields = {key: data[key] for key in ('title', 'artist', 'album', 'duration', 'genre', 'release_year') if key in data}
+        song = db.update_song(song_id, **fields)
+        if not song:
+            return jsonify({'success': False, 'error': 'Song not found'}), 404
+        if queue_manager:
+            queue_manager.update_song(song.id, song.title, song.artist, song.album)
+            log_search_edit(song.id)
+        return jsonify({'success': True, 'song': song.to_dict()})
+    except Exception as e:
+        return jsonify({'success': False, 'error': str(e)}), 400
+
+@app.route('/api/songs/<int:song_id>', methods=['DELETE'])
+def delete_song(song_id):
+    """Delete a song from the catalog and the search index"""
+    try:
+        if not db.delete_song(song_id):
+            return jsonify({'success': False, 'error': 'Song not found'}), 404
+        if queue_manager:
+            queue_manager.unindex_song(song_id)
+            queue_manager.unrank_song(song_id)
+            log_search_edit(song_id)
+        return jsonify({'success': True})
+    except Exception as e:
+        return jsonify({'success': False, 'error': str(e)}), 500
+
 # ============================================================================
 # QUEUE MANAGEMENT ENDPOINTS
 # ============================================================================
@@ -353,8 +486,8 @@ def get_queue():
                     'size': 0
                 })
         
-        queue_song_ids = queue_manager.get_queue()
-        current_song_id = queue_manager.get_current_song()
+        queue_song_ids, current_index = queue_manager.export_queue()
+        current_song_id = queue_song_ids[current_index] if current_index >= 0 else -1
         
         # Fetch song details from database
         queue_with_details = []
@@ -363,14 +496,14 @@ def get_queue():
             if song:
                 song_dict = format_song(song)
                 song_dict['position'] = position
-                song_dict['is_current'] = (song_id == current_song_id)
+                song_dict['is_current'] = (position == current_index)
                 queue_with_details.append(song_dict)
         
         return jsonify({
             'success': True,
             'queue': queue_with_details,
             'current_song_id': current_song_id,
-            'size': queue_manager.get_queue_size()
+            'size': len(queue_song_ids)
         })
     except Exception as e:
         print(f"Error in get_queue: {e}")
@@ -607,6 +740,41 @@ def move_down():
         print(f"Error in move_down: {e}")
         return jsonify({'success': False, 'error': str(e)}), 400
 
+@app.route('/api/queue/move', methods=['POST'])
+def move_to():
+    """Move a song to a position in the queue (drag-and-drop)"""
+    try:
+        data = request.json
+        if not data or 'song_id' not in data or 'position' not in data:
+            return jsonify({'success': False, 'error': 'song_id and position are required'}), 400
+            
+        song_id = data['song_id']
+        position = int(data['position'])
+        
+        if not queue_manager:
+            # Fallback: update database queue snapshot
+            snapshot = db.load_queue_snapshot()
+            idx = next((i for i, item in enumerate(snapshot) if item['song_id'] == song_id), None)
+            if idx is None or position < 0 or position >= len(snapshot):
+                return jsonify({'success': False, 'error': 'Cannot move song'}), 400
+            
+            snapshot.insert(position, snapshot.pop(idx))
+            for i, item in enumerate(snapshot):
+                item['position'] = i
+            db.save_queue_snapshot(snapshot)
+            return jsonify({'success': True, 'message': 'Song moved'})
+        
+        success = queue_manager.move_to(song_id, position)
+        
+        if success:
+            sync_queue_to_db()
+            return jsonify({'success': True, 'message': 'Song moved'})
+        else:
+            return jsonify({'success': False, 'error': 'Cannot move song'}), 400
+    except Exception as e:
+        print(f"Error in move_to: {e}")
+        return jsonify({'success': False, 'error': str(e)}), 400
+
 @app.route('/api/queue/update-priority', methods=['POST'])
 def update_priority():
     """Update song priority"""
@@ -627,6 +795,48 @@ def update_priority():
     except Exception as e:
         return jsonify({'success': False, 'error': str(e)}), 400
 
+@app.route('/api/queue/batch', methods=['POST'])
+def apply_batch():
+    """Apply several queue operations at once (e.g. queue a whole playlist)
+
+    Body: {"ops": [{"op": "add", "song_id": 1}, {"op": "move_to", "song_id": 1, "position": 0}, ...]}
+    All operations take effect or none do, and one undo reverts them all.
+    A batch must be shorter than the undo history (UNDO_HISTORY_DEPTH).
+    """
+    if not queue_manager:
+        return jsonify({'success': False, 'error': 'Queue manager not initialized'}), 503
+
+    try:
+        data = request.json
+        if not data or not isinstance(data.get('ops'), list):
+            return jsonify({'success': False, 'error': 'ops is required'}), 400
+
+        ops = []
+        for op in data['ops']:
+            error = batch_op_error(op)
+            if error:
+                return jsonify({'success': False, 'error': error}), 400
+            op = dict(op)
+            if op.get('op') == 'add':
+                song = db.get_song_by_id(op.get('song_id'))
+                if not song:
+                    return jsonify({'success': False, 'error': f"Song {op.get('song_id')} not found"}), 404
+                op.update(title=song.title, artist=song.artist,
+                          likes=int(song.popularity or 0),
+                          play_count=db.get_play_count(song.id))
+            ops.append(op)
+
+        success, results = queue_manager.apply_batch(ops)
+
+        if success:
+            sync_queue_to_db()
+            return jsonify({'success': True, 'results': results})
+        else:
+            return jsonify({'success': False, 'error': 'Batch not applied', 'results': results}), 400
+    except Exception as e:
+        print(f"Error in apply_batch: {e}")
+        return jsonify({'success': False, 'error': str(e)}), 400
+
 # ============================================================================
 # UNDO/REDO ENDPOINTS
 # ============================================================================
@@ -7,9 +7,10 @@ Automatically detects and loads the correct shared library based on OS
 
 import sys
 import os
+from array import array
 from pathlib import Path
 from ctypes import *
-from typing import Optional, List, Dict
+from typing import Optional, List, Dict, Tuple
 
 # ============================================================================
 # PLATFORM DETECTION AND LIBRARY LOADING
@@ -57,21 +58,52 @@ except Exception as e:
 # C STRUCTURE DEFINITIONS
 # ============================================================================
 
+class NodePool(Structure):
+    pass # Opaque
+
+class PoolStats(Structure):
+    _fields_ = [
+        ('node_size', c_int),
+        ('nodes_per_slab', c_int),
+        ('slab_count', c_int),
+        ('nodes_in_use', c_int),
+        ('nodes_free', c_int),
+        ('bytes_reserved', c_long)
+    ]
+
+# PoolKind enum, in declaration order
+POOL_KINDS = ['dll_node', 'queue_node', 'trie_node', 'song_id_node']
+POOL_COUNT = len(POOL_KINDS)
+
 class DLLNode(Structure):
     pass
 
 DLLNode._fields_ = [
     ('song_id', c_int),
     ('next', POINTER(DLLNode)),
-    ('prev', POINTER(DLLNode))
+    ('prev', POINTER(DLLNode)),
+    ('next_dup', POINTER(DLLNode)),
+    ('prev_dup', POINTER(DLLNode)),
+    ('left', POINTER(DLLNode)),
+    ('right', POINTER(DLLNode)),
+    ('parent', POINTER(DLLNode)),
+    ('weight', c_uint),
+    ('count', c_int)
 ]
 
+class HashMap(Structure):
+    pass # Opaque
+
 class DoublyLinkedList(Structure):
     _fields_ = [
         ('head', POINTER(DLLNode)),
         ('tail', POINTER(DLLNode)),
         ('current', POINTER(DLLNode)),
-        ('size', c_int)
+        ('size', c_int),
+        ('index', POINTER(HashMap)),
+        ('root', POINTER(DLLNode)),
+        ('seed', c_uint),
+        ('pool', POINTER(NodePool))
     ]
 
 class HeapNode(Structure):
@@ -82,9 +114,18 @@ class HeapNode(Structure):
 
 class MaxHeap(Structure):
     _fields_ = [
-        ('nodes', POINTER(HeapNode)),
+        ('priorities', POINTER(c_float)),
+        ('song_ids', POINTER(c_int)),
         ('size', c_int),
-        ('capacity', c_int)
+        ('capacity', c_int),
+        ('min_capacity', c_int),
+        ('arity', c_int),
+        ('positions', POINTER(c_int)),
+        ('position_capacity', c_int),
+        ('far_positions', c_void_p),
+        ('scratch', POINTER(c_int)),
+        ('scratch_capacity', c_int),
+        ('priority_block', POINTER(c_float))
     ]
 
 class Operation(Structure):
@@ -92,20 +133,19 @@ class Operation(Structure):
         ('type', c_int),  # OperationType enum
         ('song_id', c_int),
         ('old_position', c_int),
-        ('old_priority', c_float)
+        ('old_priority', c_float),
+        ('new_position', c_int),
+        ('new_priority', c_float),
+        ('was_ranked', c_bool),
+        ('old_current', c_int),
+        ('new_current', c_int)
     ]
 
-class StackNode(Structure):
-    pass
-
-StackNode._fields_ = [
-    ('op', Operation),
-    ('next', POINTER(StackNode))
-]
-
 class Stack(Structure):
     _fields_ = [
-        ('top', POINTER(StackNode)),
+        ('ops', POINTER(Operation)),
+        ('capacity', c_int),
+        ('top', c_int),
         ('size', c_int)
     ]
 
@@ -121,7 +161,8 @@ class Queue(Structure):
     _fields_ = [
         ('front', POINTER(QueueNode)),
         ('rear', POINTER(QueueNode)),
-        ('size', c_int)
+        ('size', c_int),
+        ('pool', POINTER(NodePool))
     ]
 
 class SongIdNode(Structure):
@@ -129,12 +170,91 @@ class SongIdNode(Structure):
 
 SongIdNode._fields_ = [
     ('song_id', c_int),
-    ('next', POINTER(SongIdNode))
+    ('next', POINTER(SongIdNode)),
+    ('node', c_void_p)
 ]
 
-class TrieNode(Structure):
+class Trie(Structure):
     pass # Opaque
 
+RECOMMENDATION_CACHE_SIZE = 100
+
+class TopKCache(Structure):
+    _fields_ = [
+        ('ids', c_int * RECOMMENDATION_CACHE_SIZE),
+        ('priorities', c_float * RECOMMENDATION_CACHE_SIZE),
+        ('count', c_int),
+        ('valid', c_bool)
+    ]
+
+class TraceRecord(Structure):
+    _fields_ = [
+        ('timestamp_ns', c_uint64),
+        ('thread_id', c_uint32),
+        ('event', c_uint16),
+        ('reserved', c_uint16),
+        ('arg0', c_int32),
+        ('arg1', c_int32)
+    ]
+
+# manager_search flags
+SEARCH_TITLES = 0x1
+SEARCH_ARTISTS = 0x2
+SEARCH_ALL = SEARCH_TITLES | SEARCH_ARTISTS
+SEARCH_FUZZY = 0x4
+
+class SearchScratch(Structure):
+    _fields_ = [
+        ('ids', POINTER(c_int)),
+        ('id_capacity', c_int),
+        ('ranked', POINTER(HeapNode)),
+        ('ranked_capacity', c_int),
+        ('stamps', c_void_p),
+        ('generation', c_uint)
+    ]
+
+# OperationType enum, in declaration order
+OPERATION_TYPES = ['add', 'remove', 'skip', 'move_up', 'move_down',
+                   'update_priority', 'move_to', 'rotate', 'batch']
+
+class QueueOp(Structure):
+    _fields_ = [
+        ('type', c_int),  # OperationType enum
+        ('song_id', c_int),
+        ('position', c_int),
+        ('forward', c_bool),
+        ('likes', c_int),
+        ('play_count', c_int),
+        ('title', c_char_p),
+        ('artist', c_char_p)
+    ]
+
+class BatchScratch(Structure):
+    _fields_ = [
+        ('ops', POINTER(Operation)),
+        ('capacity', c_int),
+        ('count', c_int),
+        ('active', c_bool)
+    ]
+
+class WriteAheadLog(Structure):
+    _fields_ = [
+        ('open', c_bool),
+        ('failed', c_bool),
+        ('locked', c_bool),
+        ('lock_fd', c_int),
+        ('fd', c_int),
+        ('dir', c_char_p),
+        ('generation', c_uint),
+        ('records', c_int),
+        ('pending', c_int),
+        ('first_pending_ms', c_longlong)
+    ]
+
+# TraceEvent enum, in declaration order
+TRACE_EVENTS = ['dll_insert', 'dll_remove', 'dll_move_up', 'dll_move_down',
+                'dll_move_to', 'dll_rotate', 'skip_next', 'skip_prev']
+
 class MusicQueueManager(Structure):
     _fields_ = [
         ('queue', POINTER(DoublyLinkedList)),
@@ -142,8 +262,13 @@ class MusicQueueManager(Structure):
         ('undo_stack', POINTER(Stack)),
         ('redo_stack', POINTER(Stack)),
         ('upcoming', POINTER(Queue)),
-        ('song_trie', POINTER(TrieNode)),
-        ('artist_trie', POINTER(TrieNode))
+        ('song_trie', POINTER(Trie)),
+        ('artist_trie', POINTER(Trie)),
+        ('top_cache', TopKCache),
+        ('pools', POINTER(NodePool) * POOL_COUNT),
+        ('search', SearchScratch),
+        ('batch', BatchScratch),
+        ('log', WriteAheadLog)
     ]
 
 # ============================================================================
@@ -158,6 +283,18 @@ if c_lib:
     c_lib.manager_add_song.argtypes = [POINTER(MusicQueueManager), c_int, c_char_p, c_char_p, c_int, c_int]
     c_lib.manager_add_song.restype = c_bool
     
+    c_lib.manager_index_song.argtypes = [POINTER(MusicQueueManager), c_int, c_char_p, c_char_p, c_char_p]
+    c_lib.manager_index_song.restype = c_bool
+
+    c_lib.manager_unindex_song.argtypes = [POINTER(MusicQueueManager), c_int]
+    c_lib.manager_unindex_song.restype = c_bool
+
+    c_lib.manager_update_song.argtypes = [POINTER(MusicQueueManager), c_int, c_char_p, c_char_p, c_char_p]
+    c_lib.manager_update_song.restype = c_bool
+
+    c_lib.manager_unrank_song.argtypes = [POINTER(MusicQueueManager), c_int]
+    c_lib.manager_unrank_song.restype = c_bool
+    
     c_lib.manager_remove_song.argtypes = [POINTER(MusicQueueManager), c_int]
     c_lib.manager_remove_song.restype = c_bool
     
@@ -173,20 +310,53 @@ if c_lib:
     c_lib.manager_move_down.argtypes = [POINTER(MusicQueueManager), c_int]
     c_lib.manager_move_down.restype = c_bool
     
+    c_lib.manager_move_to.argtypes = [POINTER(MusicQueueManager), c_int, c_int]
+    c_lib.manager_move_to.restype = c_bool
+
+    c_lib.manager_index_of.argtypes = [POINTER(MusicQueueManager), c_int]
+    c_lib.manager_index_of.restype = c_int
+
+    c_lib.manager_get_song_at.argtypes = [POINTER(MusicQueueManager), c_int]
+    c_lib.manager_get_song_at.restype = c_int
+    
     c_lib.manager_rotate_queue.argtypes = [POINTER(MusicQueueManager), c_bool]
     c_lib.manager_rotate_queue.restype = c_bool
 
     c_lib.manager_update_priority.argtypes = [POINTER(MusicQueueManager), c_int, c_int, c_int]
     c_lib.manager_update_priority.restype = c_bool
+
+    c_lib.manager_build_recommendations.argtypes = [POINTER(MusicQueueManager), POINTER(c_int), POINTER(c_int), POINTER(c_int), c_int]
+    c_lib.manager_build_recommendations.restype = c_bool
     
     c_lib.manager_undo.argtypes = [POINTER(MusicQueueManager)]
     c_lib.manager_undo.restype = c_bool
     
     c_lib.manager_redo.argtypes = [POINTER(MusicQueueManager)]
     c_lib.manager_redo.restype = c_bool
+
+    c_lib.manager_set_history_depth.argtypes = [POINTER(MusicQueueManager), c_int]
+    c_lib.manager_set_history_depth.restype = c_bool
+
+    c_lib.manager_apply_batch.argtypes = [POINTER(MusicQueueManager), POINTER(QueueOp), c_int, POINTER(c_bool)]
+    c_lib.manager_apply_batch.restype = c_bool
     
+    c_lib.manager_open_log.argtypes = [POINTER(MusicQueueManager), c_char_p]
+    c_lib.manager_open_log.restype = c_bool
+
+    c_lib.manager_commit_log.argtypes = [POINTER(MusicQueueManager)]
+    c_lib.manager_commit_log.restype = c_bool
+
+    c_lib.manager_close_log.argtypes = [POINTER(MusicQueueManager)]
+    c_lib.manager_close_log.restype = None
+
+    c_lib.manager_checkpoint.argtypes = [POINTER(MusicQueueManager)]
+    c_lib.manager_checkpoint.restype = c_bool
+
     c_lib.manager_get_current_song.argtypes = [POINTER(MusicQueueManager)]
     c_lib.manager_get_current_song.restype = c_int
+
+    c_lib.manager_export_queue.argtypes = [POINTER(MusicQueueManager), POINTER(c_int), c_int, POINTER(c_int)]
+    c_lib.manager_export_queue.restype = c_int
     
     c_lib.manager_destroy.argtypes = [POINTER(MusicQueueManager)]
     c_lib.manager_destroy.restype = None
@@ -200,6 +370,61 @@ if c_lib:
     c_lib.manager_get_recommendations.argtypes = [POINTER(MusicQueueManager), c_int]
     c_lib.manager_get_recommendations.restype = POINTER(SongIdNode)
 
+    c_lib.manager_search_songs_into.argtypes = [POINTER(MusicQueueManager), c_char_p, POINTER(c_int), c_int]
+    c_lib.manager_search_songs_into.restype = c_int
+
+    c_lib.manager_search_artists_into.argtypes = [POINTER(MusicQueueManager), c_char_p, POINTER(c_int), c_int]
+    c_lib.manager_search_artists_into.restype = c_int
+
+    c_lib.manager_search.argtypes = [POINTER(MusicQueueManager), c_char_p, c_int, POINTER(c_int), c_int]
+    c_lib.manager_search.restype = c_int
+
+    c_lib.manager_search_songs_fuzzy_into.argtypes = [POINTER(MusicQueueManager), c_char_p, c_int, POINTER(c_int), c_int]
+    c_lib.manager_search_songs_fuzzy_into.restype = c_int
+
+    c_lib.manager_search_artists_fuzzy_into.argtypes = [POINTER(MusicQueueManager), c_char_p, c_int, POINTER(c_int), c_int]
+    c_lib.manager_search_artists_fuzzy_into.restype = c_int
+
+    c_lib.manager_suggest_songs.argtypes = [POINTER(MusicQueueManager), c_char_p, c_int, POINTER(c_int)]
+    c_lib.manager_suggest_songs.restype = c_int
+
+    c_lib.manager_suggest_artists.argtypes = [POINTER(MusicQueueManager), c_char_p, c_int, POINTER(c_int)]
+    c_lib.manager_suggest_artists.restype = c_int
+
+    c_lib.manager_save_index.argtypes = [POINTER(MusicQueueManager), c_char_p]
+    c_lib.manager_save_index.restype = c_bool
+
+    c_lib.manager_load_index.argtypes = [POINTER(MusicQueueManager), c_char_p]
+    c_lib.manager_load_index.restype = c_bool
+
+    c_lib.manager_log_index_edit.argtypes = [POINTER(MusicQueueManager), c_char_p, c_int]
+    c_lib.manager_log_index_edit.restype = c_bool
+
+    c_lib.manager_is_indexed.argtypes = [POINTER(MusicQueueManager), c_int]
+    c_lib.manager_is_indexed.restype = c_bool
+
+    c_lib.manager_get_recommendations_into.argtypes = [POINTER(MusicQueueManager), POINTER(c_int), c_int]
+    c_lib.manager_get_recommendations_into.restype = c_int
+
+    c_lib.manager_free_song_list.argtypes = [POINTER(SongIdNode)]
+    c_lib.manager_free_song_list.restype = None
+
+    c_lib.manager_get_top_k.argtypes = [POINTER(MusicQueueManager), c_int, POINTER(c_int)]
+    c_lib.manager_get_top_k.restype = c_int
+
+    c_lib.manager_get_pool_stats.argtypes = [POINTER(MusicQueueManager), c_int, POINTER(PoolStats)]
+    c_lib.manager_get_pool_stats.restype = c_bool
+
+    # Tracing (inert unless the library was built with `make trace`)
+    c_lib.trace_enabled.argtypes = []
+    c_lib.trace_enabled.restype = c_bool
+
+    c_lib.trace_drain.argtypes = [POINTER(TraceRecord), c_int]
+    c_lib.trace_drain.restype = c_int
+
+    c_lib.trace_dropped_count.argtypes = []
+    c_lib.trace_dropped_count.restype = c_long
+
 # ============================================================================
 # PYTHON WRAPPER CLASS
 # ============================================================================
@@ -211,18 +436,62 @@ class MusicQueueWrapper:
     """
     
     def __init__(self, heap_capacity: int = 1000):
-        """Initialize the music queue manager"""
+        """Initialize the music queue manager
+
+        heap_capacity is only the initial size of the recommendation heap;
+        the C heap grows as more songs are ranked.
+        """
         if not c_lib:
             raise RuntimeError("CRITICAL ERROR: C library not loaded. Python fallback is strictly forbidden.")
         
         self.manager = c_lib.manager_create(heap_capacity)
         if not self.manager:
             raise RuntimeError("CRITICAL ERROR: Failed to create C manager.")
+
+        # Reusable export buffers for get_queue and search/recommendation
+        # results; they grow on demand so steady-state calls allocate nothing in C
+        self._queue_buffer = array('i', bytes(4 * 1024))
+        self._result_buffer = array('i', bytes(4 * 1024))
+        self._current_index = c_int(-1)
     
     def add_song(self, song_id: int, title: str, artist: str, likes: int = 0, play_count: int = 0) -> bool:
         """Add a song to the queue using C logic"""
         return c_lib.manager_add_song(self.manager, song_id, title.encode('utf-8'), artist.encode('utf-8'), likes, play_count)
     
+    def index_song(self, song_id: int, title: str, artist: str, album: Optional[str] = None) -> bool:
+        """Make a catalog song searchable by title, artist and album words"""
+        return c_lib.manager_index_song(self.manager, song_id, title.encode('utf-8'), artist.encode('utf-8'),
+                                        album.encode('utf-8') if album else None)
+
+    def unindex_song(self, song_id: int) -> bool:
+        """Stop a song from matching searches, e.g. after deleting it"""
+        return c_lib.manager_unindex_song(self.manager, song_id)
+
+    def update_song(self, song_id: int, title: str, artist: str, album: Optional[str] = None) -> bool:
+        """Re-index a song after its title, artist or album changed"""
+        return c_lib.manager_update_song(self.manager, song_id, title.encode('utf-8'), artist.encode('utf-8'),
+                                         album.encode('utf-8') if album else None)
+
+    def unrank_song(self, song_id: int) -> bool:
+        """Drop a song from the recommendations, e.g. after deleting it"""
+        return c_lib.manager_unrank_song(self.manager, song_id)
+
+    def save_index(self, directory: str) -> bool:
+        """Write the search indexes to titles.idx / artists.idx in directory"""
+        return c_lib.manager_save_index(self.manager, directory.encode('utf-8'))
+
+    def load_index(self, directory: str) -> bool:
+        """Map search indexes saved by save_index; False if missing or stale"""
+        return c_lib.manager_load_index(self.manager, directory.encode('utf-8'))
+
+    def log_index_edit(self, directory: str, song_id: int) -> bool:
+        """Note an edited or deleted song in directory's edit log; load_index drops its saved copy"""
+        return c_lib.manager_log_index_edit(self.manager, directory.encode('utf-8'), song_id)
+
+    def is_indexed(self, song_id: int) -> bool:
+        """Whether song_id is already searchable"""
+        return c_lib.manager_is_indexed(self.manager, song_id)
+    
     def remove_song(self, song_id: int) -> bool:
         """Remove a song from the queue"""
         return c_lib.manager_remove_song(self.manager, song_id)
@@ -243,6 +512,18 @@ class MusicQueueWrapper:
         """Move song down in queue"""
         return c_lib.manager_move_down(self.manager, song_id)
     
+    def move_to(self, song_id: int, position: int) -> bool:
+        """Move song to a queue position"""
+        return c_lib.manager_move_to(self.manager, song_id, position)
+    
+    def index_of(self, song_id: int) -> int:
+        """Get queue position of a song, or -1"""
+        return c_lib.manager_index_of(self.manager, song_id)
+    
+    def song_at(self, position: int) -> int:
+        """Get song ID at a queue position, or -1"""
+        return c_lib.manager_get_song_at(self.manager, position)
+    
     def rotate(self, forward: bool = True) -> bool:
         """Rotate the circular queue"""
         return c_lib.manager_rotate_queue(self.manager, forward)
@@ -251,35 +532,77 @@ class MusicQueueWrapper:
         """Update song priority in C heap"""
         return c_lib.manager_update_priority(self.manager, song_id, likes, play_count)
     
+    def build_recommendations(self, songs: List[tuple]) -> bool:
+        """Bulk-load (song_id, likes, play_count) tuples into the C heap in O(n)"""
+        n = len(songs)
+        song_ids = (c_int * n)(*(s[0] for s in songs))
+        likes = (c_int * n)(*(s[1] for s in songs))
+        play_counts = (c_int * n)(*(s[2] for s in songs))
+        return c_lib.manager_build_recommendations(self.manager, song_ids, likes, play_counts, n)
+    
+    def _fill_results(self, fn, *args) -> List[int]:
+        """Call a C function that writes IDs into (buffer, cap) and returns the match count"""
+        while True:
+            cap = len(self._result_buffer)
+            view = (c_int * cap).from_buffer(self._result_buffer)
+            count = fn(self.manager, *args, view, cap)
+            del view  # Release the buffer export so the array can be resized
+            if count <= cap:
+                return self._result_buffer[:count].tolist()
+            self._result_buffer = array('i', bytes(4 * max(count, 2 * cap)))
+
     def search_songs(self, query: str) -> List[int]:
-        """Search songs using C Trie"""
-        node_ptr = c_lib.manager_search_songs(self.manager, query.encode('utf-8'))
-        results = []
-        current = node_ptr
-        while current:
-            results.append(current.contents.song_id)
-            current = current.contents.next
-        return list(set(results)) # Deduplicate if any duplicates in trie nodes
+        """Songs whose title/album words start with every word of query (C word index)"""
+        return self._fill_results(c_lib.manager_search_songs_into, query.encode('utf-8'))
 
     def search_artists(self, query: str) -> List[int]:
-        """Search artists using C Trie"""
-        node_ptr = c_lib.manager_search_artists(self.manager, query.encode('utf-8'))
-        results = []
-        current = node_ptr
-        while current:
-            results.append(current.contents.song_id)
-            current = current.contents.next
-        return list(set(results))
+        """Songs whose artist words start with every word of query (C word index)"""
+        return self._fill_results(c_lib.manager_search_artists_into, query.encode('utf-8'))
+
+    def search(self, query: str, flags: int = SEARCH_ALL | SEARCH_FUZZY) -> List[int]:
+        """Unique songs matching query in the indexes selected by flags, best ranked first"""
+        return self._fill_results(c_lib.manager_search, query.encode('utf-8'), flags)
+
+    def search_songs_fuzzy(self, query: str, max_edits: int = 2) -> List[int]:
+        """Like search_songs, allowing up to max_edits typos per word"""
+        return self._fill_results(c_lib.manager_search_songs_fuzzy_into, query.encode('utf-8'), max_edits)
+
+    def search_artists_fuzzy(self, query: str, max_edits: int = 2) -> List[int]:
+        """Like search_artists, allowing up to max_edits typos per word"""
+        return self._fill_results(c_lib.manager_search_artists_fuzzy_into, query.encode('utf-8'), max_edits)
+
+    def _result_view(self, count: int):
+        """ctypes view over the first count slots of the reusable result buffer"""
+        if len(self._result_buffer) < count:
+            self._result_buffer = array('i', bytes(4 * count))
+        return (c_int * count).from_buffer(self._result_buffer)
+
+    def suggest_songs(self, prefix: str, limit: int = 10) -> List[int]:
+        """Best-ranked songs whose title starts with prefix"""
+        if limit <= 0:
+            return []
+        view = self._result_view(limit)
+        count = c_lib.manager_suggest_songs(self.manager, prefix.encode('utf-8'), limit, view)
+        del view
+        return self._result_buffer[:count].tolist()
+
+    def suggest_artists(self, prefix: str, limit: int = 10) -> List[int]:
+        """Best-ranked songs whose artist starts with prefix"""
+        if limit <= 0:
+            return []
+        view = self._result_view(limit)
+        count = c_lib.manager_suggest_artists(self.manager, prefix.encode('utf-8'), limit, view)
+        del view
+        return self._result_buffer[:count].tolist()
 
     def get_recommendations(self, limit: int = 10) -> List[int]:
         """Get recommended song IDs from the heap"""
-        node_ptr = c_lib.manager_get_recommendations(self.manager, limit)
-        results = []
-        current = node_ptr
-        while current:
-            results.append(current.contents.song_id)
-            current = current.contents.next
-        return results
+        if limit <= 0:
+            return []
+        view = self._result_view(limit)
+        count = c_lib.manager_get_recommendations_into(self.manager, view, limit)
+        del view
+        return self._result_buffer[:count].tolist()
 
     def undo(self) -> bool:
         """Undo last operation"""
@@ -288,23 +611,106 @@ class MusicQueueWrapper:
     def redo(self) -> bool:
         """Redo last undone operation"""
         return c_lib.manager_redo(self.manager)
+
+    def apply_batch(self, ops: List[Dict]) -> Tuple[bool, List[bool]]:
+        """Apply queue operations atomically as one undo entry
+
+        Each op is a dict with 'op' (an OPERATION_TYPES name) and the fields
+        it needs: song_id, position (move_to), forward (skip, rotate), title,
+        artist, likes and play_count (add, update_priority). Returns whether
+        the batch was applied and each op's own outcome; on failure nothing
+        is applied. A batch of more than one op must be shorter than the
+        history depth (set_history_depth) so one undo reverts all of it;
+        longer batches are rejected.
+        """
+        n = len(ops)
+        batch = (QueueOp * n)()
+        for slot, op in zip(batch, ops):
+            slot.type = OPERATION_TYPES.index(op['op'])
+            slot.song_id = op.get('song_id', -1)
+            slot.position = op.get('position', -1)
+            slot.forward = op.get('forward', True)
+            slot.likes = op.get('likes', 0)
+            slot.play_count = op.get('play_count', 0)
+            slot.title = (op.get('title') or '').encode('utf-8')
+            slot.artist = (op.get('artist') or '').encode('utf-8')
+        results = (c_bool * n)()
+        ok = c_lib.manager_apply_batch(self.manager, batch, n, results)
+        return ok, list(results)
+
+    def set_history_depth(self, depth: int) -> bool:
+        """Keep at most depth operations of undo and redo history"""
+        return c_lib.manager_set_history_depth(self.manager, depth)
+
+    def open_log(self, directory: str) -> bool:
+        """Restore the queue from the write-ahead log in directory and keep logging to it
+
+        Must be called while the queue is empty. Afterwards every queue
+        change is appended to the log; False if the log cannot be recovered.
+        """
+        return c_lib.manager_open_log(self.manager, directory.encode('utf-8'))
+
+    def commit_log(self) -> bool:
+        """Flush logged queue changes to disk now rather than with their group
+
+        False if the log is not open or a write to it has failed; nothing
+        more is logged after a failure.
+        """
+        return c_lib.manager_commit_log(self.manager)
+
+    def close_log(self) -> None:
+        """Sync and close the queue log; later changes are not logged"""
+        c_lib.manager_close_log(self.manager)
+
+    def checkpoint(self) -> bool:
+        """Fold the log into a snapshot of the whole queue"""
+        return c_lib.manager_checkpoint(self.manager)
     
     def get_current_song(self) -> int:
         """Get currently playing song ID"""
         return c_lib.manager_get_current_song(self.manager)
     
+    def export_queue(self) -> Tuple[List[int], int]:
+        """Get all songs in queue order and the position of the current song (-1 if none)
+
+        The C side fills a reusable buffer in one call; it is only reallocated
+        when the queue outgrows it.
+        """
+        while True:
+            cap = len(self._queue_buffer)
+            view = (c_int * cap).from_buffer(self._queue_buffer)
+            size = c_lib.manager_export_queue(self.manager, view, cap, byref(self._current_index))
+            del view  # Release the buffer export so the array can be resized
+            if size <= cap:
+                return self._queue_buffer[:size].tolist(), self._current_index.value
+            self._queue_buffer = array('i', bytes(4 * max(size, 2 * cap)))
+
     def get_queue(self) -> List[int]:
         """Get all songs in queue as a list"""
-        songs = []
-        if self.manager and self.manager.contents.queue:
-            head = self.manager.contents.queue.contents.head
-            size = self.manager.contents.queue.contents.size
-            current_node = head
-            for _ in range(size):
-                if not current_node: break
-                songs.append(current_node.contents.song_id)
-                current_node = current_node.contents.next
-        return songs
+        return self.export_queue()[0]
+    
+    def get_pool_stats(self) -> Dict[str, Dict[str, int]]:
+        """Get slab usage of the C node pools, keyed by node type"""
+        stats = {}
+        for kind, name in enumerate(POOL_KINDS):
+            s = PoolStats()
+            if c_lib.manager_get_pool_stats(self.manager, kind, byref(s)):
+                stats[name] = {field: getattr(s, field) for field, _ in PoolStats._fields_}
+        return stats
+    
+    def drain_trace(self, max_records: int = 4096) -> List[Dict[str, int]]:
+        """Collect pending queue trace records from the C ring buffers"""
+        if not c_lib.trace_enabled():
+            return []
+        buffer = (TraceRecord * max_records)()
+        count = c_lib.trace_drain(buffer, max_records)
+        return [{
+            'timestamp_ns': r.timestamp_ns,
+            'thread_id': r.thread_id,
+            'event': TRACE_EVENTS[r.event] if r.event < len(TRACE_EVENTS) else r.event,
+            'arg0': r.arg0,
+            'arg1': r.arg1
+        } for r in buffer[:count]]
     
     def get_queue_size(self) -> int:
         """Get queue size"""
@@ -95,6 +95,24 @@ def create_song(title: str, artist: str, duration: int, **kwargs) -> Song:
     finally:
         session.close()
 
+def update_song(song_id: int, **fields) -> Optional[Song]:
+    """Update a song's columns; returns the updated song, or None if missing"""
+    session = get_session()
+    try:
+        song = session.query(Song).filter(Song.id == song_id).first()
+        if not song:
+            return None
+        for name, value in fields.items():
+            setattr(song, name, value)
+        session.commit()
+        session.refresh(song)
+        return song
+    except Exception as e:
+        session.rollback()
+        raise e
+    finally:
+        session.close()
+
 def delete_song(song_id: int) -> bool:
     """Delete a song"""
     session = get_session()
@@ -257,6 +275,18 @@ def get_play_count(song_id: int) -> int:
     finally:
         session.close()
 
+def get_all_play_counts() -> Dict[int, int]:
+    """Get play counts for every song in a single grouped query"""
+    session = get_session()
+    try:
+        from sqlalchemy import func
+        rows = session.query(PlayHistory.song_id, func.count(PlayHistory.id))\
+            .group_by(PlayHistory.song_id)\
+            .all()
+        return {song_id: count for song_id, count in rows}
+    finally:
+        session.close()
+
 def get_popular_songs(limit: int = 10) -> List[Song]:
     """Get most popular songs based on play count"""
     session = get_session()
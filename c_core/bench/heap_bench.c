@@ -0,0 +1,208 @@
+/**
+ * Recommendation Heap Benchmark
+ *
+ * Compares the binary heap against the 4-ary and 8-ary layouts on a
+ * synthetic catalog: bulk build, priority updates (likes/plays) and
+ * extractMax throughput. The first row is the original heap - recursive
+ * sift, array of {song_id, priority} structs, linear song lookup - built by
+ * repeated insertion since it has no bulk build. Its O(n) updates are timed
+ * on at most LEGACY_UPDATES of them.
+ *
+ * Build and run: make bench
+ * Usage: heap_bench [songs] [updates]
+ */
+
+#include "../music_queue_core.h"
+#include <time.h>
+
+#define LEGACY_UPDATES 5000
+
+/**
+ * The heap as it was before the split-array d-ary layout
+ */
+typedef struct {
+  HeapNode *nodes;
+  int size;
+  int capacity;
+} LegacyHeap;
+
+static void legacy_swap(HeapNode *a, HeapNode *b) {
+  HeapNode temp = *a;
+  *a = *b;
+  *b = temp;
+}
+
+static void legacy_up(LegacyHeap *heap, int index) {
+  if (index <= 0)
+    return;
+  int parent = (index - 1) / 2;
+  if (heap->nodes[index].priority > heap->nodes[parent].priority) {
+    legacy_swap(&heap->nodes[index], &heap->nodes[parent]);
+    legacy_up(heap, parent);
+  }
+}
+
+static void legacy_down(LegacyHeap *heap, int index) {
+  int largest = index;
+  int left = 2 * index + 1;
+  int right = 2 * index + 2;
+  if (left < heap->size &&
+      heap->nodes[left].priority > heap->nodes[largest].priority)
+    largest = left;
+  if (right < heap->size &&
+      heap->nodes[right].priority > heap->nodes[largest].priority)
+    largest = right;
+  if (largest != index) {
+    legacy_swap(&heap->nodes[index], &heap->nodes[largest]);
+    legacy_down(heap, largest);
+  }
+}
+
+static void legacy_insert(LegacyHeap *heap, int song_id, float priority) {
+  heap->nodes[heap->size].song_id = song_id;
+  heap->nodes[heap->size].priority = priority;
+  legacy_up(heap, heap->size);
+  heap->size++;
+}
+
+static int legacy_find(LegacyHeap *heap, int song_id) {
+  for (int i = 0; i < heap->size; i++) {
+    if (heap->nodes[i].song_id == song_id)
+      return i;
+  }
+  return -1;
+}
+
+static void legacy_update(LegacyHeap *heap, int song_id, float priority) {
+  int index = legacy_find(heap, song_id);
+  if (index == -1) {
+    legacy_insert(heap, song_id, priority);
+    return;
+  }
+  float old_priority = heap->nodes[index].priority;
+  heap->nodes[index].priority = priority;
+  if (priority > old_priority)
+    legacy_up(heap, index);
+  else
+    legacy_down(heap, index);
+}
+
+static void legacy_extract(LegacyHeap *heap) {
+  heap->nodes[0] = heap->nodes[heap->size - 1];
+  heap->size--;
+  if (heap->size > 0)
+    legacy_down(heap, 0);
+}
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * xorshift32 - deterministic across runs and arities
+ */
+static unsigned int next_random(unsigned int *state) {
+  unsigned int x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+static void run_legacy(int songs, int updates) {
+  unsigned int state = 2463534242u;
+  LegacyHeap heap = {(HeapNode *)malloc(sizeof(HeapNode) * songs), 0, songs};
+
+  double start = now_seconds();
+  for (int i = 0; i < songs; i++)
+    legacy_insert(&heap, i, (float)(next_random(&state) % 100000));
+  double build_time = now_seconds() - start;
+
+  int extracts = songs < updates ? songs : updates;
+  if (updates > LEGACY_UPDATES)
+    updates = LEGACY_UPDATES;
+  start = now_seconds();
+  for (int i = 0; i < updates; i++) {
+    int song_id = next_random(&state) % songs;
+    int index = legacy_find(&heap, song_id);
+    float priority = heap.nodes[index].priority;
+    if (i % 8 == 0)
+      priority = (float)(next_random(&state) % 100000);
+    else
+      priority += (float)(next_random(&state) % 64);
+    legacy_update(&heap, song_id, priority);
+  }
+  double update_time = now_seconds() - start;
+
+  start = now_seconds();
+  for (int i = 0; i < extracts; i++)
+    legacy_extract(&heap);
+  double extract_time = now_seconds() - start;
+
+  printf("%6s  %12.1f  %14.0f  %14.0f\n", "old", build_time * 1000.0,
+         updates / update_time, extracts / extract_time);
+
+  free(heap.nodes);
+}
+
+static void run(int arity, int songs, int updates) {
+  int *song_ids = (int *)malloc(sizeof(int) * songs);
+  float *priorities = (float *)malloc(sizeof(float) * songs);
+  unsigned int state = 2463534242u;
+
+  for (int i = 0; i < songs; i++) {
+    song_ids[i] = i;
+    priorities[i] = (float)(next_random(&state) % 100000);
+  }
+
+  MaxHeap *heap = heap_create_with_arity(1024, arity);
+
+  double start = now_seconds();
+  heap_build_from_array(heap, song_ids, priorities, songs);
+  double build_time = now_seconds() - start;
+
+  // Likes and plays mostly nudge priorities up; occasionally reset them
+  start = now_seconds();
+  for (int i = 0; i < updates; i++) {
+    int song_id = next_random(&state) % songs;
+    float priority = heap_get_priority(heap, song_id);
+    if (i % 8 == 0)
+      priority = (float)(next_random(&state) % 100000);
+    else
+      priority += (float)(next_random(&state) % 64);
+    heap_update_priority(heap, song_id, priority);
+  }
+  double update_time = now_seconds() - start;
+
+  int extracts = songs < updates ? songs : updates;
+  start = now_seconds();
+  for (int i = 0; i < extracts; i++)
+    extractMax(heap);
+  double extract_time = now_seconds() - start;
+
+  printf("%6d  %12.1f  %14.0f  %14.0f\n", arity, build_time * 1000.0,
+         updates / update_time, extracts / extract_time);
+
+  heap_destroy(heap);
+  free(song_ids);
+  free(priorities);
+}
+
+int main(int argc, char **argv) {
+  int songs = argc > 1 ? atoi(argv[1]) : 1000000;
+  int updates = argc > 2 ? atoi(argv[2]) : 1000000;
+
+  printf("Heap benchmark: %d songs, %d updates\n\n", songs, updates);
+  printf("%6s  %12s  %14s  %14s\n", "arity", "build (ms)", "updates/s",
+         "extracts/s");
+
+  run_legacy(songs, updates);
+  run(2, songs, updates);
+  run(4, songs, updates);
+  run(8, songs, updates);
+
+  return 0;
+}
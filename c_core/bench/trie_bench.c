@@ -0,0 +1,252 @@
+/**
+ * Search Trie Benchmark
+ *
+ * Indexes the words of a synthetic catalog of song titles and reports
+ * memory per key next to what the previous 26-pointer-per-character layout
+ * would have needed, plus indexing, autocomplete, two-word search,
+ * typo-tolerant search and title edit throughput, and the cost of saving the
+ * index and serving the same queries from the mapped file.
+ *
+ * Build and run: make bench
+ * Usage: trie_bench [titles]
+ */
+
+#include "../music_queue_core.h"
+#include <time.h>
+
+/**
+ * Node layout before path compression: one node per indexed character
+ */
+typedef struct {
+  void *children[26];
+  void *parent;
+  bool isEnd;
+  void *song_ids;
+  int top_count;
+  HeapNode top[TRIE_TOP_K];
+} CharTrieNode;
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * xorshift32 - deterministic across runs
+ */
+static unsigned int next_random(unsigned int *state) {
+  unsigned int x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+/**
+ * Title of 1-4 words, each 2-4 consonant+vowel syllables
+ */
+static void make_title(char *out, unsigned int *state) {
+  static const char consonants[] = "bcdfghjklmnprstvwz";
+  static const char vowels[] = "aeiou";
+  int words = 1 + next_random(state) % 4;
+  int len = 0;
+  for (int w = 0; w < words; w++) {
+    if (w > 0)
+      out[len++] = ' ';
+    int syllables = 2 + next_random(state) % 3;
+    for (int s = 0; s < syllables; s++) {
+      out[len++] = consonants[next_random(state) % (sizeof(consonants) - 1)];
+      out[len++] = vowels[next_random(state) % (sizeof(vowels) - 1)];
+    }
+  }
+  out[len] = '\0';
+}
+
+int main(int argc, char **argv) {
+  int titles = argc > 1 ? atoi(argv[1]) : 500000;
+  int queries = 1000000;
+  unsigned int state = 2463534242u;
+
+  char(*catalog)[64] = malloc(sizeof(*catalog) * titles);
+  MaxHeap *heap = heap_create(1024);
+  for (int i = 0; i < titles; i++) {
+    make_title(catalog[i], &state);
+    insertHeap(heap, i, (float)(next_random(&state) % 100000));
+  }
+
+  Trie *trie = trie_create();
+  trie_set_ranking(trie, heap);
+
+  double start = now_seconds();
+  for (int i = 0; i < titles; i++)
+    trie_index_text(trie, catalog[i], i);
+  double insert_time = now_seconds() - start;
+
+  int out[TRIE_TOP_K];
+  long found = 0;
+  start = now_seconds();
+  for (int i = 0; i < queries; i++) {
+    char prefix[4];
+    memcpy(prefix, catalog[next_random(&state) % titles], 3);
+    prefix[3] = '\0';
+    found += trie_top_k(trie, prefix, TRIE_TOP_K, out);
+  }
+  double query_time = now_seconds() - start;
+
+  // Two-word queries: a whole word plus the first letters of another
+  int searches = queries / 10;
+  long matched = 0;
+  start = now_seconds();
+  for (int i = 0; i < searches; i++) {
+    const char *a = catalog[next_random(&state) % titles];
+    const char *b = catalog[next_random(&state) % titles];
+    char query[64];
+    int len = (int)strcspn(a, " ");
+    memcpy(query, a, len);
+    query[len++] = ' ';
+    memcpy(query + len, b, 2);
+    query[len + 2] = '\0';
+    matched += trie_search_words(trie, query, NULL, 0);
+  }
+  double search_time = now_seconds() - start;
+
+  // One word of a title with a letter replaced, within two edits
+  int fuzzy_searches = queries / 100;
+  long fuzzy_matched = 0;
+  start = now_seconds();
+  for (int i = 0; i < fuzzy_searches; i++) {
+    const char *title = catalog[next_random(&state) % titles];
+    char query[64];
+    int len = (int)strcspn(title, " ");
+    memcpy(query, title, len);
+    query[len] = '\0';
+    query[next_random(&state) % len] = 'x';
+    fuzzy_matched += trie_search_fuzzy(trie, query, 2, NULL, 0);
+  }
+  double fuzzy_time = now_seconds() - start;
+
+  // Edit a title: drop every key of the song and index the new text
+  int updates = titles / 10;
+  start = now_seconds();
+  for (int i = 0; i < updates; i++) {
+    int song_id = next_random(&state) % titles;
+    trie_remove_song(trie, song_id);
+    make_title(catalog[song_id], &state);
+    trie_index_text(trie, catalog[song_id], song_id);
+  }
+  double update_time = now_seconds() - start;
+
+  // Save, then map the image into an empty trie and rerun autocomplete
+  const char *path = "trie_bench.idx";
+  start = now_seconds();
+  bool saved = trie_save(trie, path);
+  double save_time = now_seconds() - start;
+
+  Trie *loaded = trie_create();
+  trie_set_ranking(loaded, heap);
+  start = now_seconds();
+  bool mapped = saved && trie_load(loaded, path);
+  double load_time = now_seconds() - start;
+
+  long loaded_found = 0;
+  start = now_seconds();
+  for (int i = 0; mapped && i < queries; i++) {
+    char prefix[4];
+    memcpy(prefix, catalog[next_random(&state) % titles], 3);
+    prefix[3] = '\0';
+    loaded_found += trie_top_k(loaded, prefix, TRIE_TOP_K, out);
+  }
+  double loaded_query_time = now_seconds() - start;
+
+  long loaded_matched = 0;
+  start = now_seconds();
+  for (int i = 0; mapped && i < searches; i++) {
+    const char *a = catalog[next_random(&state) % titles];
+    const char *b = catalog[next_random(&state) % titles];
+    char query[64];
+    int len = (int)strcspn(a, " ");
+    memcpy(query, a, len);
+    query[len++] = ' ';
+    memcpy(query + len, b, 2);
+    query[len + 2] = '\0';
+    loaded_matched += trie_search_words(loaded, query, NULL, 0);
+  }
+  double loaded_search_time = now_seconds() - start;
+
+  // Re-rank songs after mapping; the image must agree with memory
+  int reranks = titles / 100;
+  long mismatches = 0;
+  start = now_seconds();
+  for (int i = 0; mapped && i < reranks; i++) {
+    int song_id = next_random(&state) % titles;
+    float priority = (float)(next_random(&state) % 200000);
+    heap_update_priority(heap, song_id, priority);
+    trie_update_priority(trie, song_id, priority);
+    trie_update_priority(loaded, song_id, priority);
+  }
+  double rerank_time = now_seconds() - start;
+  for (int i = 0; mapped && i < queries / 10; i++) {
+    char prefix[4];
+    memcpy(prefix, catalog[next_random(&state) % titles], 2);
+    prefix[2] = '\0';
+    int expected[TRIE_TOP_K];
+    int count = trie_top_k(trie, prefix, TRIE_TOP_K, expected);
+    if (trie_top_k(loaded, prefix, TRIE_TOP_K, out) != count ||
+        memcmp(out, expected, sizeof(int) * count) != 0)
+      mismatches++;
+  }
+
+  TrieStats loaded_stats;
+  trie_get_stats(loaded, &loaded_stats);
+
+  TrieStats stats;
+  trie_get_stats(trie, &stats);
+  long total = stats.node_bytes + stats.label_bytes + stats.child_bytes +
+               stats.entry_bytes;
+  long char_nodes = stats.label_chars + 1;
+  long char_total = char_nodes * (long)sizeof(CharTrieNode) + stats.entry_bytes;
+
+  printf("Trie benchmark: %d titles, %d distinct words\n\n", titles,
+         stats.key_count);
+  printf("%-22s  %12s  %12s  %12s\n", "layout", "nodes", "MiB",
+         "bytes/key");
+  printf("%-22s  %12ld  %12.1f  %12.1f\n", "26-way (estimated)", char_nodes,
+         char_total / 1048576.0, (double)char_total / stats.key_count);
+  printf("%-22s  %12d  %12.1f  %12.1f\n", "radix", stats.node_count,
+         total / 1048576.0, (double)total / stats.key_count);
+  printf("\n  nodes %ld B  labels %ld B  children %ld B  entries %ld B\n",
+         stats.node_bytes, stats.label_bytes, stats.child_bytes,
+         stats.entry_bytes);
+  printf("\nindex: %.0f titles/s   top-%d: %.0f queries/s (%.1f hits avg)\n",
+         titles / insert_time, TRIE_TOP_K, queries / query_time,
+         (double)found / queries);
+  printf("two-word search: %.0f queries/s (%.1f matches avg)\n",
+         searches / search_time, (double)matched / searches);
+  printf("fuzzy search (2 edits): %.1f us/query (%.1f matches avg)\n",
+         fuzzy_time * 1e6 / fuzzy_searches,
+         (double)fuzzy_matched / fuzzy_searches);
+  printf("title edits (remove + re-index): %.0f songs/s\n",
+         updates / update_time);
+  if (mapped) {
+    printf("\nimage: %.1f MiB, saved in %.0f ms, mapped in %.3f ms\n",
+           loaded_stats.image_bytes / 1048576.0, save_time * 1e3,
+           load_time * 1e3);
+    printf("mapped top-%d: %.0f queries/s (%.1f hits avg)\n", TRIE_TOP_K,
+           queries / loaded_query_time, (double)loaded_found / queries);
+    printf("mapped two-word search: %.0f queries/s (%.1f matches avg)\n",
+           searches / loaded_search_time, (double)loaded_matched / searches);
+    printf("mapped re-rank: %.0f songs/s, %ld of %d top-%d lists differ\n",
+           reranks / rerank_time, mismatches, queries / 10, TRIE_TOP_K);
+  } else {
+    printf("\nimage: could not save or map %s\n", path);
+  }
+
+  trie_destroy(loaded);
+  remove(path);
+  trie_destroy(trie);
+  heap_destroy(heap);
+  free(catalog);
+  return mismatches == 0 ? 0 : 1;
+}
@@ -3,9 +3,27 @@
  *
  * Maintains the main playback queue with circularity
  * Supports bidirectional navigation and rotation
+ *
+ * The same nodes also form an implicit treap (a randomized balanced tree
+ * ordered by queue position, with subtree sizes), so index-of, item-at and
+ * move-to-position are O(log n) expected without walking the ring.
  */
 
 #include "music_queue_core.h"
+#include "trace.h"
+
+// Helper function prototypes
+static void index_add(DoublyLinkedList *list, DLLNode *node);
+static void index_remove(DoublyLinkedList *list, DLLNode *node);
+static void index_reorder(DoublyLinkedList *list, DLLNode *node);
+static void free_node(DoublyLinkedList *list, DLLNode *node);
+static int tree_count(DLLNode *node);
+static void tree_update(DLLNode *node);
+static DLLNode *tree_merge(DLLNode *a, DLLNode *b);
+static void tree_split(DLLNode *node, int k, DLLNode **left, DLLNode **right);
+static void tree_insert_at(DoublyLinkedList *list, DLLNode *node, int index);
+static void tree_remove(DoublyLinkedList *list, DLLNode *node);
+static void tree_move(DoublyLinkedList *list, DLLNode *node, int index);
 
 /**
  * Create a new circular doubly linked list
@@ -19,6 +37,14 @@ DoublyLinkedList *dll_create() {
   list->tail = NULL;
   list->current = NULL;
   list->size = 0;
+  list->root = NULL;
+  list->seed = 2463534242u;
+  list->pool = NULL;
+  list->index = hashmap_create(64);
+  if (!list->index) {
+    free(list);
+    return NULL;
+  }
 
   return list;
 }
@@ -28,15 +54,33 @@ DoublyLinkedList *dll_create() {
  * Operation: enqueue
  */
 DLLNode *dll_insert_end(DoublyLinkedList *list, int song_id) {
-  if (!list)
+  return list ? dll_insert_at(list, song_id, list->size) : NULL;
+}
+
+/**
+ * Insert song so that it ends up at the given position (0..size)
+ * Time Complexity: O(log n) expected, O(d log n) among d earlier copies of
+ * the song
+ */
+DLLNode *dll_insert_at(DoublyLinkedList *list, int song_id, int index) {
+  if (!list || index < 0 || index > list->size)
     return NULL;
 
-  DLLNode *new_node = (DLLNode *)malloc(sizeof(DLLNode));
+  DLLNode *new_node = list->pool ? (DLLNode *)pool_alloc(list->pool)
+                                 : (DLLNode *)malloc(sizeof(DLLNode));
   if (!new_node)
     return NULL;
 
+  // A song's first copy claims its index slot up front, the only step
+  // that can fail
   new_node->song_id = song_id;
+  bool copy = hashmap_get(list->index, song_id) != NULL;
+  if (!copy && !hashmap_put(list->index, song_id, new_node)) {
+    free_node(list, new_node);
+    return NULL;
+  }
 
+  DLLNode *successor = dll_get_at(list, index);
   if (list->head == NULL) {
     // First node
     new_node->next = new_node;
@@ -44,6 +88,13 @@ DLLNode *dll_insert_end(DoublyLinkedList *list, int song_id) {
     list->head = new_node;
     list->tail = new_node;
     list->current = new_node;
+  } else if (successor) {
+    new_node->prev = successor->prev;
+    new_node->next = successor;
+    successor->prev->next = new_node;
+    successor->prev = new_node;
+    if (list->head == successor)
+      list->head = new_node;
   } else {
     // Standard insert at end
     new_node->prev = list->tail;
@@ -53,8 +104,15 @@ DLLNode *dll_insert_end(DoublyLinkedList *list, int song_id) {
     list->tail = new_node;
   }
 
+  tree_insert_at(list, new_node, index);
   list->size++;
-  printf("CDLL used for queue operation: enqueue %d\n", song_id);
+  if (copy) {
+    index_add(list, new_node);
+  } else {
+    new_node->next_dup = NULL;
+    new_node->prev_dup = new_node;
+  }
+  TRACE(TRACE_DLL_INSERT, song_id, list->size);
   return new_node;
 }
 
@@ -67,6 +125,8 @@ bool dll_remove(DoublyLinkedList *list, DLLNode *node) {
     return false;
 
   int song_id = node->song_id;
+  index_remove(list, node);
+  tree_remove(list, node);
 
   if (list->size == 1) {
     list->head = NULL;
@@ -87,9 +147,9 @@ bool dll_remove(DoublyLinkedList *list, DLLNode *node) {
     }
   }
 
-  free(node);
+  free_node(list, node);
   list->size--;
-  printf("CDLL used for queue operation: remove %d\n", song_id);
+  TRACE(TRACE_DLL_REMOVE, song_id, list->size);
   return true;
 }
 
@@ -101,6 +161,7 @@ bool dll_move_up(DoublyLinkedList *list, DLLNode *node) {
     return false;
 
   DLLNode *prev = node->prev;
+  int index = dll_index_of(list, node);
 
   // Swap IDs for simplicity in CDLL if we don't want to re-link everything
   // But requirement says CDLL ops, so let's re-link properly.
@@ -108,6 +169,18 @@ bool dll_move_up(DoublyLinkedList *list, DLLNode *node) {
   DLLNode *p_prev = prev->prev;
   DLLNode *n_next = node->next;
 
+  // A two-node ring already reads the same both ways round; swapping the
+  // ends is enough (relinking would make each node point at itself)
+  if (list->size == 2) {
+    list->head = list->head->next;
+    list->tail = list->tail->next;
+    tree_move(list, node, index == 0 ? 1 : 0);
+    index_reorder(list, node);
+    index_reorder(list, prev);
+    TRACE(TRACE_DLL_MOVE_UP, node->song_id, index);
+    return true;
+  }
+
   // Link p_prev to node
   p_prev->next = node;
   node->prev = p_prev;
@@ -131,7 +204,18 @@ bool dll_move_up(DoublyLinkedList *list, DLLNode *node) {
   else if (list->tail == prev)
     list->tail = node;
 
-  printf("CDLL used for queue operation: moveUp %d\n", node->song_id);
+  // Mirror the swap in the position tree; moving the head up wraps it
+  // around, exchanging the first and last songs
+  if (index > 0) {
+    tree_move(list, node, index - 1);
+  } else {
+    tree_move(list, prev, 0);
+    tree_move(list, node, list->size - 1);
+  }
+  index_reorder(list, node);
+  index_reorder(list, prev);
+
+  TRACE(TRACE_DLL_MOVE_UP, node->song_id, index);
   return true;
 }
 
@@ -141,7 +225,7 @@ bool dll_move_up(DoublyLinkedList *list, DLLNode *node) {
 bool dll_move_down(DoublyLinkedList *list, DLLNode *node) {
   if (!list || !node || list->size < 2)
     return false;
-  printf("CDLL used for queue operation: moveDown %d\n", node->song_id);
+  TRACE(TRACE_DLL_MOVE_DOWN, node->song_id, -1);
   return dll_move_up(list, node->next);
 }
 
@@ -152,14 +236,18 @@ void dll_rotate(DoublyLinkedList *list, bool forward) {
   if (!list || list->size < 2)
     return;
 
+  DLLNode *moved = forward ? list->head : list->tail;
   if (forward) {
+    tree_move(list, moved, list->size - 1);
     list->head = list->head->next;
     list->tail = list->tail->next;
   } else {
+    tree_move(list, moved, 0);
     list->head = list->head->prev;
     list->tail = list->tail->prev;
   }
-  printf("CDLL used for queue operation: rotate\n");
+  index_reorder(list, moved);
+  TRACE(TRACE_DLL_ROTATE, forward, list->size);
 }
 
 /**
@@ -182,20 +270,101 @@ DLLNode *dll_get_prev(DoublyLinkedList *list, DLLNode *current) {
 
 /**
  * Find node by song ID (Note: can be multiple)
+ * Returns the song's first copy in queue order, from head; the others
+ * follow it through next_dup
+ * Time Complexity: O(1) average via the song_id index
  */
 DLLNode *dll_find_by_id(DoublyLinkedList *list, int song_id) {
   if (!list || list->size == 0)
     return NULL;
+  return (DLLNode *)hashmap_get(list->index, song_id);
+}
 
-  DLLNode *current = list->head;
-  for (int i = 0; i < list->size; i++) {
-    if (current->song_id == song_id)
-      return current;
-    current = current->next;
+/**
+ * Get the position of a node, counted from head
+ * Time Complexity: O(log n) expected
+ */
+int dll_index_of(DoublyLinkedList *list, DLLNode *node) {
+  if (!list || !node)
+    return -1;
+
+  int index = tree_count(node->left);
+  while (node->parent) {
+    if (node == node->parent->right)
+      index += tree_count(node->parent->left) + 1;
+    node = node->parent;
+  }
+  return index;
+}
+
+/**
+ * Get the node at a position, counted from head
+ * Time Complexity: O(log n) expected
+ */
+DLLNode *dll_get_at(DoublyLinkedList *list, int index) {
+  if (!list || index < 0 || index >= list->size)
+    return NULL;
+
+  DLLNode *node = list->root;
+  while (node) {
+    int left = tree_count(node->left);
+    if (index < left) {
+      node = node->left;
+    } else if (index == left) {
+      return node;
+    } else {
+      index -= left + 1;
+      node = node->right;
+    }
   }
   return NULL;
 }
 
+/**
+ * Move a node so that it ends up at the given position
+ * The currently playing node is unaffected
+ * Time Complexity: O(log n) expected
+ */
+bool dll_move_to(DoublyLinkedList *list, DLLNode *node, int index) {
+  if (!list || !node || index < 0 || index >= list->size)
+    return false;
+
+  int old_index = dll_index_of(list, node);
+  if (old_index == index)
+    return true;
+
+  // Unlink from the ring
+  if (list->head == node)
+    list->head = node->next;
+  if (list->tail == node)
+    list->tail = node->prev;
+  node->prev->next = node->next;
+  node->next->prev = node->prev;
+  tree_remove(list, node);
+
+  // Relink before the node now holding the target position, or at the end
+  DLLNode *successor = dll_get_at(list, index);
+  if (successor) {
+    node->prev = successor->prev;
+    node->next = successor;
+    successor->prev->next = node;
+    successor->prev = node;
+    if (list->head == successor)
+      list->head = node;
+  } else {
+    node->prev = list->tail;
+    node->next = list->head;
+    list->tail->next = node;
+    list->head->prev = node;
+    list->tail = node;
+  }
+  tree_insert_at(list, node, index);
+  index_reorder(list, node);
+
+  TRACE(TRACE_DLL_MOVE_TO, node->song_id, index);
+  return true;
+}
+
 /**
  * Display the queue
  */
@@ -227,7 +396,8 @@ void dll_destroy(DoublyLinkedList *list) {
   if (!list)
     return;
 
-  if (list->size > 0) {
+  // Pooled nodes are released with their slabs by the pool owner
+  if (list->size > 0 && !list->pool) {
     DLLNode *current = list->head;
     for (int i = 0; i < list->size; i++) {
       DLLNode *next = current->next;
@@ -236,5 +406,202 @@ void dll_destroy(DoublyLinkedList *list) {
     }
   }
 
+  hashmap_destroy(list->index);
   free(list);
 }
+
+// ============================================================================
+// HELPER FUNCTIONS
+// ============================================================================
+
+static void free_node(DoublyLinkedList *list, DLLNode *node) {
+  if (list->pool)
+    pool_free(list->pool, node);
+  else
+    free(node);
+}
+
+/**
+ * Link a positioned node into its song's non-empty occurrence chain, which
+ * is kept in queue order
+ * Time Complexity: O(log n) when the node is the song's last copy,
+ * otherwise O(d log n) for d copies
+ */
+static void index_add(DoublyLinkedList *list, DLLNode *node) {
+  DLLNode *first = (DLLNode *)hashmap_get(list->index, node->song_id);
+  DLLNode *last = first->prev_dup;
+  int index = dll_index_of(list, node);
+
+  if (dll_index_of(list, last) < index) {
+    last->next_dup = node;
+    node->next_dup = NULL;
+    node->prev_dup = last;
+    first->prev_dup = node;
+    return;
+  }
+
+  if (index < dll_index_of(list, first)) {
+    node->next_dup = first;
+    node->prev_dup = last;
+    first->prev_dup = node;
+    hashmap_put(list->index, node->song_id, node);
+    return;
+  }
+
+  // Somewhere in between: after the last copy ahead of it
+  DLLNode *before = first;
+  while (dll_index_of(list, before->next_dup) < index)
+    before = before->next_dup;
+  node->next_dup = before->next_dup;
+  node->prev_dup = before;
+  before->next_dup->prev_dup = node;
+  before->next_dup = node;
+}
+
+/**
+ * Unlink a node from its song's occurrence chain
+ */
+static void index_remove(DoublyLinkedList *list, DLLNode *node) {
+  DLLNode *first = (DLLNode *)hashmap_get(list->index, node->song_id);
+  if (!first)
+    return;
+
+  if (node == first) {
+    DLLNode *next = node->next_dup;
+    if (next) {
+      next->prev_dup = node->prev_dup;
+      hashmap_put(list->index, node->song_id, next);
+    } else {
+      hashmap_remove(list->index, node->song_id);
+    }
+    return;
+  }
+
+  node->prev_dup->next_dup = node->next_dup;
+  if (node->next_dup)
+    node->next_dup->prev_dup = node->prev_dup;
+  else
+    first->prev_dup = node->prev_dup;
+}
+
+/**
+ * Re-place a node in its chain after it moved in the queue
+ */
+static void index_reorder(DoublyLinkedList *list, DLLNode *node) {
+  DLLNode *first = (DLLNode *)hashmap_get(list->index, node->song_id);
+  if (first == node && !node->next_dup)
+    return;
+  index_remove(list, node);
+  index_add(list, node);
+}
+
+// ============================================================================
+// POSITION TREE (implicit treap over the queue nodes)
+// ============================================================================
+
+static int tree_count(DLLNode *node) { return node ? node->count : 0; }
+
+/**
+ * Recompute a node's subtree size and re-point its children at it
+ */
+static void tree_update(DLLNode *node) {
+  node->count = 1 + tree_count(node->left) + tree_count(node->right);
+  if (node->left)
+    node->left->parent = node;
+  if (node->right)
+    node->right->parent = node;
+}
+
+/**
+ * Concatenate two trees; every node of a precedes every node of b
+ */
+static DLLNode *tree_merge(DLLNode *a, DLLNode *b) {
+  if (!a)
+    return b;
+  if (!b)
+    return a;
+
+  if (a->weight > b->weight) {
+    a->right = tree_merge(a->right, b);
+    tree_update(a);
+    return a;
+  }
+  b->left = tree_merge(a, b->left);
+  tree_update(b);
+  return b;
+}
+
+/**
+ * Split a tree into its first k nodes and the rest
+ */
+static void tree_split(DLLNode *node, int k, DLLNode **left, DLLNode **right) {
+  if (!node) {
+    *left = NULL;
+    *right = NULL;
+    return;
+  }
+
+  if (tree_count(node->left) >= k) {
+    tree_split(node->left, k, left, &node->left);
+    tree_update(node);
+    *right = node;
+  } else {
+    tree_split(node->right, k - tree_count(node->left) - 1, &node->right,
+               right);
+    tree_update(node);
+    *left = node;
+  }
+}
+
+/**
+ * Insert a detached node at a position
+ */
+static void tree_insert_at(DoublyLinkedList *list, DLLNode *node, int index) {
+  // xorshift32 gives each node a random heap weight
+  unsigned int x = list->seed;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  list->seed = x;
+
+  node->left = NULL;
+  node->right = NULL;
+  node->parent = NULL;
+  node->weight = x;
+  node->count = 1;
+
+  DLLNode *before;
+  DLLNode *after;
+  tree_split(list->root, index, &before, &after);
+  list->root = tree_merge(tree_merge(before, node), after);
+  list->root->parent = NULL;
+}
+
+/**
+ * Detach a node, splicing its merged children into its place
+ */
+static void tree_remove(DoublyLinkedList *list, DLLNode *node) {
+  DLLNode *parent = node->parent;
+  DLLNode *replacement = tree_merge(node->left, node->right);
+
+  if (replacement)
+    replacement->parent = parent;
+
+  if (!parent)
+    list->root = replacement;
+  else if (parent->left == node)
+    parent->left = replacement;
+  else
+    parent->right = replacement;
+
+  for (DLLNode *p = parent; p; p = p->parent)
+    p->count--;
+}
+
+/**
+ * Reposition a node in the tree only; the ring is relinked by the caller
+ */
+static void tree_move(DoublyLinkedList *list, DLLNode *node, int index) {
+  tree_remove(list, node);
+  tree_insert_at(list, node, index);
+}
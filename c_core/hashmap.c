@@ -0,0 +1,189 @@
+/**
+ * HashMap Implementation
+ *
+ * Maps song_id to a pointer (e.g. the first queue node holding that song)
+ * Open addressing with linear probing and backward-shift deletion, so no
+ * tombstones accumulate under heavy add/remove traffic
+ */
+
+#include "music_queue_core.h"
+
+#define HASHMAP_MAX_LOAD_NUM 7
+#define HASHMAP_MAX_LOAD_DEN 10
+
+// Helper function prototypes
+static unsigned int hash_key(int key, int capacity);
+static bool hashmap_resize(HashMap *map, int new_capacity);
+
+/**
+ * Create a new hashmap
+ * Capacity is rounded up to a power of two
+ * Time Complexity: O(capacity)
+ */
+HashMap *hashmap_create(int capacity) {
+  HashMap *map = (HashMap *)malloc(sizeof(HashMap));
+  if (!map)
+    return NULL;
+
+  int rounded = 8;
+  while (rounded < capacity)
+    rounded *= 2;
+
+  map->entries = (HashEntry *)calloc(rounded, sizeof(HashEntry));
+  if (!map->entries) {
+    free(map);
+    return NULL;
+  }
+
+  map->capacity = rounded;
+  map->size = 0;
+
+  return map;
+}
+
+/**
+ * Insert or replace the value for a key
+ * Values must be non-NULL; NULL marks an empty slot
+ * Time Complexity: O(1) average
+ */
+bool hashmap_put(HashMap *map, int key, void *value) {
+  if (!map || !value)
+    return false;
+
+  if ((map->size + 1) * HASHMAP_MAX_LOAD_DEN >
+          map->capacity * HASHMAP_MAX_LOAD_NUM &&
+      !hashmap_resize(map, map->capacity * 2))
+    return false;
+
+  unsigned int mask = map->capacity - 1;
+  unsigned int i = hash_key(key, map->capacity);
+  while (map->entries[i].value) {
+    if (map->entries[i].key == key) {
+      map->entries[i].value = value;
+      return true;
+    }
+    i = (i + 1) & mask;
+  }
+
+  map->entries[i].key = key;
+  map->entries[i].value = value;
+  map->size++;
+
+  return true;
+}
+
+/**
+ * Look up the value for a key
+ * Returns NULL if the key is absent
+ * Time Complexity: O(1) average
+ */
+void *hashmap_get(HashMap *map, int key) {
+  if (!map)
+    return NULL;
+
+  unsigned int mask = map->capacity - 1;
+  unsigned int i = hash_key(key, map->capacity);
+  while (map->entries[i].value) {
+    if (map->entries[i].key == key)
+      return map->entries[i].value;
+    i = (i + 1) & mask;
+  }
+
+  return NULL;
+}
+
+/**
+ * Remove a key
+ * Later entries of the probe run are shifted back into the hole
+ * Time Complexity: O(1) average
+ */
+bool hashmap_remove(HashMap *map, int key) {
+  if (!map)
+    return false;
+
+  unsigned int mask = map->capacity - 1;
+  unsigned int i = hash_key(key, map->capacity);
+  while (map->entries[i].value && map->entries[i].key != key)
+    i = (i + 1) & mask;
+
+  if (!map->entries[i].value)
+    return false;
+
+  unsigned int hole = i;
+  unsigned int j = i;
+  while (true) {
+    j = (j + 1) & mask;
+    if (!map->entries[j].value)
+      break;
+
+    // An entry may fill the hole only if its home slot is not in (hole, j]
+    unsigned int home = hash_key(map->entries[j].key, map->capacity);
+    if (((j - home) & mask) >= ((j - hole) & mask)) {
+      map->entries[hole] = map->entries[j];
+      hole = j;
+    }
+  }
+
+  map->entries[hole].value = NULL;
+  map->size--;
+
+  return true;
+}
+
+/**
+ * Get number of keys
+ */
+int hashmap_get_size(HashMap *map) { return map ? map->size : 0; }
+
+/**
+ * Destroy hashmap
+ * Values are not owned by the map and are not freed
+ */
+void hashmap_destroy(HashMap *map) {
+  if (!map)
+    return;
+  free(map->entries);
+  free(map);
+}
+
+// ============================================================================
+// HELPER FUNCTIONS
+// ============================================================================
+
+/**
+ * Integer mixer - spreads sequential song IDs across the table
+ */
+static unsigned int hash_key(int key, int capacity) {
+  unsigned int h = (unsigned int)key;
+  h ^= h >> 16;
+  h *= 0x7feb352du;
+  h ^= h >> 15;
+  h *= 0x846ca68bu;
+  h ^= h >> 16;
+  return h & (unsigned int)(capacity - 1);
+}
+
+static bool hashmap_resize(HashMap *map, int new_capacity) {
+  HashEntry *old_entries = map->entries;
+  int old_capacity = map->capacity;
+
+  HashEntry *entries = (HashEntry *)calloc(new_capacity, sizeof(HashEntry));
+  if (!entries)
+    return false;
+
+  map->entries = entries;
+  map->capacity = new_capacity;
+
+  unsigned int mask = new_capacity - 1;
+  for (int i = 0; i < old_capacity; i++) {
+    if (!old_entries[i].value)
+      continue;
+    unsigned int j = hash_key(old_entries[i].key, new_capacity);
+    while (entries[j].value)
+      j = (j + 1) & mask;
+    entries[j] = old_entries[i];
+  }
+
+  free(old_entries);
+  return true;
+}
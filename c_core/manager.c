@@ -6,23 +6,72 @@
  */
 
 #include "music_queue_core.h"
+#include "trace.h"
+#include <stdint.h>
+
+// Helper function prototypes
+static bool rank_song(MusicQueueManager *mgr, int song_id, float priority);
+static void unrank_song(MusicQueueManager *mgr, int song_id);
+static Operation op_begin(MusicQueueManager *mgr, OperationType type,
+                          int song_id);
+static void op_record(MusicQueueManager *mgr, Operation op);
+static bool op_revert(MusicQueueManager *mgr, const Operation *op);
+static bool op_replay(MusicQueueManager *mgr, const Operation *op);
+static DLLNode *op_node(MusicQueueManager *mgr, const Operation *op,
+                        int position);
+static bool history_step(MusicQueueManager *mgr, Stack *from, Stack *to,
+                         bool undo);
+static bool apply_one(MusicQueueManager *mgr, const QueueOp *op);
+static bool batch_reject(bool *out_results, int n);
+static void log_op(MusicQueueManager *mgr, const Operation *op, int flags);
+static bool log_apply(MusicQueueManager *mgr, const WalRecord *record,
+                      bool inverse);
+static int log_recover(MusicQueueManager *mgr, const WalRecord *records,
+                       int count);
+static SongIdNode *song_list_from(const int *ids, int count);
+static SongIdNode *search_list(Trie *trie, const char *query);
+static int search_merge(MusicQueueManager *mgr, const char *query, int flags,
+                        int max_edits);
+static bool search_take(SearchScratch *search, int song_id);
+static int compare_by_priority(const void *a, const void *b);
+static void index_path(char *out, size_t size, const char *dir,
+                       const char *name);
+static void index_apply_edits(MusicQueueManager *mgr, const char *dir);
+static void top_cache_refresh(MusicQueueManager *mgr);
+static void top_cache_move(TopKCache *cache, int from, int song_id,
+                           float priority);
 
 /**
  * Create a new music queue manager
  */
 MusicQueueManager *manager_create(int heap_capacity) {
   MusicQueueManager *mgr =
-      (MusicQueueManager *)malloc(sizeof(MusicQueueManager));
+      (MusicQueueManager *)calloc(1, sizeof(MusicQueueManager));
   if (!mgr)
     return NULL;
 
+  // One slab pool per node type; containers allocate from these
+  static const size_t node_sizes[POOL_COUNT] = {
+      sizeof(DLLNode), sizeof(QueueNode), sizeof(TrieNode), sizeof(SongIdNode)};
+  for (int i = 0; i < POOL_COUNT; i++) {
+    mgr->pools[i] = pool_create(node_sizes[i], POOL_NODES_PER_SLAB);
+    if (!mgr->pools[i]) {
+      manager_destroy(mgr);
+      return NULL;
+    }
+  }
+
   mgr->queue = dll_create();
   mgr->recommendations = heap_create(heap_capacity);
-  mgr->undo_stack = stack_create();
-  mgr->redo_stack = stack_create();
+  mgr->undo_stack = stack_create(UNDO_HISTORY_DEPTH);
+  mgr->redo_stack = stack_create(UNDO_HISTORY_DEPTH);
   mgr->upcoming = queue_create();
-  mgr->song_trie = trie_create();
-  mgr->artist_trie = trie_create();
+  mgr->song_trie = trie_create_pooled(mgr->pools[POOL_TRIE_NODE],
+                                      mgr->pools[POOL_SONG_ID_NODE]);
+  mgr->artist_trie = trie_create_pooled(mgr->pools[POOL_TRIE_NODE],
+                                        mgr->pools[POOL_SONG_ID_NODE]);
+  mgr->top_cache.count = 0;
+  mgr->top_cache.valid = false;
 
   if (!mgr->queue || !mgr->recommendations || !mgr->undo_stack ||
       !mgr->redo_stack || !mgr->upcoming || !mgr->song_trie ||
@@ -31,6 +80,13 @@ MusicQueueManager *manager_create(int heap_capacity) {
     return NULL;
   }
 
+  // Autocomplete ranks completions by recommendation priority
+  trie_set_ranking(mgr->song_trie, mgr->recommendations);
+  trie_set_ranking(mgr->artist_trie, mgr->recommendations);
+
+  mgr->queue->pool = mgr->pools[POOL_DLL_NODE];
+  mgr->upcoming->pool = mgr->pools[POOL_QUEUE_NODE];
+
   return mgr;
 }
 
@@ -43,6 +99,8 @@ bool manager_add_song(MusicQueueManager *mgr, int song_id, const char *title,
   if (!mgr)
     return false;
 
+  Operation op = op_begin(mgr, OP_ADD, song_id);
+
   // Add to circular doubly linked list (main queue)
   DLLNode *node = dll_insert_end(mgr->queue, song_id);
   if (!node)
@@ -51,18 +109,74 @@ bool manager_add_song(MusicQueueManager *mgr, int song_id, const char *title,
   // Calculate priority: (likes * 2 + play_count)
   float priority = (float)(likes * 2 + play_count);
 
-  // Add to search Tries
-  trie_insert(mgr->song_trie, title, song_id);
-  trie_insert(mgr->artist_trie, artist, song_id);
+  // Add to popular songs heap first so the Tries index it at its new rank
+  rank_song(mgr, song_id, priority);
 
-  // Add to popular songs heap
-  heap_update_priority(mgr->recommendations, song_id, priority);
+  // Add to search Tries
+  trie_index_text(mgr->song_trie, title, song_id);
+  trie_index_text(mgr->artist_trie, artist, song_id);
 
   // Record operation for undo
-  Operation op = {OP_ADD, song_id, mgr->queue->size - 1, priority};
-  stack_push(mgr->undo_stack, op);
-  stack_clear(mgr->redo_stack);
+  op.new_position = mgr->queue->size - 1;
+  op.new_priority = priority;
+  op_record(mgr, op);
+
+  return true;
+}
+
+/**
+ * Make a catalog song searchable without queueing it
+ * Title and album words go into the song index, artist words into the
+ * artist index. album may be NULL. Nothing is recorded for undo.
+ */
+bool manager_index_song(MusicQueueManager *mgr, int song_id, const char *title,
+                        const char *artist, const char *album) {
+  if (!mgr)
+    return false;
+
+  trie_index_text(mgr->song_trie, title, song_id);
+  trie_index_text(mgr->song_trie, album, song_id);
+  trie_index_text(mgr->artist_trie, artist, song_id);
+  return true;
+}
+
+/**
+ * Make a song unsearchable, e.g. after it is deleted from the catalog
+ * Works for songs in a loaded index as well. Nothing is recorded for undo.
+ * Returns false if the song was not indexed
+ */
+bool manager_unindex_song(MusicQueueManager *mgr, int song_id) {
+  if (!mgr)
+    return false;
+
+  bool titles = trie_remove_song(mgr->song_trie, song_id);
+  bool artists = trie_remove_song(mgr->artist_trie, song_id);
+  return titles || artists;
+}
+
+/**
+ * Re-index a song whose title, artist or album changed
+ * Its old words stop matching; album may be NULL.
+ */
+bool manager_update_song(MusicQueueManager *mgr, int song_id, const char *title,
+                         const char *artist, const char *album) {
+  if (!mgr)
+    return false;
 
+  manager_unindex_song(mgr, song_id);
+  return manager_index_song(mgr, song_id, title, artist, album);
+}
+
+/**
+ * Drop a song from the recommendations, e.g. after it is deleted from the
+ * catalog. Nothing is recorded for undo.
+ * Returns false if the song was not ranked
+ */
+bool manager_unrank_song(MusicQueueManager *mgr, int song_id) {
+  if (!mgr || heap_find(mgr->recommendations, song_id) < 0)
+    return false;
+
+  unrank_song(mgr, song_id);
   return true;
 }
 
@@ -78,20 +192,10 @@ bool manager_remove_song(MusicQueueManager *mgr, int song_id) {
   if (!node)
     return false;
 
-  int position = 0;
-  DLLNode *temp = mgr->queue->head;
-  for (int i = 0; i < mgr->queue->size; i++) {
-    if (temp == node)
-      break;
-    position++;
-    temp = temp->next;
-  }
-
+  Operation op = op_begin(mgr, OP_REMOVE, song_id);
+  op.old_position = dll_index_of(mgr->queue, node);
   dll_remove(mgr->queue, node);
-
-  Operation op = {OP_REMOVE, song_id, position, 0.0f};
-  stack_push(mgr->undo_stack, op);
-  stack_clear(mgr->redo_stack);
+  op_record(mgr, op);
 
   return true;
 }
@@ -104,14 +208,12 @@ bool manager_skip_next(MusicQueueManager *mgr) {
     return false;
 
   int old_song_id = mgr->queue->current->song_id;
+  Operation op = op_begin(mgr, OP_SKIP, old_song_id);
   mgr->queue->current = mgr->queue->current->next;
 
-  printf("CDLL used for queue operation: skip next from %d to %d\n",
-         old_song_id, mgr->queue->current->song_id);
+  TRACE(TRACE_SKIP_NEXT, old_song_id, mgr->queue->current->song_id);
 
-  Operation op = {OP_SKIP, old_song_id, -1, 0.0f};
-  stack_push(mgr->undo_stack, op);
-  stack_clear(mgr->redo_stack);
+  op_record(mgr, op);
 
   return true;
 }
@@ -124,14 +226,12 @@ bool manager_skip_prev(MusicQueueManager *mgr) {
     return false;
 
   int old_song_id = mgr->queue->current->song_id;
+  Operation op = op_begin(mgr, OP_SKIP, old_song_id);
   mgr->queue->current = mgr->queue->current->prev;
 
-  printf("CDLL used for queue operation: skip prev from %d to %d\n",
-         old_song_id, mgr->queue->current->song_id);
+  TRACE(TRACE_SKIP_PREV, old_song_id, mgr->queue->current->song_id);
 
-  Operation op = {OP_SKIP, old_song_id, -1, 0.0f};
-  stack_push(mgr->undo_stack, op);
-  stack_clear(mgr->redo_stack);
+  op_record(mgr, op);
 
   return true;
 }
@@ -146,12 +246,13 @@ bool manager_move_up(MusicQueueManager *mgr, int song_id) {
   if (!node)
     return false;
 
+  Operation op = op_begin(mgr, OP_MOVE_UP, song_id);
+  op.old_position = dll_index_of(mgr->queue, node);
   if (!dll_move_up(mgr->queue, node))
     return false;
 
-  Operation op = {OP_MOVE_UP, song_id, -1, 0.0f};
-  stack_push(mgr->undo_stack, op);
-  stack_clear(mgr->redo_stack);
+  op.new_position = dll_index_of(mgr->queue, node);
+  op_record(mgr, op);
 
   return true;
 }
@@ -166,23 +267,75 @@ bool manager_move_down(MusicQueueManager *mgr, int song_id) {
   if (!node)
     return false;
 
+  Operation op = op_begin(mgr, OP_MOVE_DOWN, song_id);
+  op.old_position = dll_index_of(mgr->queue, node);
   if (!dll_move_down(mgr->queue, node))
     return false;
 
-  Operation op = {OP_MOVE_DOWN, song_id, -1, 0.0f};
-  stack_push(mgr->undo_stack, op);
-  stack_clear(mgr->redo_stack);
+  op.new_position = dll_index_of(mgr->queue, node);
+  op_record(mgr, op);
+
+  return true;
+}
+
+/**
+ * Move song to a position in the queue (drag-and-drop)
+ */
+bool manager_move_to(MusicQueueManager *mgr, int song_id, int position) {
+  if (!mgr)
+    return false;
+  DLLNode *node = dll_find_by_id(mgr->queue, song_id);
+  if (!node)
+    return false;
+
+  Operation op = op_begin(mgr, OP_MOVE_TO, song_id);
+  op.old_position = dll_index_of(mgr->queue, node);
+  if (!dll_move_to(mgr->queue, node, position))
+    return false;
+
+  op.new_position = position;
+  op_record(mgr, op);
 
   return true;
 }
 
+/**
+ * Get the queue position of a song (first occurrence), or -1
+ */
+int manager_index_of(MusicQueueManager *mgr, int song_id) {
+  if (!mgr)
+    return -1;
+  DLLNode *node = dll_find_by_id(mgr->queue, song_id);
+  return node ? dll_index_of(mgr->queue, node) : -1;
+}
+
+/**
+ * Get the song at a queue position, or -1
+ */
+int manager_get_song_at(MusicQueueManager *mgr, int position) {
+  if (!mgr)
+    return -1;
+  DLLNode *node = dll_get_at(mgr->queue, position);
+  return node ? node->song_id : -1;
+}
+
 /**
  * Rotate the entire queue
  */
 bool manager_rotate_queue(MusicQueueManager *mgr, bool forward) {
   if (!mgr)
     return false;
-  dll_rotate(mgr->queue, forward);
+  if (mgr->queue->size < 2)
+    return true;
+
+  // Recorded as the song carried from one end to the other
+  DoublyLinkedList *list = mgr->queue;
+  Operation op =
+      op_begin(mgr, OP_ROTATE, (forward ? list->head : list->tail)->song_id);
+  op.old_position = forward ? 0 : list->size - 1;
+  op.new_position = forward ? list->size - 1 : 0;
+  dll_rotate(list, forward);
+  op_record(mgr, op);
   return true;
 }
 
@@ -195,49 +348,52 @@ bool manager_update_priority(MusicQueueManager *mgr, int song_id, int likes,
     return false;
 
   float priority = (float)(likes * 2 + play_count);
-  bool result = heap_update_priority(mgr->recommendations, song_id, priority);
+  Operation op = op_begin(mgr, OP_UPDATE_PRIORITY, song_id);
+  bool result = rank_song(mgr, song_id, priority);
 
   if (result) {
-    Operation op = {OP_UPDATE_PRIORITY, song_id, -1, priority};
-    stack_push(mgr->undo_stack, op);
-    stack_clear(mgr->redo_stack);
+    op.new_priority = priority;
+    op_record(mgr, op);
   }
 
   return result;
 }
 
+/**
+ * Load the whole catalog into the recommendation heap at once
+ * Replaces the heap contents in O(n); intended for startup, so nothing is
+ * recorded for undo.
+ */
+bool manager_build_recommendations(MusicQueueManager *mgr, const int *song_ids,
+                                   const int *likes, const int *play_counts,
+                                   int n) {
+  if (!mgr || n < 0 || (n > 0 && (!song_ids || !likes || !play_counts)))
+    return false;
+
+  float *priorities = (float *)malloc(sizeof(float) * (n > 0 ? n : 1));
+  if (!priorities)
+    return false;
+
+  for (int i = 0; i < n; i++)
+    priorities[i] = (float)(likes[i] * 2 + play_counts[i]);
+
+  bool result =
+      heap_build_from_array(mgr->recommendations, song_ids, priorities, n);
+  free(priorities);
+
+  mgr->top_cache.valid = false;
+  trie_refresh_ranking(mgr->song_trie);
+  trie_refresh_ranking(mgr->artist_trie);
+  return result;
+}
+
 /**
  * Undo last operation
  */
 bool manager_undo(MusicQueueManager *mgr) {
   if (!mgr || stack_is_empty(mgr->undo_stack))
     return false;
-
-  Operation op = stack_pop(mgr->undo_stack);
-  stack_push(mgr->redo_stack, op);
-
-  switch (op.type) {
-  case OP_ADD:
-    manager_remove_song(mgr, op.song_id);
-    stack_pop(mgr->undo_stack);
-    break;
-  case OP_REMOVE:
-    // Simplified - re-add to end
-    dll_insert_end(mgr->queue, op.song_id);
-    stack_pop(mgr->undo_stack);
-    break;
-  case OP_MOVE_UP:
-    manager_move_down(mgr, op.song_id);
-    stack_pop(mgr->undo_stack);
-    break;
-  case OP_MOVE_DOWN:
-    manager_move_up(mgr, op.song_id);
-    stack_pop(mgr->undo_stack);
-    break;
-  default:
-    break;
-  }
-  return true;
+  return history_step(mgr, mgr->undo_stack, mgr->redo_stack, true);
 }
 
 /**
@@ -246,62 +402,408 @@ bool manager_undo(MusicQueueManager *mgr) {
 bool manager_redo(MusicQueueManager *mgr) {
   if (!mgr || stack_is_empty(mgr->redo_stack))
     return false;
-  Operation op = stack_pop(mgr->redo_stack);
-  // Logic to re-execute op...
-  return true;
+  return history_step(mgr, mgr->redo_stack, mgr->undo_stack, false);
 }
 
 /**
- * Get recommendations from the heap
+ * Keep at most depth operations in each of the undo and redo histories
+ * Older operations are dropped; nothing is allocated per operation.
  */
-SongIdNode *manager_get_recommendations(MusicQueueManager *mgr, int limit) {
-  if (!mgr || !mgr->recommendations || mgr->recommendations->size == 0)
-    return NULL;
+bool manager_set_history_depth(MusicQueueManager *mgr, int depth) {
+  if (!mgr || depth <= 0)
+    return false;
+  return stack_set_capacity(mgr->undo_stack, depth) &&
+         stack_set_capacity(mgr->redo_stack, depth);
+}
+
+/**
+ * Apply n queue mutations atomically
+ * Either every op succeeds or none takes effect: on the first failure the
+ * ops before it are reverted. out_results (may be NULL) receives each op's
+ * own outcome; ops after a failure are not attempted and report false.
+ * The batch is one undo entry, and clears redo once instead of n times.
+ * Returns false without applying anything, every op reporting false, if
+ * the entry (n ops and its marker) would not fit in the history depth or
+ * the batch cannot be set up.
+ */
+bool manager_apply_batch(MusicQueueManager *mgr, const QueueOp *ops, int n,
+                         bool *out_results) {
+  if (!mgr || n < 0 || (n > 0 && !ops) || mgr->batch.active ||
+      (n > 1 && n >= mgr->undo_stack->capacity))
+    return batch_reject(out_results, n);
 
-  // We should not modify the actual heap, so we'll copy it
-  MaxHeap *temp_heap = heap_create(mgr->recommendations->capacity);
-  for (int i = 0; i < mgr->recommendations->size; i++) {
-    insertHeap(temp_heap, mgr->recommendations->nodes[i].song_id,
-               mgr->recommendations->nodes[i].priority);
+  BatchScratch *batch = &mgr->batch;
+  if (n > batch->capacity) {
+    Operation *grown =
+        (Operation *)realloc(batch->ops, sizeof(Operation) * n);
+    if (!grown)
+      return batch_reject(out_results, n);
+    batch->ops = grown;
+    batch->capacity = n;
   }
 
-  SongIdNode *head = NULL;
-  SongIdNode *current = NULL;
+  // While active, op_record collects into the batch instead of the history
+  batch->count = 0;
+  batch->active = true;
+  int applied = 0;
+  while (applied < n && apply_one(mgr, &ops[applied])) {
+    if (out_results)
+      out_results[applied] = true;
+    applied++;
+  }
+  batch->active = false;
 
-  int count = 0;
-  while (!heap_is_empty(temp_heap) && count < limit) {
-    HeapNode max = extractMax(temp_heap);
-    SongIdNode *new_node = (SongIdNode *)malloc(sizeof(SongIdNode));
-    new_node->song_id = max.song_id;
-    new_node->next = NULL;
+  if (applied < n) {
+    for (int i = applied; out_results && i < n; i++)
+      out_results[i] = false;
+    for (int i = batch->count - 1; i >= 0; i--)
+      op_revert(mgr, &batch->ops[i]);
+    return false;
+  }
 
-    if (!head) {
-      head = new_node;
-      current = head;
-    } else {
-      current->next = new_node;
-      current = new_node;
+  if (batch->count > 0) {
+    for (int i = 0; i < batch->count; i++) {
+      stack_push(mgr->undo_stack, batch->ops[i]);
+      log_op(mgr, &batch->ops[i], i < batch->count - 1 ? WAL_CONTINUED : 0);
+    }
+    if (batch->count > 1) {
+      Operation marker = batch->ops[batch->count - 1];
+      marker.type = OP_BATCH;
+      marker.song_id = batch->count;
+      stack_push(mgr->undo_stack, marker);
+    }
+    stack_clear(mgr->redo_stack);
+  }
+  return true;
+}
+
+/**
+ * Recover the queue from the write-ahead log in dir, then log to it
+ * The queue becomes the last checkpoint with the logged operations replayed
+ * on top; a trailing batch that was not completely logged is dropped. Call
+ * before anything is queued. Recovered operations are not undoable, and
+ * songs are not re-ranked or re-indexed beyond what the records carry.
+ * Returns false if the queue is not empty or the log cannot be recovered,
+ * and without touching the queue if another process has dir's log open.
+ */
+bool manager_open_log(MusicQueueManager *mgr, const char *dir) {
+  if (!mgr || !dir || mgr->log.open || mgr->queue->size > 0 ||
+      mgr->batch.active)
+    return false;
+  if (!wal_lock(&mgr->log, dir))
+    return false;
+
+  unsigned int generation;
+  int *ids, current;
+  int count = wal_read_checkpoint(dir, &generation, &ids, &current);
+  if (count < 0) {
+    wal_close(&mgr->log);
+    return false;
+  }
+
+  DoublyLinkedList *list = mgr->queue;
+  for (int i = 0; i < count; i++) {
+    if (!dll_insert_end(list, ids[i])) {
+      free(ids);
+      wal_close(&mgr->log);
+      return false;
     }
-    count++;
   }
+  free(ids);
+  list->current = dll_get_at(list, current);
+
+  int record_count;
+  WalRecord *records = wal_read(dir, generation, &record_count);
+  int kept = log_recover(mgr, records, record_count);
+  free(records);
+
+  stack_clear(mgr->undo_stack);
+  stack_clear(mgr->redo_stack);
+  return wal_open(&mgr->log, dir, generation, kept);
+}
 
-  heap_destroy(temp_heap);
+/**
+ * Make every logged operation durable now instead of with its group
+ * Returns false if the log is not open or a write to it has failed; after
+ * a failure nothing more is logged, so the caller must persist the queue
+ * some other way.
+ */
+bool manager_commit_log(MusicQueueManager *mgr) {
+  if (!mgr)
+    return false;
+  return wal_sync(&mgr->log);
+}
+
+/**
+ * Sync and close the write-ahead log; later changes are not logged
+ */
+void manager_close_log(MusicQueueManager *mgr) {
+  if (!mgr)
+    return;
+  wal_close(&mgr->log);
+}
+
+/**
+ * Fold the log into a new checkpoint of the whole queue
+ * Bounds recovery time; done automatically every WAL_CHECKPOINT_RECORDS
+ * records.
+ * Time Complexity: O(n)
+ */
+bool manager_checkpoint(MusicQueueManager *mgr) {
+  if (!mgr || !mgr->log.open || mgr->batch.active)
+    return false;
+
+  DoublyLinkedList *list = mgr->queue;
+  int *ids = (int *)malloc(sizeof(int) * (list->size > 0 ? list->size : 1));
+  if (!ids)
+    return false;
+
+  int current;
+  int count = manager_export_queue(mgr, ids, list->size, &current);
+  bool ok = wal_checkpoint(&mgr->log, ids, count, current);
+  free(ids);
+  return ok;
+}
+
+/**
+ * Get recommendations from the heap
+ * Returns a malloc'd list the caller releases with manager_free_song_list;
+ * prefer manager_get_recommendations_into, which does not allocate.
+ */
+SongIdNode *manager_get_recommendations(MusicQueueManager *mgr, int limit) {
+  if (!mgr || !mgr->recommendations || mgr->recommendations->size == 0 ||
+      limit <= 0)
+    return NULL;
+
+  int *ids = (int *)malloc(sizeof(int) * limit);
+  if (!ids)
+    return NULL;
+  int count = manager_get_top_k(mgr, limit, ids);
+
+  SongIdNode *head = song_list_from(ids, count);
+  free(ids);
   return head;
 }
 
+/**
+ * Write the top k recommended song IDs into out_ids, best first
+ * Served from the cached top-K view with a single memcpy when
+ * k <= RECOMMENDATION_CACHE_SIZE; larger requests walk the heap.
+ * Returns the number of IDs written.
+ */
+int manager_get_top_k(MusicQueueManager *mgr, int k, int *out_ids) {
+  if (!mgr || !out_ids || k <= 0)
+    return 0;
+  if (k > RECOMMENDATION_CACHE_SIZE)
+    return heap_top_k(mgr->recommendations, k, out_ids);
+
+  if (!mgr->top_cache.valid)
+    top_cache_refresh(mgr);
+
+  int count = k < mgr->top_cache.count ? k : mgr->top_cache.count;
+  memcpy(out_ids, mgr->top_cache.ids, sizeof(int) * count);
+  return count;
+}
+
+/**
+ * Write up to cap recommended song IDs into out_ids, best first
+ * Returns the number of IDs written; nothing is allocated
+ */
+int manager_get_recommendations_into(MusicQueueManager *mgr, int *out_ids,
+                                     int cap) {
+  return manager_get_top_k(mgr, cap, out_ids);
+}
+
+/**
+ * Free a list returned by manager_get_recommendations or manager_search_*
+ */
+void manager_free_song_list(SongIdNode *list) {
+  while (list) {
+    SongIdNode *next = list->next;
+    free(list);
+    list = next;
+  }
+}
+
 /**
  * Search functions
+ * Same matching as manager_search_songs_into / manager_search_artists_into.
+ * Returns a malloc'd list the caller releases with manager_free_song_list.
  */
 SongIdNode *manager_search_songs(MusicQueueManager *mgr, const char *query) {
   if (!mgr)
     return NULL;
-  return trie_search_prefix(mgr->song_trie, query);
+  return search_list(mgr->song_trie, query);
 }
 
 SongIdNode *manager_search_artists(MusicQueueManager *mgr, const char *query) {
   if (!mgr)
     return NULL;
-  return trie_search_prefix(mgr->artist_trie, query);
+  return search_list(mgr->artist_trie, query);
+}
+
+/**
+ * Search functions writing into caller buffers
+ * A song matches when every word of query starts one of its title / album
+ * (or artist) words. IDs are written in ascending order.
+ * Write at most cap IDs and return the total number of matches; if that
+ * exceeds cap, call again with a larger buffer
+ */
+int manager_search_songs_into(MusicQueueManager *mgr, const char *query,
+                              int *out_ids, int cap) {
+  if (!mgr)
+    return 0;
+  return trie_search_words(mgr->song_trie, query, out_ids, cap);
+}
+
+int manager_search_artists_into(MusicQueueManager *mgr, const char *query,
+                                int *out_ids, int cap) {
+  if (!mgr)
+    return 0;
+  return trie_search_words(mgr->artist_trie, query, out_ids, cap);
+}
+
+/**
+ * Typo-tolerant variants: each query word may be up to max_edits (at most
+ * TRIE_MAX_EDITS) character edits away from the start of a matching word
+ */
+int manager_search_songs_fuzzy_into(MusicQueueManager *mgr, const char *query,
+                                    int max_edits, int *out_ids, int cap) {
+  if (!mgr)
+    return 0;
+  return trie_search_fuzzy(mgr->song_trie, query, max_edits, out_ids, cap);
+}
+
+int manager_search_artists_fuzzy_into(MusicQueueManager *mgr,
+                                      const char *query, int max_edits,
+                                      int *out_ids, int cap) {
+  if (!mgr)
+    return 0;
+  return trie_search_fuzzy(mgr->artist_trie, query, max_edits, out_ids, cap);
+}
+
+/**
+ * Search titles/albums and/or artists in one call
+ * flags selects the indexes (SEARCH_TITLES, SEARCH_ARTISTS or SEARCH_ALL);
+ * with SEARCH_FUZZY a query with no exact match is retried allowing up to
+ * TRIE_MAX_EDITS typos per word. Each song is reported once, ranked by
+ * recommendation priority (highest first, then by ID); songs missing from
+ * the heap come last. Allocates only to grow buffers reused across calls.
+ * Writes at most cap IDs and returns the total number of unique matches
+ */
+int manager_search(MusicQueueManager *mgr, const char *query, int flags,
+                   int *out_ids, int cap) {
+  if (!mgr || !query)
+    return 0;
+
+  int count = search_merge(mgr, query, flags, -1);
+  if (count == 0 && (flags & SEARCH_FUZZY))
+    count = search_merge(mgr, query, flags, TRIE_MAX_EDITS);
+  if (count <= 0)
+    return 0;
+
+  HeapNode *ranked = mgr->search.ranked;
+  qsort(ranked, count, sizeof(HeapNode), compare_by_priority);
+
+  int written = count < cap ? count : cap;
+  for (int i = 0; out_ids && i < written; i++)
+    out_ids[i] = ranked[i].song_id;
+  return count;
+}
+
+/**
+ * Autocomplete: the k best songs whose title / artist starts with prefix
+ * Ranked by recommendation priority, highest first. Returns the number of IDs
+ * written; O(|prefix| + k) for k <= TRIE_TOP_K.
+ */
+int manager_suggest_songs(MusicQueueManager *mgr, const char *prefix, int k,
+                          int *out_ids) {
+  if (!mgr)
+    return 0;
+  return trie_top_k(mgr->song_trie, prefix, k, out_ids);
+}
+
+int manager_suggest_artists(MusicQueueManager *mgr, const char *prefix, int k,
+                            int *out_ids) {
+  if (!mgr)
+    return 0;
+  return trie_top_k(mgr->artist_trie, prefix, k, out_ids);
+}
+
+/**
+ * Write both search indexes into dir as titles.idx and artists.idx
+ * dir must exist. Each file is replaced atomically, so a running process
+ * that has the old files mapped keeps working. The edit log is folded in
+ * and emptied.
+ */
+bool manager_save_index(MusicQueueManager *mgr, const char *dir) {
+  if (!mgr || !dir)
+    return false;
+
+  char path[1024];
+  index_path(path, sizeof(path), dir, "titles.idx");
+  if (!trie_save(mgr->song_trie, path))
+    return false;
+  index_path(path, sizeof(path), dir, "artists.idx");
+  if (!trie_save(mgr->artist_trie, path))
+    return false;
+  index_path(path, sizeof(path), dir, "edits.log");
+  remove(path);
+  return true;
+}
+
+/**
+ * Map the indexes written by manager_save_index as the search base
+ * Songs indexed since start-up stay searchable alongside them. Loads both
+ * or neither. Songs listed in the edit log are dropped from the base; the
+ * caller re-indexes the ones that still exist from their current text
+ * (manager_is_indexed is false for them).
+ */
+bool manager_load_index(MusicQueueManager *mgr, const char *dir) {
+  if (!mgr || !dir)
+    return false;
+
+  char path[1024];
+  index_path(path, sizeof(path), dir, "titles.idx");
+  if (!trie_load(mgr->song_trie, path))
+    return false;
+  index_path(path, sizeof(path), dir, "artists.idx");
+  if (!trie_load(mgr->artist_trie, path)) {
+    trie_unload(mgr->song_trie);
+    return false;
+  }
+  index_apply_edits(mgr, dir);
+  return true;
+}
+
+/**
+ * Record that song_id was edited or deleted since the indexes in dir were
+ * saved, by appending it to dir's edit log
+ * Costs one small append instead of rewriting the indexes; the log is
+ * applied by manager_load_index and emptied by manager_save_index.
+ */
+bool manager_log_index_edit(MusicQueueManager *mgr, const char *dir,
+                            int song_id) {
+  if (!mgr || !dir)
+    return false;
+
+  char path[1024];
+  index_path(path, sizeof(path), dir, "edits.log");
+  FILE *log = fopen(path, "ab");
+  if (!log)
+    return false;
+  bool ok = fwrite(&song_id, sizeof(song_id), 1, log) == 1;
+  return fclose(log) == 0 && ok;
+}
+
+/**
+ * Whether song_id is searchable, from the loaded index or indexed since
+ */
+bool manager_is_indexed(MusicQueueManager *mgr, int song_id) {
+  if (!mgr)
+    return false;
+  return trie_has_song(mgr->song_trie, song_id) ||
+         trie_has_song(mgr->artist_trie, song_id);
 }
 
 /**
@@ -313,6 +815,34 @@ int manager_get_current_song(MusicQueueManager *mgr) {
   return mgr->queue->current->song_id;
 }
 
+/**
+ * Copy the queue into a caller buffer in playback order, from head
+ * Writes at most cap IDs and stores the position of the current song (or -1)
+ * in out_current_index. Returns the full queue size; if that exceeds cap,
+ * call again with a larger buffer.
+ */
+int manager_export_queue(MusicQueueManager *mgr, int *out_ids, int cap,
+                         int *out_current_index) {
+  if (!mgr)
+    return 0;
+
+  DoublyLinkedList *list = mgr->queue;
+  if (out_current_index)
+    *out_current_index =
+        list->current ? dll_index_of(list, list->current) : -1;
+
+  if (out_ids) {
+    int count = list->size < cap ? list->size : cap;
+    DLLNode *node = list->head;
+    for (int i = 0; i < count; i++) {
+      out_ids[i] = node->song_id;
+      node = node->next;
+    }
+  }
+
+  return list->size;
+}
+
 /**
  * Display current queue
  */
@@ -331,12 +861,26 @@ void manager_display_recommendations(MusicQueueManager *mgr) {
   heap_display(mgr->recommendations);
 }
 
+/**
+ * Report slab usage for one of the manager's node pools
+ */
+bool manager_get_pool_stats(MusicQueueManager *mgr, PoolKind kind,
+                            PoolStats *stats) {
+  if (!mgr || !stats || kind < 0 || kind >= POOL_COUNT)
+    return false;
+  pool_get_stats(mgr->pools[kind], stats);
+  return true;
+}
+
 /**
  * Destroy manager
+ * Containers skip per-node frees; dropping the pools releases every node
+ * in O(number of slabs)
  */
 void manager_destroy(MusicQueueManager *mgr) {
   if (!mgr)
     return;
+  wal_close(&mgr->log);
   if (mgr->queue)
     dll_destroy(mgr->queue);
   if (mgr->recommendations)
@@ -351,5 +895,545 @@ void manager_destroy(MusicQueueManager *mgr) {
     trie_destroy(mgr->song_trie);
   if (mgr->artist_trie)
     trie_destroy(mgr->artist_trie);
+  for (int i = 0; i < POOL_COUNT; i++)
+    pool_destroy(mgr->pools[i]);
+  free(mgr->search.ids);
+  free(mgr->search.ranked);
+  hashmap_destroy(mgr->search.stamps);
+  free(mgr->batch.ops);
   free(mgr);
 }
+
+// ============================================================================
+// HELPER FUNCTIONS
+// ============================================================================
+
+/**
+ * Set a song's heap priority and patch the cached top-K view
+ * The cache is only invalidated when a cached song drops below the K-th
+ * threshold, since its replacement has to come from the heap.
+ * The Tries' completion caches are updated to the new priority as well.
+ */
+static bool rank_song(MusicQueueManager *mgr, int song_id, float priority) {
+  if (!heap_update_priority(mgr->recommendations, song_id, priority))
+    return false;
+
+  trie_update_priority(mgr->song_trie, song_id, priority);
+  trie_update_priority(mgr->artist_trie, song_id, priority);
+
+  TopKCache *cache = &mgr->top_cache;
+  if (!cache->valid)
+    return true;
+
+  int index = -1;
+  for (int i = 0; i < cache->count; i++) {
+    if (cache->ids[i] == song_id) {
+      index = i;
+      break;
+    }
+  }
+
+  // A cache that is not full holds the entire heap
+  bool full = cache->count == RECOMMENDATION_CACHE_SIZE;
+
+  if (index != -1) {
+    int last = cache->count - 1;
+    if (!full || priority >= cache->priorities[index] ||
+        (index != last && priority >= cache->priorities[last])) {
+      top_cache_move(cache, index, song_id, priority);
+    } else {
+      cache->valid = false;
+    }
+  } else if (!full) {
+    top_cache_move(cache, cache->count++, song_id, priority);
+  } else if (priority > cache->priorities[cache->count - 1]) {
+    // Displaces the current K-th song
+    top_cache_move(cache, cache->count - 1, song_id, priority);
+  }
+
+  return true;
+}
+
+/**
+ * Take a song out of the heap and the caches ranked from it
+ */
+static void unrank_song(MusicQueueManager *mgr, int song_id) {
+  if (!heap_remove(mgr->recommendations, song_id))
+    return;
+
+  // Unranked songs rank as -1 (heap_get_priority)
+  trie_update_priority(mgr->song_trie, song_id, -1.0f);
+  trie_update_priority(mgr->artist_trie, song_id, -1.0f);
+
+  TopKCache *cache = &mgr->top_cache;
+  for (int i = 0; cache->valid && i < cache->count; i++) {
+    if (cache->ids[i] == song_id)
+      cache->valid = false;
+  }
+}
+
+/**
+ * Start recording an operation: capture the state it may change
+ */
+static Operation op_begin(MusicQueueManager *mgr, OperationType type,
+                          int song_id) {
+  DoublyLinkedList *list = mgr->queue;
+  Operation op;
+  memset(&op, 0, sizeof(op));
+  op.type = type;
+  op.song_id = song_id;
+  op.old_position = -1;
+  op.new_position = -1;
+  op.was_ranked = heap_find(mgr->recommendations, song_id) != -1;
+  op.old_priority = heap_get_priority(mgr->recommendations, song_id);
+  op.new_priority = op.old_priority;
+  op.old_current = list->current ? dll_index_of(list, list->current) : -1;
+  return op;
+}
+
+/**
+ * Finish an operation: note where current ended up and push it for undo
+ */
+static void op_record(MusicQueueManager *mgr, Operation op) {
+  DoublyLinkedList *list = mgr->queue;
+  op.new_current = list->current ? dll_index_of(list, list->current) : -1;
+  if (mgr->batch.active) {
+    mgr->batch.ops[mgr->batch.count++] = op;
+    return;
+  }
+  stack_push(mgr->undo_stack, op);
+  stack_clear(mgr->redo_stack);
+  log_op(mgr, &op, 0);
+}
+
+/**
+ * The node at position, provided it holds the operation's song
+ */
+static DLLNode *op_node(MusicQueueManager *mgr, const Operation *op,
+                        int position) {
+  DLLNode *node = dll_get_at(mgr->queue, position);
+  return node && node->song_id == op->song_id ? node : NULL;
+}
+
+/**
+ * Apply the inverse of op, returning the manager to its state before it
+ * Time Complexity: O(log n)
+ */
+static bool op_revert(MusicQueueManager *mgr, const Operation *op) {
+  DoublyLinkedList *list = mgr->queue;
+  DLLNode *node = NULL;
+
+  switch (op->type) {
+  case OP_ADD:
+    node = op_node(mgr, op, op->new_position);
+    if (!node || !dll_remove(list, node))
+      return false;
+    break;
+  case OP_REMOVE:
+    if (!dll_insert_at(list, op->song_id, op->old_position))
+      return false;
+    break;
+  case OP_MOVE_UP:
+    node = op_node(mgr, op, op->new_position);
+    if (!node || !dll_move_down(list, node))
+      return false;
+    break;
+  case OP_MOVE_DOWN:
+    node = op_node(mgr, op, op->new_position);
+    if (!node || !dll_move_up(list, node))
+      return false;
+    break;
+  case OP_MOVE_TO:
+    node = op_node(mgr, op, op->new_position);
+    if (!node || !dll_move_to(list, node, op->old_position))
+      return false;
+    break;
+  case OP_ROTATE:
+    if (!op_node(mgr, op, op->new_position))
+      return false;
+    dll_rotate(list, op->old_position != 0);
+    break;
+  default:
+    break;
+  }
+
+  if (op->type == OP_ADD || op->type == OP_UPDATE_PRIORITY) {
+    if (op->was_ranked)
+      rank_song(mgr, op->song_id, op->old_priority);
+    else
+      unrank_song(mgr, op->song_id);
+  }
+  list->current = dll_get_at(list, op->old_current);
+  return true;
+}
+
+/**
+ * Apply op again after op_revert
+ * Time Complexity: O(log n)
+ */
+static bool op_replay(MusicQueueManager *mgr, const Operation *op) {
+  DoublyLinkedList *list = mgr->queue;
+  DLLNode *node = NULL;
+
+  switch (op->type) {
+  case OP_ADD:
+    if (!dll_insert_at(list, op->song_id, op->new_position))
+      return false;
+    break;
+  case OP_REMOVE:
+    node = op_node(mgr, op, op->old_position);
+    if (!node || !dll_remove(list, node))
+      return false;
+    break;
+  case OP_MOVE_UP:
+    node = op_node(mgr, op, op->old_position);
+    if (!node || !dll_move_up(list, node))
+      return false;
+    break;
+  case OP_MOVE_DOWN:
+    node = op_node(mgr, op, op->old_position);
+    if (!node || !dll_move_down(list, node))
+      return false;
+    break;
+  case OP_MOVE_TO:
+    node = op_node(mgr, op, op->old_position);
+    if (!node || !dll_move_to(list, node, op->new_position))
+      return false;
+    break;
+  case OP_ROTATE:
+    if (!op_node(mgr, op, op->old_position))
+      return false;
+    dll_rotate(list, op->old_position == 0);
+    break;
+  default:
+    break;
+  }
+
+  if (op->type == OP_ADD || op->type == OP_UPDATE_PRIORITY)
+    rank_song(mgr, op->song_id, op->new_priority);
+  list->current = dll_get_at(list, op->new_current);
+  return true;
+}
+
+/**
+ * Undo (or redo) the entry on top of from and move it to to
+ * A batch entry is its OP_BATCH marker over the batch's operations, newest
+ * on top; they are reverted newest first and replayed oldest first, so
+ * moving them one by one leaves them in the right order on the other stack.
+ * If any step fails, the steps already taken are rolled back. A batch whose
+ * oldest operations have dropped off the history is discarded whole.
+ */
+static bool history_step(MusicQueueManager *mgr, Stack *from, Stack *to,
+                         bool undo) {
+  Operation top = stack_peek(from);
+  bool batch = top.type == OP_BATCH;
+  int count = batch ? top.song_id : 1;
+  if (batch && count > stack_get_size(from) - 1) {
+    // Only the oldest entry can lose operations, so nothing remains below
+    stack_clear(from);
+    return false;
+  }
+  int base = batch ? 1 : 0;
+
+  for (int i = 0; i < count; i++) {
+    Operation op = stack_peek_at(from, base + i);
+    if (!(undo ? op_revert(mgr, &op) : op_replay(mgr, &op))) {
+      while (--i >= 0) {
+        op = stack_peek_at(from, base + i);
+        if (undo)
+          op_replay(mgr, &op);
+        else
+          op_revert(mgr, &op);
+      }
+      return false;
+    }
+  }
+
+  for (int i = 0; i < count; i++) {
+    Operation op = stack_peek_at(from, base + i);
+    log_op(mgr, &op,
+           (undo ? WAL_REVERT : 0) | (i < count - 1 ? WAL_CONTINUED : 0));
+  }
+
+  if (batch)
+    stack_pop(from);
+  for (int i = 0; i < count; i++)
+    stack_push(to, stack_pop(from));
+  if (batch)
+    stack_push(to, top);
+  return true;
+}
+
+/**
+ * Execute one batch op through the public mutators
+ */
+static bool apply_one(MusicQueueManager *mgr, const QueueOp *op) {
+  switch (op->type) {
+  case OP_ADD:
+    return manager_add_song(mgr, op->song_id, op->title, op->artist,
+                            op->likes, op->play_count);
+  case OP_REMOVE:
+    return manager_remove_song(mgr, op->song_id);
+  case OP_SKIP:
+    return op->forward ? manager_skip_next(mgr) : manager_skip_prev(mgr);
+  case OP_MOVE_UP:
+    return manager_move_up(mgr, op->song_id);
+  case OP_MOVE_DOWN:
+    return manager_move_down(mgr, op->song_id);
+  case OP_MOVE_TO:
+    return manager_move_to(mgr, op->song_id, op->position);
+  case OP_UPDATE_PRIORITY:
+    return manager_update_priority(mgr, op->song_id, op->likes,
+                                   op->play_count);
+  case OP_ROTATE:
+    return manager_rotate_queue(mgr, op->forward);
+  default:
+    return false;
+  }
+}
+
+/**
+ * Report every op of a batch that was not attempted as failed
+ */
+static bool batch_reject(bool *out_results, int n) {
+  for (int i = 0; out_results && i < n; i++)
+    out_results[i] = false;
+  return false;
+}
+
+/**
+ * Append an applied operation to the log, if one is open
+ * A log that can no longer be written is reported by manager_commit_log;
+ * the operation itself has already taken effect.
+ */
+static void log_op(MusicQueueManager *mgr, const Operation *op, int flags) {
+  WriteAheadLog *log = &mgr->log;
+  if (!log->open)
+    return;
+
+  // A failed append marks the log failed; manager_commit_log reports it
+  wal_append(log, op, flags);
+  if (!(flags & WAL_CONTINUED) && log->records >= WAL_CHECKPOINT_RECORDS)
+    manager_checkpoint(mgr);
+}
+
+/**
+ * Redo a logged record, or with inverse, take it back
+ */
+static bool log_apply(MusicQueueManager *mgr, const WalRecord *record,
+                      bool inverse) {
+  bool revert = ((record->flags & WAL_REVERT) != 0) != inverse;
+  return revert ? op_revert(mgr, &record->op) : op_replay(mgr, &record->op);
+}
+
+/**
+ * Replay logged records group by group
+ * A group that fails part-way, or whose last record is missing, is rolled
+ * back along with everything after it.
+ * Returns the number of records kept
+ */
+static int log_recover(MusicQueueManager *mgr, const WalRecord *records,
+                       int count) {
+  int kept = 0;
+  int i = 0;
+  while (i < count && log_apply(mgr, &records[i], false)) {
+    i++;
+    if (!(records[i - 1].flags & WAL_CONTINUED))
+      kept = i;
+  }
+
+  while (i > kept) {
+    i--;
+    log_apply(mgr, &records[i], true);
+  }
+  return kept;
+}
+
+/**
+ * Rebuild the cached top-K view from the heap
+ */
+static void top_cache_refresh(MusicQueueManager *mgr) {
+  TopKCache *cache = &mgr->top_cache;
+  MaxHeap *heap = mgr->recommendations;
+
+  cache->count = heap_top_k(heap, RECOMMENDATION_CACHE_SIZE, cache->ids);
+  for (int i = 0; i < cache->count; i++)
+    cache->priorities[i] = heap_get_priority(heap, cache->ids[i]);
+  cache->valid = true;
+}
+
+/**
+ * Store (song_id, priority) in slot from, then shift it into sorted order
+ */
+static void top_cache_move(TopKCache *cache, int from, int song_id,
+                           float priority) {
+  int i = from;
+  while (i > 0 && cache->priorities[i - 1] < priority) {
+    cache->ids[i] = cache->ids[i - 1];
+    cache->priorities[i] = cache->priorities[i - 1];
+    i--;
+  }
+  while (i < cache->count - 1 && cache->priorities[i + 1] > priority) {
+    cache->ids[i] = cache->ids[i + 1];
+    cache->priorities[i] = cache->priorities[i + 1];
+    i++;
+  }
+  cache->ids[i] = song_id;
+  cache->priorities[i] = priority;
+}
+
+/**
+ * Build a malloc'd SongIdNode list holding ids in order
+ */
+static SongIdNode *song_list_from(const int *ids, int count) {
+  SongIdNode *head = NULL;
+  SongIdNode *current = NULL;
+
+  for (int i = 0; i < count; i++) {
+    SongIdNode *new_node = (SongIdNode *)malloc(sizeof(SongIdNode));
+    if (!new_node)
+      break;
+    new_node->song_id = ids[i];
+    new_node->next = NULL;
+    new_node->node = NULL;
+
+    if (!head) {
+      head = new_node;
+      current = head;
+    } else {
+      current->next = new_node;
+      current = new_node;
+    }
+  }
+
+  return head;
+}
+
+/**
+ * Run a word search and return the matches as a malloc'd list
+ */
+static SongIdNode *search_list(Trie *trie, const char *query) {
+  int total = trie_search_words(trie, query, NULL, 0);
+  if (total <= 0)
+    return NULL;
+
+  int *ids = (int *)malloc(sizeof(int) * total);
+  if (!ids)
+    return NULL;
+  int count = trie_search_words(trie, query, ids, total);
+
+  SongIdNode *head = song_list_from(ids, count < total ? count : total);
+  free(ids);
+  return head;
+}
+
+/**
+ * Collect the unique matches of every index selected by flags into
+ * mgr->search.ranked, with their priorities, in no particular order
+ * max_edits < 0 runs the exact word search, otherwise the fuzzy one.
+ * Returns the count, or -1 if a buffer cannot grow
+ */
+static int search_merge(MusicQueueManager *mgr, const char *query, int flags,
+                        int max_edits) {
+  SearchScratch *search = &mgr->search;
+
+  // A new generation invalidates every stamp; on wrap-around drop them
+  if (++search->generation == 0) {
+    hashmap_destroy(search->stamps);
+    search->stamps = NULL;
+    search->generation = 1;
+  }
+  if (!search->stamps && !(search->stamps = hashmap_create(1024)))
+    return -1;
+
+  Trie *tries[2] = {(flags & SEARCH_TITLES) ? mgr->song_trie : NULL,
+                    (flags & SEARCH_ARTISTS) ? mgr->artist_trie : NULL};
+  int count = 0;
+  for (int t = 0; t < 2; t++) {
+    if (!tries[t])
+      continue;
+
+    int total = 0;
+    for (;;) {
+      total = max_edits < 0 ? trie_search_words(tries[t], query, search->ids,
+                                                search->id_capacity)
+                            : trie_search_fuzzy(tries[t], query, max_edits,
+                                                search->ids,
+                                                search->id_capacity);
+      if (total <= search->id_capacity)
+        break;
+
+      // Too many matches for the buffer: grow it and search again
+      int *grown = (int *)realloc(search->ids, sizeof(int) * total);
+      if (!grown)
+        return -1;
+      search->ids = grown;
+      search->id_capacity = total;
+    }
+
+    if (count + total > search->ranked_capacity) {
+      HeapNode *grown = (HeapNode *)realloc(
+          search->ranked, sizeof(HeapNode) * (count + total));
+      if (!grown)
+        return -1;
+      search->ranked = grown;
+      search->ranked_capacity = count + total;
+    }
+
+    for (int i = 0; i < total; i++) {
+      int song_id = search->ids[i];
+      if (!search_take(search, song_id))
+        continue;
+      search->ranked[count].song_id = song_id;
+      search->ranked[count].priority =
+          heap_get_priority(mgr->recommendations, song_id);
+      count++;
+    }
+  }
+
+  return count;
+}
+
+/**
+ * Stamp song_id for the current query
+ * Returns false if it was already taken (or cannot be tracked)
+ */
+static bool search_take(SearchScratch *search, int song_id) {
+  if (song_id < 0)
+    return false;
+
+  void *stamp = (void *)(uintptr_t)search->generation;
+  if (hashmap_get(search->stamps, song_id) == stamp)
+    return false;
+  return hashmap_put(search->stamps, song_id, stamp);
+}
+
+/**
+ * Higher priority first, lower song_id breaks ties
+ */
+static int compare_by_priority(const void *a, const void *b) {
+  const HeapNode *x = (const HeapNode *)a;
+  const HeapNode *y = (const HeapNode *)b;
+  if (x->priority != y->priority)
+    return x->priority > y->priority ? -1 : 1;
+  return (x->song_id > y->song_id) - (x->song_id < y->song_id);
+}
+
+static void index_path(char *out, size_t size, const char *dir,
+                       const char *name) {
+  snprintf(out, size, "%s/%s", dir, name);
+}
+
+static void index_apply_edits(MusicQueueManager *mgr, const char *dir) {
+  char path[1024];
+  index_path(path, sizeof(path), dir, "edits.log");
+  FILE *log = fopen(path, "rb");
+  if (!log)
+    return;
+
+  // A torn final append is shorter than an ID and is not read
+  int song_id;
+  while (fread(&song_id, sizeof(song_id), 1, log) == 1)
+    manager_unindex_song(mgr, song_id);
+  fclose(log);
+}
@@ -3,34 +3,78 @@
  *
  * Used for popularity ranking
  * Priority = (likes * 2 + play_count)
+ *
+ * d-ary layout: each node has `arity` children (2, 4 or 8), stored as
+ * split arrays. Keys live in their own array, placed so that slot 1 (the
+ * root's first child) starts a cache line. A sibling group of `arity` floats
+ * is then aligned to its own size (16 bytes for 4-ary) and, being at most
+ * 32 bytes, never straddles a line: one sift-down level touches a single
+ * cache line, and the child scan is a contiguous float loop the compiler
+ * can vectorize.
  */
 
 #include "music_queue_core.h"
+#include <limits.h>
+#include <stdint.h>
+
+#define HEAP_CACHE_LINE 64
+#define HEAP_ALIGN_PAD (HEAP_CACHE_LINE / sizeof(float))
+
+// The direct song_id -> slot map covers IDs below the larger of these;
+// sparser or larger IDs go to a hashmap instead
+#define HEAP_DIRECT_IDS 65536
+#define HEAP_DIRECT_PER_SLOT 4
 
 // Helper function prototypes
-static void swap_nodes(HeapNode *a, HeapNode *b);
-static int find_song_index(MaxHeap *heap, int song_id);
+static void place_node(MaxHeap *heap, int index, int song_id, float priority);
+static void swap_nodes(MaxHeap *heap, int i, int j);
+static int max_child(MaxHeap *heap, int index);
+static bool ensure_position_capacity(MaxHeap *heap, int song_id);
+static int position_of(MaxHeap *heap, int song_id);
+static bool set_position(MaxHeap *heap, int song_id, int index);
+static bool heap_resize(MaxHeap *heap, int new_capacity);
+static void heap_maybe_shrink(MaxHeap *heap);
+static void frontier_push(MaxHeap *heap, int *frontier, int *count, int slot);
+static int frontier_pop(MaxHeap *heap, int *frontier, int *count);
 
 /**
- * Create a new max heap
+ * Create a new max heap with the default arity (HEAP_DEFAULT_ARITY)
+ * capacity is the initial size; the heap grows geometrically as songs arrive
+ * and never shrinks below it
  */
 MaxHeap *heap_create(int capacity) {
-  if (capacity <= 0)
+  return heap_create_with_arity(capacity, HEAP_DEFAULT_ARITY);
+}
+
+/**
+ * Create a new max heap with 2, 4 or 8 children per node
+ */
+MaxHeap *heap_create_with_arity(int capacity, int arity) {
+  if (capacity <= 0 || (arity != 2 && arity != 4 && arity != 8))
     return NULL;
 
   MaxHeap *heap = (MaxHeap *)malloc(sizeof(MaxHeap));
   if (!heap)
     return NULL;
 
-  heap->nodes = (HeapNode *)malloc(sizeof(HeapNode) * capacity);
-  if (!heap->nodes) {
+  heap->priority_block = NULL;
+  heap->priorities = NULL;
+  heap->song_ids = NULL;
+  heap->size = 0;
+  heap->capacity = 0;
+  heap->min_capacity = capacity;
+  heap->arity = arity;
+  heap->positions = NULL;
+  heap->position_capacity = 0;
+  heap->far_positions = NULL;
+  heap->scratch = NULL;
+  heap->scratch_capacity = 0;
+
+  if (!heap_resize(heap, capacity)) {
     free(heap);
     return NULL;
   }
 
-  heap->size = 0;
-  heap->capacity = capacity;
-
   return heap;
 }
 
@@ -39,16 +83,27 @@ MaxHeap *heap_create(int capacity) {
  * Operation: insertHeap
  */
 bool insertHeap(MaxHeap *heap, int song_id, float priority) {
-  if (!heap || heap->size >= heap->capacity)
+  if (!heap || song_id < 0)
+    return false;
+
+  // Each song_id owns at most one slot
+  if (heap_find(heap, song_id) != -1)
+    return heap_update_priority(heap, song_id, priority);
+
+  // Grow geometrically so n inserts cost O(n) amortized copying
+  if (heap->size >= heap->capacity && !heap_resize(heap, heap->capacity * 2))
     return false;
 
   // Add at the end
-  heap->nodes[heap->size].song_id = song_id;
-  heap->nodes[heap->size].priority = priority;
+  int index = heap->size;
+  if (!ensure_position_capacity(heap, song_id) ||
+      !set_position(heap, song_id, index))
+    return false;
+  heap->size++;
+  place_node(heap, index, song_id, priority);
 
   // Heapify up to maintain max heap property
-  heapifyUp(heap, heap->size);
-  heap->size++;
+  heapifyUp(heap, index);
 
   return true;
 }
@@ -63,17 +118,19 @@ HeapNode extractMax(MaxHeap *heap) {
   if (!heap || heap->size == 0)
     return invalid;
 
-  HeapNode max = heap->nodes[0];
+  HeapNode max = {heap->song_ids[0], heap->priorities[0]};
 
   // Move last element to root
-  heap->nodes[0] = heap->nodes[heap->size - 1];
+  swap_nodes(heap, 0, heap->size - 1);
   heap->size--;
+  set_position(heap, max.song_id, -1);
 
   // Heapify down to maintain max heap property
   if (heap->size > 0) {
     heapifyDown(heap, 0);
   }
 
+  heap_maybe_shrink(heap);
   return max;
 }
 
@@ -84,63 +141,65 @@ HeapNode heap_peek(MaxHeap *heap) {
   HeapNode invalid = {-1, -1.0f};
   if (!heap || heap->size == 0)
     return invalid;
-  return heap->nodes[0];
+  HeapNode max = {heap->song_ids[0], heap->priorities[0]};
+  return max;
 }
 
 /**
  * Heapify up - restore max heap property
+ * Iterative: the moving node is held aside and ancestors slide down into
+ * the hole, so each level costs one write instead of a full swap
  */
 void heapifyUp(MaxHeap *heap, int index) {
-  if (index <= 0)
-    return;
-
-  int parent = (index - 1) / 2;
-
-  if (heap->nodes[index].priority > heap->nodes[parent].priority) {
-    swap_nodes(&heap->nodes[index], &heap->nodes[parent]);
-    heapifyUp(heap, parent);
+  int song_id = heap->song_ids[index];
+  float priority = heap->priorities[index];
+
+  while (index > 0) {
+    int parent = (index - 1) / heap->arity;
+    if (priority <= heap->priorities[parent])
+      break;
+    place_node(heap, index, heap->song_ids[parent], heap->priorities[parent]);
+    index = parent;
   }
+
+  place_node(heap, index, song_id, priority);
 }
 
 /**
  * Heapify down - restore max heap property
  */
 void heapifyDown(MaxHeap *heap, int index) {
-  int largest = index;
-  int left = 2 * index + 1;
-  int right = 2 * index + 2;
-
-  if (left < heap->size &&
-      heap->nodes[left].priority > heap->nodes[largest].priority) {
-    largest = left;
+  int song_id = heap->song_ids[index];
+  float priority = heap->priorities[index];
+
+  while (true) {
+    int largest = max_child(heap, index);
+    if (largest == -1 || heap->priorities[largest] <= priority)
+      break;
+    place_node(heap, index, heap->song_ids[largest],
+               heap->priorities[largest]);
+    index = largest;
   }
 
-  if (right < heap->size &&
-      heap->nodes[right].priority > heap->nodes[largest].priority) {
-    largest = right;
-  }
-
-  if (largest != index) {
-    swap_nodes(&heap->nodes[index], &heap->nodes[largest]);
-    heapifyDown(heap, largest);
-  }
+  place_node(heap, index, song_id, priority);
 }
 
 /**
  * Update priority of a song
+ * Time Complexity: O(log n) - the slot is found through the position map
  */
 bool heap_update_priority(MaxHeap *heap, int song_id, float new_priority) {
   if (!heap)
     return false;
 
-  int index = find_song_index(heap, song_id);
+  int index = heap_find(heap, song_id);
   if (index == -1) {
     // If not found, insert it
     return insertHeap(heap, song_id, new_priority);
   }
 
-  float old_priority = heap->nodes[index].priority;
-  heap->nodes[index].priority = new_priority;
+  float old_priority = heap->priorities[index];
+  heap->priorities[index] = new_priority;
 
   if (new_priority > old_priority) {
     heapifyUp(heap, index);
@@ -151,6 +210,166 @@ bool heap_update_priority(MaxHeap *heap, int song_id, float new_priority) {
   return true;
 }
 
+/**
+ * Replace the heap contents with n songs in one pass
+ * Uses Floyd's bottom-up heapify: O(n) instead of O(n log n) for n inserts.
+ * If a song_id appears more than once, the last priority wins. If memory
+ * runs out part-way the heap is left empty.
+ */
+bool heap_build_from_array(MaxHeap *heap, const int *song_ids,
+                           const float *priorities, int n) {
+  if (!heap || n < 0 || (n > 0 && (!song_ids || !priorities)))
+    return false;
+
+  int target = heap->min_capacity;
+  while (target < n)
+    target *= 2;
+  if (target > heap->capacity && !heap_resize(heap, target))
+    return false;
+
+  for (int i = 0; i < n; i++) {
+    if (song_ids[i] < 0)
+      return false;
+  }
+
+  // Forget the previous contents
+  for (int i = 0; i < heap->size; i++)
+    set_position(heap, heap->song_ids[i], -1);
+  heap->size = 0;
+
+  // Copy in unordered, collapsing duplicate IDs onto one slot
+  for (int i = 0; i < n; i++) {
+    int index = position_of(heap, song_ids[i]);
+    if (index == -1) {
+      index = heap->size;
+      if (!ensure_position_capacity(heap, song_ids[i]) ||
+          !set_position(heap, song_ids[i], index)) {
+        for (int j = 0; j < heap->size; j++)
+          set_position(heap, heap->song_ids[j], -1);
+        heap->size = 0;
+        return false;
+      }
+      heap->size++;
+      heap->song_ids[index] = song_ids[i];
+    }
+    heap->priorities[index] = priorities[i];
+  }
+
+  // Sift down every internal node, deepest first
+  for (int i = (heap->size - 2) / heap->arity; i >= 0 && heap->size > 1; i--)
+    heapifyDown(heap, i);
+
+  heap_shrink_to_fit(heap);
+  return true;
+}
+
+/**
+ * Write the k highest-priority song IDs into out_ids, best first
+ * The heap is not modified. A small frontier heap of candidate slots is
+ * expanded from the root: each step pops the best candidate and offers its
+ * children, so only O(k) slots are touched. Time Complexity: O(k log k)
+ * Returns the number of IDs written
+ */
+int heap_top_k(MaxHeap *heap, int k, int *out_ids) {
+  if (!heap || !out_ids || k <= 0 || heap->size == 0)
+    return 0;
+  if (k > heap->size)
+    k = heap->size;
+
+  // Each pop adds at most arity candidates, so the frontier stays bounded
+  int bound = k * (heap->arity - 1) + 1;
+  if (heap->scratch_capacity < bound) {
+    int *scratch = (int *)realloc(heap->scratch, sizeof(int) * bound);
+    if (!scratch)
+      return 0;
+    heap->scratch = scratch;
+    heap->scratch_capacity = bound;
+  }
+
+  int *frontier = heap->scratch;
+  int frontier_size = 0;
+  int count = 0;
+
+  frontier_push(heap, frontier, &frontier_size, 0);
+  while (count < k && frontier_size > 0) {
+    int slot = frontier_pop(heap, frontier, &frontier_size);
+    out_ids[count++] = heap->song_ids[slot];
+
+    int first = heap->arity * slot + 1;
+    for (int child = first; child < first + heap->arity && child < heap->size;
+         child++)
+      frontier_push(heap, frontier, &frontier_size, child);
+  }
+
+  return count;
+}
+
+/**
+ * Find the slot holding a song
+ * Returns the slot index, or -1 if the song is not in the heap
+ * Time Complexity: O(1)
+ */
+int heap_find(MaxHeap *heap, int song_id) {
+  if (!heap || song_id < 0)
+    return -1;
+  return position_of(heap, song_id);
+}
+
+/**
+ * Get the priority of a song, or -1.0f if it is not in the heap
+ * Time Complexity: O(1)
+ */
+float heap_get_priority(MaxHeap *heap, int song_id) {
+  int index = heap_find(heap, song_id);
+  return index == -1 ? -1.0f : heap->priorities[index];
+}
+
+/**
+ * Remove a song from the heap by ID
+ * Time Complexity: O(log n)
+ */
+bool heap_remove(MaxHeap *heap, int song_id) {
+  int index = heap_find(heap, song_id);
+  if (index == -1)
+    return false;
+
+  int last = heap->size - 1;
+  float removed_priority = heap->priorities[index];
+
+  // Fill the hole with the last node, then restore order around it
+  swap_nodes(heap, index, last);
+  heap->size--;
+  set_position(heap, song_id, -1);
+
+  if (index < heap->size) {
+    if (heap->priorities[index] > removed_priority) {
+      heapifyUp(heap, index);
+    } else {
+      heapifyDown(heap, index);
+    }
+  }
+
+  heap_maybe_shrink(heap);
+  return true;
+}
+
+/**
+ * Release unused slots after bulk removals
+ * Capacity drops to the next power-of-two multiple of the initial capacity
+ * that still holds every song
+ */
+void heap_shrink_to_fit(MaxHeap *heap) {
+  if (!heap)
+    return;
+
+  int target = heap->min_capacity;
+  while (target < heap->size)
+    target *= 2;
+
+  if (target < heap->capacity)
+    heap_resize(heap, target);
+}
+
 /**
  * Display heap contents
  */
@@ -162,8 +381,8 @@ void heap_display(MaxHeap *heap) {
 
   printf("\n=== POPULAR SONGS (Size: %d) ===\n", heap->size);
   for (int i = 0; i < heap->size && i < 10; i++) {
-    printf("[%d] Song ID: %d, Priority: %.2f\n", i + 1, heap->nodes[i].song_id,
-           heap->nodes[i].priority);
+    printf("[%d] Song ID: %d, Priority: %.2f\n", i + 1, heap->song_ids[i],
+           heap->priorities[i]);
   }
   printf("================================\n\n");
 }
@@ -184,8 +403,15 @@ bool heap_is_empty(MaxHeap *heap) { return !heap || heap->size == 0; }
 void heap_destroy(MaxHeap *heap) {
   if (!heap)
     return;
-  if (heap->nodes)
-    free(heap->nodes);
+  if (heap->priority_block)
+    free(heap->priority_block);
+  if (heap->song_ids)
+    free(heap->song_ids);
+  if (heap->positions)
+    free(heap->positions);
+  hashmap_destroy(heap->far_positions);
+  if (heap->scratch)
+    free(heap->scratch);
   free(heap);
 }
 
@@ -193,17 +419,212 @@ void heap_destroy(MaxHeap *heap) {
 // HELPER FUNCTIONS
 // ============================================================================
 
-static void swap_nodes(HeapNode *a, HeapNode *b) {
-  HeapNode temp = *a;
-  *a = *b;
-  *b = temp;
+/**
+ * Write a node into a slot and record its position
+ */
+static void place_node(MaxHeap *heap, int index, int song_id, float priority) {
+  heap->song_ids[index] = song_id;
+  heap->priorities[index] = priority;
+  set_position(heap, song_id, index);
+}
+
+/**
+ * Swap two slots and keep the position map in sync
+ */
+static void swap_nodes(MaxHeap *heap, int i, int j) {
+  int song_id = heap->song_ids[i];
+  float priority = heap->priorities[i];
+
+  place_node(heap, i, heap->song_ids[j], heap->priorities[j]);
+  place_node(heap, j, song_id, priority);
+}
+
+/**
+ * Index of the highest-priority child of a slot, or -1 for a leaf
+ * Siblings are contiguous in the key array, so this scans one cache line
+ */
+static int max_child(MaxHeap *heap, int index) {
+  int first = heap->arity * index + 1;
+  if (first >= heap->size)
+    return -1;
+
+  int last = first + heap->arity;
+  if (last > heap->size)
+    last = heap->size;
+
+  const float *keys = heap->priorities;
+  int largest = first;
+  for (int child = first + 1; child < last; child++) {
+    if (keys[child] > keys[largest])
+      largest = child;
+  }
+  return largest;
+}
+
+/**
+ * Reallocate the key and ID arrays; contents and positions are unchanged
+ * The key array is offset so that slot 1 (the first sibling group) starts
+ * on a cache line, which aligns every later group of 2, 4 or 8 children.
+ */
+static bool heap_resize(MaxHeap *heap, int new_capacity) {
+  if (new_capacity < heap->size || new_capacity <= 0)
+    return false;
+
+  float *block =
+      (float *)malloc(sizeof(float) * (new_capacity + HEAP_ALIGN_PAD));
+  if (!block)
+    return false;
+
+  int *song_ids = (int *)realloc(heap->song_ids, sizeof(int) * new_capacity);
+  if (!song_ids) {
+    free(block);
+    return false;
+  }
+  heap->song_ids = song_ids;
+
+  uintptr_t group = (uintptr_t)(block + 1);
+  group = (group + HEAP_CACHE_LINE - 1) & ~(uintptr_t)(HEAP_CACHE_LINE - 1);
+  float *priorities = (float *)group - 1;
+
+  if (heap->size > 0)
+    memcpy(priorities, heap->priorities, sizeof(float) * heap->size);
+  if (heap->priority_block)
+    free(heap->priority_block);
+
+  heap->priority_block = block;
+  heap->priorities = priorities;
+  heap->capacity = new_capacity;
+  return true;
 }
 
-static int find_song_index(MaxHeap *heap, int song_id) {
-  for (int i = 0; i < heap->size; i++) {
-    if (heap->nodes[i].song_id == song_id) {
-      return i;
+/**
+ * Halve capacity once the heap is a quarter full
+ * The gap between the grow and shrink thresholds avoids thrashing when the
+ * size oscillates around a power of two
+ */
+static void heap_maybe_shrink(MaxHeap *heap) {
+  if (heap->capacity > heap->min_capacity &&
+      heap->size <= heap->capacity / 4) {
+    int target = heap->capacity / 2;
+    if (target < heap->min_capacity)
+      target = heap->min_capacity;
+    heap_resize(heap, target);
+  }
+}
+
+/**
+ * Make song_id addressable before it is given a slot
+ * Song IDs are normally dense database keys, so a direct-indexed array
+ * covers them. It only grows while it stays within HEAP_DIRECT_PER_SLOT
+ * entries per heap slot (or HEAP_DIRECT_IDS); a sparse or very large ID
+ * goes to the far_positions hashmap instead. Growing the array moves the
+ * hashmap entries it now covers into it.
+ */
+static bool ensure_position_capacity(MaxHeap *heap, int song_id) {
+  if (song_id < heap->position_capacity)
+    return true;
+
+  size_t limit = (size_t)heap->capacity * HEAP_DIRECT_PER_SLOT;
+  if (limit < HEAP_DIRECT_IDS)
+    limit = HEAP_DIRECT_IDS;
+  if ((size_t)song_id >= limit) {
+    if (!heap->far_positions)
+      heap->far_positions = hashmap_create(16);
+    return heap->far_positions != NULL;
+  }
+
+  size_t new_capacity =
+      heap->position_capacity > 0 ? (size_t)heap->position_capacity : 64;
+  while (new_capacity <= (size_t)song_id)
+    new_capacity *= 2;
+  if (new_capacity > INT_MAX)
+    new_capacity = INT_MAX;
+
+  int *positions = (int *)realloc(heap->positions, sizeof(int) * new_capacity);
+  if (!positions)
+    return false;
+
+  int old_capacity = heap->position_capacity;
+  for (size_t i = (size_t)old_capacity; i < new_capacity; i++)
+    positions[i] = -1;
+
+  heap->positions = positions;
+  heap->position_capacity = (int)new_capacity;
+  for (int i = 0; heap->far_positions && i < heap->size; i++) {
+    int id = heap->song_ids[i];
+    if (id >= old_capacity && id < heap->position_capacity) {
+      hashmap_remove(heap->far_positions, id);
+      positions[id] = i;
     }
   }
-  return -1;
+  return true;
+}
+
+/**
+ * Slot holding song_id (>= 0), or -1
+ */
+static int position_of(MaxHeap *heap, int song_id) {
+  if (song_id < heap->position_capacity)
+    return heap->positions[song_id];
+  if (!heap->far_positions)
+    return -1;
+  void *slot = hashmap_get(heap->far_positions, song_id);
+  return slot ? (int)(intptr_t)slot - 1 : -1;
+}
+
+/**
+ * Record song_id's slot, or -1 to forget it
+ * Fails only when a far ID cannot be added to the hashmap
+ */
+static bool set_position(MaxHeap *heap, int song_id, int index) {
+  if (song_id < heap->position_capacity) {
+    heap->positions[song_id] = index;
+    return true;
+  }
+  if (!heap->far_positions)
+    return index == -1;
+  if (index == -1) {
+    hashmap_remove(heap->far_positions, song_id);
+    return true;
+  }
+  return hashmap_put(heap->far_positions, song_id, (void *)(intptr_t)(index + 1));
+}
+
+/**
+ * Frontier heap used by heap_top_k
+ * Holds slot indices into the heap, ordered by their priority
+ */
+static void frontier_push(MaxHeap *heap, int *frontier, int *count, int slot) {
+  const float *keys = heap->priorities;
+  int index = (*count)++;
+  while (index > 0) {
+    int parent = (index - 1) / 2;
+    if (keys[frontier[parent]] >= keys[slot])
+      break;
+    frontier[index] = frontier[parent];
+    index = parent;
+  }
+  frontier[index] = slot;
+}
+
+static int frontier_pop(MaxHeap *heap, int *frontier, int *count) {
+  const float *keys = heap->priorities;
+  int top = frontier[0];
+  int last = frontier[--(*count)];
+  int index = 0;
+
+  while (true) {
+    int child = 2 * index + 1;
+    if (child >= *count)
+      break;
+    if (child + 1 < *count && keys[frontier[child + 1]] > keys[frontier[child]])
+      child++;
+    if (keys[frontier[child]] <= keys[last])
+      break;
+    frontier[index] = frontier[child];
+    index = child;
+  }
+  frontier[index] = last;
+
+  return top;
 }
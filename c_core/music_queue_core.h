@@ -5,8 +5,8 @@
  * All core DSA implemented in pure C for optimal performance
  *
  * Complexity guarantees:
- * - Doubly Linked List: O(1) insert/delete with reference
- * - Max Heap: O(log n) insert/extract, O(1) peek
+ * - Doubly Linked List: O(log n) insert/delete/index-of/item-at/move-to
+ * - Max Heap: O(log n) insert/extract/update/remove, O(1) peek and lookup
  * - Stack: O(1) push/pop
  * - Queue: O(1) enqueue/dequeue
  * - HashMap: O(1) average case lookup/insert/delete
@@ -41,9 +41,46 @@ typedef enum {
   OP_SKIP,
   OP_MOVE_UP,
   OP_MOVE_DOWN,
-  OP_UPDATE_PRIORITY
+  OP_UPDATE_PRIORITY,
+  OP_MOVE_TO,
+  OP_ROTATE,
+  OP_BATCH // History marker over the song_id operations recorded below it
 } OperationType;
 
+// ============================================================================
+// NODE POOL (Slab Allocator for list/queue/trie nodes)
+// ============================================================================
+
+struct PoolSlab;
+
+typedef struct {
+  size_t node_size;
+  size_t slab_header;
+  int nodes_per_slab;
+  void *free_list; // Recycled nodes, linked through their first word
+  struct PoolSlab *slabs;
+  char *bump; // Next never-used node in the newest slab
+  int bump_left;
+  int slab_count;
+  int nodes_in_use;
+} NodePool;
+
+typedef struct {
+  int node_size;
+  int nodes_per_slab;
+  int slab_count;
+  int nodes_in_use;
+  int nodes_free;
+  long bytes_reserved;
+} PoolStats;
+
+// Pool Functions
+NodePool *pool_create(size_t node_size, int nodes_per_slab);
+void *pool_alloc(NodePool *pool);
+void pool_free(NodePool *pool, void *node);
+void pool_get_stats(NodePool *pool, PoolStats *stats);
+void pool_destroy(NodePool *pool);
+
 // ============================================================================
 // DOUBLY LINKED LIST (Main Queue)
 // ============================================================================
@@ -52,18 +89,35 @@ typedef struct DLLNode {
   int song_id;
   struct DLLNode *next;
   struct DLLNode *prev;
+  // Chain of nodes sharing this song_id, in queue order.
+  // The first node's prev_dup points at the last one.
+  struct DLLNode *next_dup;
+  struct DLLNode *prev_dup;
+  // Implicit treap keyed by queue position, for O(log n) positional access
+  struct DLLNode *left;
+  struct DLLNode *right;
+  struct DLLNode *parent;
+  unsigned int weight; // Random treap priority
+  int count;           // Nodes in this subtree
 } DLLNode;
 
+typedef struct HashMap HashMap;
+
 typedef struct {
   DLLNode *head;
   DLLNode *tail;
   DLLNode *current; // Currently playing song
   int size;
+  HashMap *index; // song_id -> first DLLNode holding it
+  DLLNode *root;  // Root of the position treap
+  unsigned int seed;
+  NodePool *pool; // Node allocator; NULL uses malloc
 } DoublyLinkedList;
 
 // DLL Functions (CDLL)
 DoublyLinkedList *dll_create();
 DLLNode *dll_insert_end(DoublyLinkedList *list, int song_id);
+DLLNode *dll_insert_at(DoublyLinkedList *list, int song_id, int index);
 bool dll_remove(DoublyLinkedList *list, DLLNode *node);
 bool dll_move_up(DoublyLinkedList *list, DLLNode *node);
 bool dll_move_down(DoublyLinkedList *list, DLLNode *node);
@@ -71,10 +125,36 @@ void dll_rotate(DoublyLinkedList *list, bool forward);
 DLLNode *dll_get_next(DoublyLinkedList *list, DLLNode *current);
 DLLNode *dll_get_prev(DoublyLinkedList *list, DLLNode *current);
 DLLNode *dll_find_by_id(DoublyLinkedList *list, int song_id);
+int dll_index_of(DoublyLinkedList *list, DLLNode *node);
+DLLNode *dll_get_at(DoublyLinkedList *list, int index);
+bool dll_move_to(DoublyLinkedList *list, DLLNode *node, int index);
 void dll_display(DoublyLinkedList *list);
 void dll_destroy(DoublyLinkedList *list);
 int dll_get_size(DoublyLinkedList *list);
 
+// ============================================================================
+// HASHMAP (song_id Index)
+// ============================================================================
+
+typedef struct {
+  int key;
+  void *value; // NULL marks an empty slot
+} HashEntry;
+
+struct HashMap {
+  HashEntry *entries;
+  int capacity; // Power of two
+  int size;
+};
+
+// HashMap Functions
+HashMap *hashmap_create(int capacity);
+bool hashmap_put(HashMap *map, int key, void *value);
+void *hashmap_get(HashMap *map, int key);
+bool hashmap_remove(HashMap *map, int key);
+int hashmap_get_size(HashMap *map);
+void hashmap_destroy(HashMap *map);
+
 // ============================================================================
 // MAX HEAP (Priority Queue for Recommendations)
 // ============================================================================
@@ -84,25 +164,64 @@ typedef struct {
   float priority;
 } HeapNode;
 
+/**
+ * Children per heap node; 4 keeps a node's children in one 16-byte group
+ * Override at build time with -DHEAP_DEFAULT_ARITY=2|4|8
+ */
+#ifndef HEAP_DEFAULT_ARITY
+#define HEAP_DEFAULT_ARITY 4
+#endif
+
 typedef struct {
-  HeapNode *nodes;
+  float *priorities; // Keys, split from IDs; no sibling group straddles a line
+  int *song_ids;     // song_ids[i] is the song in slot i
   int size;
-  int capacity;
+  int capacity;     // Grows by doubling on insert
+  int min_capacity; // Initial capacity, the floor for shrinking
+  int arity;        // Children per node: 2, 4 or 8
+  int *positions;   // song_id -> slot, -1 if absent
+  int position_capacity;
+  HashMap *far_positions; // song_id -> slot + 1 for IDs past positions
+  int *scratch; // Reusable frontier buffer for heap_top_k
+  int scratch_capacity;
+  float *priority_block; // Unaligned allocation backing priorities
 } MaxHeap;
 
 // Heap Functions
 MaxHeap *heap_create(int capacity);
+MaxHeap *heap_create_with_arity(int capacity, int arity);
 bool insertHeap(MaxHeap *heap, int song_id, float priority);
 HeapNode extractMax(MaxHeap *heap);
 HeapNode heap_peek(MaxHeap *heap);
 void heapifyUp(MaxHeap *heap, int index);
 void heapifyDown(MaxHeap *heap, int index);
 bool heap_update_priority(MaxHeap *heap, int song_id, float new_priority);
+int heap_find(MaxHeap *heap, int song_id);
+float heap_get_priority(MaxHeap *heap, int song_id);
+bool heap_remove(MaxHeap *heap, int song_id);
+void heap_shrink_to_fit(MaxHeap *heap);
+bool heap_build_from_array(MaxHeap *heap, const int *song_ids,
+                           const float *priorities, int n);
+int heap_top_k(MaxHeap *heap, int k, int *out_ids);
 void heap_display(MaxHeap *heap);
 void heap_destroy(MaxHeap *heap);
 int heap_get_size(MaxHeap *heap);
 bool heap_is_empty(MaxHeap *heap);
 
+// ============================================================================
+// POSTING LISTS (Compressed ascending song ID lists for the search index)
+// ============================================================================
+
+// IDs per delta-coded block; one skip table entry per block
+#define POSTING_BLOCK 128
+
+// Posting List Functions
+size_t postings_encode(const int *ids, int count, unsigned char *out);
+int postings_count(const unsigned char *data);
+int postings_decode(const unsigned char *data, int *out);
+bool postings_any_in(const unsigned char *data, int lo, int hi);
+bool postings_contains(const unsigned char *data, int id);
+
 // ============================================================================
 // TRIE (Song and Artist Search)
 // ============================================================================
@@ -110,49 +229,153 @@ bool heap_is_empty(MaxHeap *heap);
 typedef struct SongIdNode {
   int song_id;
   struct SongIdNode *next;
+  struct TrieNode *node; // Trie terminal links only: node indexing song_id
 } SongIdNode;
 
+/**
+ * Completions cached per trie node
+ * Only nodes with more than TRIE_TOP_K postings below them keep a list;
+ * smaller subtrees are ranked on demand. Override at build time with
+ * -DTRIE_TOP_K=n
+ */
+#ifndef TRIE_TOP_K
+#define TRIE_TOP_K 10
+#endif
+
+// Longest indexed word in folded UTF-8 bytes, including the terminator
+// (longer words are cut at a character boundary), and most terms per query
+#define TRIE_MAX_WORD 128
+#define TRIE_MAX_TERMS 8
+
+// Largest edit distance trie_search_fuzzy accepts per query word
+#define TRIE_MAX_EDITS 2
+
+/**
+ * Radix (path-compressed) trie node
+ * Each node is reached by a label of one or more bytes of folded UTF-8 text
+ * (a split may fall inside a multi-byte character); children are kept in a
+ * compact array sorted by the first byte of their label.
+ */
 typedef struct TrieNode {
-  struct TrieNode *children[26];
+  const char *label; // Not NUL-terminated; points into the trie's label arena
+  int label_len;     // In bytes
+  unsigned short child_count;
+  unsigned short child_capacity;
+  unsigned char *child_keys;   // First label byte of each child, sorted
+  struct TrieNode **children;  // Same allocation as child_keys
+  struct TrieNode *parent;
   bool isEnd;
-  SongIdNode *song_ids;
+  int *postings; // Songs with a key ending here, ascending
+  int posting_count;
+  int posting_capacity;
+  int subtree_postings; // Postings at or below this node
+  int top_count;
+  HeapNode *top; // TRIE_TOP_K best songs in this subtree, highest first;
+                 // NULL while subtree_postings <= TRIE_TOP_K
 } TrieNode;
 
+typedef struct TrieLabelChunk TrieLabelChunk;
+typedef struct TrieImage TrieImage; // Read-only mapped index (trie_load)
+
+typedef struct {
+  TrieNode *root;
+  NodePool *node_pool; // TrieNode allocator; NULL uses malloc
+  NodePool *id_pool;   // SongIdNode (terminal link) allocator; NULL: malloc
+  MaxHeap *ranking;    // Priority source for completions; NULL ranks by ID
+  HashMap *terminals;  // song_id -> SongIdNode chain of nodes indexing it
+  TrieLabelChunk *labels; // Append-only storage for edge labels
+  int *matches;           // Reusable query buffers for trie_search_words
+  int match_capacity;
+  int *term_matches;
+  int term_capacity;
+  TrieImage *image;   // Base index from trie_load; inserts go to root
+  int *image_matches; // Query buffer for image results
+  int image_capacity;
+  int *removed;       // Image songs removed since loading, ascending
+  int removed_count;
+  int removed_capacity;
+} Trie;
+
+typedef struct {
+  int node_count;
+  int key_count;     // Distinct keys (nodes with isEnd)
+  int entry_count;   // (key, song_id) pairs
+  long label_chars;  // Sum of label lengths; 1 node each without compression
+  long node_bytes;   // node_count * sizeof(TrieNode) plus completion lists
+  long label_bytes;  // Label arena, including slack
+  long child_bytes;  // Child arrays, including slack
+  long entry_bytes;  // Posting arrays and terminal links
+  long image_bytes;  // Mapped base index; 0 without trie_load
+} TrieStats;
+
 // Trie Functions
-TrieNode *trie_create();
-void trie_insert(TrieNode *root, const char *key, int song_id);
-SongIdNode *trie_search_prefix(TrieNode *root, const char *prefix);
-void trie_display_results(TrieNode *root, const char *prefix);
-void trie_destroy(TrieNode *root);
+Trie *trie_create();
+Trie *trie_create_pooled(NodePool *node_pool, NodePool *id_pool);
+void trie_insert(Trie *trie, const char *key, int song_id);
+void trie_index_text(Trie *trie, const char *text, int song_id);
+bool trie_remove(Trie *trie, const char *key, int song_id);
+bool trie_remove_song(Trie *trie, int song_id);
+int trie_search_prefix_into(Trie *trie, const char *prefix, int *out_ids,
+                            int cap);
+int trie_search_words(Trie *trie, const char *query, int *out_ids, int cap);
+int trie_search_fuzzy(Trie *trie, const char *query, int max_edits,
+                      int *out_ids, int cap);
+int trie_top_k(Trie *trie, const char *prefix, int k, int *out_ids);
+void trie_set_ranking(Trie *trie, MaxHeap *ranking);
+void trie_update_priority(Trie *trie, int song_id, float priority);
+void trie_refresh_ranking(Trie *trie);
+void trie_get_stats(Trie *trie, TrieStats *stats);
+bool trie_save(Trie *trie, const char *path);
+bool trie_load(Trie *trie, const char *path);
+void trie_unload(Trie *trie);
+bool trie_has_song(Trie *trie, int song_id);
+void trie_display_results(Trie *trie, const char *prefix);
+void trie_destroy(Trie *trie);
 
 // ============================================================================
 // STACK (Undo/Redo System)
 // ============================================================================
 
+/**
+ * A recorded operation, with the state on both sides of it
+ * Positions are queue indices (-1 where the song is not queued); the queue
+ * is restored exactly, so they identify the same nodes when replayed.
+ */
 typedef struct {
   OperationType type;
   int song_id;
   int old_position;
   float old_priority;
+  int new_position;
+  float new_priority;
+  bool was_ranked;  // Whether the song was in the heap before
+  int old_current;  // Position of the current song before, or -1
+  int new_current;  // ...and after
 } Operation;
 
-typedef struct StackNode {
-  Operation op;
-  struct StackNode *next;
-} StackNode;
-
+/**
+ * Ring buffer of the newest capacity operations; pushing onto a full stack
+ * overwrites the oldest
+ */
 typedef struct {
-  StackNode *top;
+  Operation *ops;
+  int capacity;
+  int top; // Slot of the next push
   int size;
 } Stack;
 
+// Operations kept by each of the manager's undo and redo stacks
+#define UNDO_HISTORY_DEPTH 1024
+
 // Stack Functions
-Stack *stack_create();
+Stack *stack_create(int capacity);
 bool stack_push(Stack *stack, Operation op);
 Operation stack_pop(Stack *stack);
 Operation stack_peek(Stack *stack);
+Operation stack_peek_at(Stack *stack, int depth);
 bool stack_is_empty(Stack *stack);
 int stack_get_size(Stack *stack);
+bool stack_set_capacity(Stack *stack, int capacity);
 void stack_clear(Stack *stack);
 void stack_destroy(Stack *stack);
 
@@ -169,6 +392,7 @@ typedef struct {
   QueueNode *front;
   QueueNode *rear;
   int size;
+  NodePool *pool; // Node allocator; NULL uses malloc
 } Queue;
 
 // Queue Functions
@@ -181,40 +405,226 @@ int queue_get_size(Queue *queue);
 void queue_clear(Queue *queue);
 void queue_destroy(Queue *queue);
 
+// ============================================================================
+// WRITE-AHEAD LOG (Durable queue state)
+// ============================================================================
+
+/**
+ * Group commit: a log write is made durable (fsync) once this many records
+ * are pending, or when a record is appended and the oldest pending one is
+ * this old. Nothing syncs on a timer; callers that acknowledge changes call
+ * manager_commit_log first.
+ */
+#define WAL_GROUP_RECORDS 64
+#define WAL_GROUP_WINDOW_MS 10
+
+// Records after which the manager folds the log into a new checkpoint
+#define WAL_CHECKPOINT_RECORDS 65536
+
+// WalRecord flags
+#define WAL_REVERT 0x1    // The record undoes op rather than applying it
+#define WAL_CONTINUED 0x2 // More records of the same atomic group follow
+
+typedef struct {
+  Operation op;
+  int flags;
+} WalRecord;
+
+/**
+ * Append-only log of the operations applied since the last checkpoint
+ * Checkpoint and log carry a generation; a log whose generation differs
+ * from the checkpoint's is already folded into it. One process at a time
+ * owns a log directory, through an exclusive lock on its queue.lock.
+ */
+typedef struct {
+  bool open;
+  bool failed; // A write failed; the log is no longer trustworthy
+  bool locked; // lock_fd holds the directory's lock
+  int lock_fd;
+  int fd;
+  char *dir;
+  unsigned int generation;
+  int records; // In the log since the checkpoint
+  int pending; // Written but not yet synced
+  long long first_pending_ms;
+} WriteAheadLog;
+
+// WAL Functions
+int wal_read_checkpoint(const char *dir, unsigned int *out_generation,
+                        int **out_ids, int *out_current);
+WalRecord *wal_read(const char *dir, unsigned int generation, int *out_count);
+bool wal_lock(WriteAheadLog *log, const char *dir);
+bool wal_open(WriteAheadLog *log, const char *dir, unsigned int generation,
+              int keep);
+bool wal_append(WriteAheadLog *log, const Operation *op, int flags);
+bool wal_sync(WriteAheadLog *log);
+bool wal_checkpoint(WriteAheadLog *log, const int *ids, int count,
+                    int current);
+void wal_close(WriteAheadLog *log);
+
 // ============================================================================
 // UNIFIED MUSIC QUEUE MANAGER
 // ============================================================================
 
+#define RECOMMENDATION_CACHE_SIZE 100
+
+/**
+ * Materialized top-K view of the recommendation heap
+ * Holds the best min(K, heap size) songs, best first. Patched in place on
+ * priority changes; rebuilt lazily only when an update could pull in a song
+ * from below the K-th threshold.
+ */
+typedef struct {
+  int ids[RECOMMENDATION_CACHE_SIZE];
+  float priorities[RECOMMENDATION_CACHE_SIZE];
+  int count;
+  bool valid;
+} TopKCache;
+
+/**
+ * Per-manager node pools, one per node type
+ */
+typedef enum {
+  POOL_DLL_NODE,
+  POOL_QUEUE_NODE,
+  POOL_TRIE_NODE,
+  POOL_SONG_ID_NODE,
+  POOL_COUNT
+} PoolKind;
+
+#define POOL_NODES_PER_SLAB 256
+
+/**
+ * manager_search flags
+ */
+#define SEARCH_TITLES 0x1  // Title and album words
+#define SEARCH_ARTISTS 0x2 // Artist words
+#define SEARCH_ALL (SEARCH_TITLES | SEARCH_ARTISTS)
+#define SEARCH_FUZZY 0x4 // Retry allowing typos when nothing matches exactly
+
+/**
+ * Reusable manager_search state
+ * A song is taken once per query by stamping it with the query's generation
+ * in a hashmap keyed by song_id, so nothing has to be cleared between
+ * queries and memory follows the matched songs rather than the largest ID.
+ */
+typedef struct {
+  int *ids; // Raw matches of one trie
+  int id_capacity;
+  HeapNode *ranked; // Unique matches with their priorities
+  int ranked_capacity;
+  HashMap *stamps; // song_id -> generation it was last taken in
+  unsigned int generation;
+} SearchScratch;
+
+/**
+ * One queue mutation for manager_apply_batch
+ * OP_ADD uses title, artist, likes and play_count; OP_UPDATE_PRIORITY likes
+ * and play_count; OP_MOVE_TO position; OP_SKIP and OP_ROTATE forward.
+ */
+typedef struct {
+  OperationType type;
+  int song_id;
+  int position;
+  bool forward;
+  int likes;
+  int play_count;
+  const char *title;
+  const char *artist;
+} QueueOp;
+
+/**
+ * Operations recorded by the batch in progress, pushed as one undo entry
+ */
+typedef struct {
+  Operation *ops;
+  int capacity;
+  int count;
+  bool active;
+} BatchScratch;
+
 typedef struct {
   DoublyLinkedList *queue;
   MaxHeap *recommendations;
   Stack *undo_stack;
   Stack *redo_stack;
   Queue *upcoming;
-  TrieNode *song_trie;
-  TrieNode *artist_trie;
+  Trie *song_trie;
+  Trie *artist_trie;
+  TopKCache top_cache;
+  NodePool *pools[POOL_COUNT];
+  SearchScratch search;
+  BatchScratch batch;
+  WriteAheadLog log;
 } MusicQueueManager;
 
 // Manager Functions
 MusicQueueManager *manager_create(int heap_capacity);
 bool manager_add_song(MusicQueueManager *mgr, int song_id, const char *title,
                       const char *artist, int likes, int play_count);
+bool manager_index_song(MusicQueueManager *mgr, int song_id, const char *title,
+                        const char *artist, const char *album);
+bool manager_unindex_song(MusicQueueManager *mgr, int song_id);
+bool manager_update_song(MusicQueueManager *mgr, int song_id, const char *title,
+                         const char *artist, const char *album);
+bool manager_unrank_song(MusicQueueManager *mgr, int song_id);
 bool manager_remove_song(MusicQueueManager *mgr, int song_id);
 bool manager_skip_next(MusicQueueManager *mgr);
 bool manager_skip_prev(MusicQueueManager *mgr);
 bool manager_move_up(MusicQueueManager *mgr, int song_id);
 bool manager_move_down(MusicQueueManager *mgr, int song_id);
+bool manager_move_to(MusicQueueManager *mgr, int song_id, int position);
+int manager_index_of(MusicQueueManager *mgr, int song_id);
+int manager_get_song_at(MusicQueueManager *mgr, int position);
 bool manager_rotate_queue(MusicQueueManager *mgr, bool forward);
 bool manager_update_priority(MusicQueueManager *mgr, int song_id, int likes,
                              int play_count);
+bool manager_build_recommendations(MusicQueueManager *mgr, const int *song_ids,
+                                   const int *likes, const int *play_counts,
+                                   int n);
 bool manager_undo(MusicQueueManager *mgr);
 bool manager_redo(MusicQueueManager *mgr);
+bool manager_set_history_depth(MusicQueueManager *mgr, int depth);
+bool manager_apply_batch(MusicQueueManager *mgr, const QueueOp *ops, int n,
+                         bool *out_results);
+bool manager_open_log(MusicQueueManager *mgr, const char *dir);
+bool manager_commit_log(MusicQueueManager *mgr);
+void manager_close_log(MusicQueueManager *mgr);
+bool manager_checkpoint(MusicQueueManager *mgr);
 int manager_get_current_song(MusicQueueManager *mgr);
+int manager_export_queue(MusicQueueManager *mgr, int *out_ids, int cap,
+                         int *out_current_index);
 void manager_display_queue(MusicQueueManager *mgr);
 void manager_display_recommendations(MusicQueueManager *mgr);
 void manager_destroy(MusicQueueManager *mgr);
 SongIdNode *manager_search_songs(MusicQueueManager *mgr, const char *query);
 SongIdNode *manager_search_artists(MusicQueueManager *mgr, const char *query);
 SongIdNode *manager_get_recommendations(MusicQueueManager *mgr, int limit);
+int manager_get_top_k(MusicQueueManager *mgr, int k, int *out_ids);
+int manager_search_songs_into(MusicQueueManager *mgr, const char *query,
+                              int *out_ids, int cap);
+int manager_search_artists_into(MusicQueueManager *mgr, const char *query,
+                                int *out_ids, int cap);
+int manager_search_songs_fuzzy_into(MusicQueueManager *mgr, const char *query,
+                                    int max_edits, int *out_ids, int cap);
+int manager_search_artists_fuzzy_into(MusicQueueManager *mgr,
+                                      const char *query, int max_edits,
+                                      int *out_ids, int cap);
+int manager_search(MusicQueueManager *mgr, const char *query, int flags,
+                   int *out_ids, int cap);
+int manager_suggest_songs(MusicQueueManager *mgr, const char *prefix, int k,
+                          int *out_ids);
+int manager_suggest_artists(MusicQueueManager *mgr, const char *prefix, int k,
+                            int *out_ids);
+bool manager_save_index(MusicQueueManager *mgr, const char *dir);
+bool manager_load_index(MusicQueueManager *mgr, const char *dir);
+bool manager_log_index_edit(MusicQueueManager *mgr, const char *dir,
+                            int song_id);
+bool manager_is_indexed(MusicQueueManager *mgr, int song_id);
+int manager_get_recommendations_into(MusicQueueManager *mgr, int *out_ids,
+                                     int cap);
+void manager_free_song_list(SongIdNode *list);
+bool manager_get_pool_stats(MusicQueueManager *mgr, PoolKind kind,
+                            PoolStats *stats);
 
 #endif // MUSIC_QUEUE_CORE_H
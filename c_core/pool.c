@@ -0,0 +1,151 @@
+/**
+ * Node Pool Implementation (Slab Allocator)
+ *
+ * Fixed-size node allocator shared by the manager's containers
+ * Nodes are carved from large slabs and recycled through a freelist, so
+ * enqueue/undo/skip traffic never reaches malloc, nodes of one type stay
+ * packed together, and teardown frees whole slabs instead of single nodes
+ */
+
+#include "music_queue_core.h"
+
+/**
+ * Slab header; nodes follow it in the same allocation
+ */
+struct PoolSlab {
+  struct PoolSlab *next;
+};
+
+// Helper function prototypes
+static bool pool_add_slab(NodePool *pool);
+
+/**
+ * Create a pool for nodes of node_size bytes
+ * Time Complexity: O(1)
+ */
+NodePool *pool_create(size_t node_size, int nodes_per_slab) {
+  if (node_size == 0 || nodes_per_slab <= 0)
+    return NULL;
+
+  NodePool *pool = (NodePool *)malloc(sizeof(NodePool));
+  if (!pool)
+    return NULL;
+
+  // Every node must be able to hold the freelist link and stay aligned
+  size_t align = sizeof(void *) > sizeof(double) ? sizeof(void *)
+                                                 : sizeof(double);
+  if (node_size < sizeof(void *))
+    node_size = sizeof(void *);
+  node_size = (node_size + align - 1) & ~(align - 1);
+
+  // Round the slab header up so the first node keeps that alignment
+  size_t header = (sizeof(struct PoolSlab) + align - 1) & ~(align - 1);
+
+  pool->node_size = node_size;
+  pool->nodes_per_slab = nodes_per_slab;
+  pool->slab_header = header;
+  pool->free_list = NULL;
+  pool->slabs = NULL;
+  pool->bump = NULL;
+  pool->bump_left = 0;
+  pool->slab_count = 0;
+  pool->nodes_in_use = 0;
+
+  return pool;
+}
+
+/**
+ * Allocate one node
+ * Recycled nodes are reused first, then the current slab is carved
+ * Time Complexity: O(1) amortized
+ */
+void *pool_alloc(NodePool *pool) {
+  if (!pool)
+    return NULL;
+
+  void *node;
+  if (pool->free_list) {
+    node = pool->free_list;
+    pool->free_list = *(void **)node;
+  } else {
+    if (pool->bump_left == 0 && !pool_add_slab(pool))
+      return NULL;
+    node = pool->bump;
+    pool->bump += pool->node_size;
+    pool->bump_left--;
+  }
+
+  pool->nodes_in_use++;
+  return node;
+}
+
+/**
+ * Return a node to the pool
+ * Time Complexity: O(1)
+ */
+void pool_free(NodePool *pool, void *node) {
+  if (!pool || !node)
+    return;
+
+  *(void **)node = pool->free_list;
+  pool->free_list = node;
+  pool->nodes_in_use--;
+}
+
+/**
+ * Report slab usage
+ */
+void pool_get_stats(NodePool *pool, PoolStats *stats) {
+  if (!stats)
+    return;
+  memset(stats, 0, sizeof(PoolStats));
+  if (!pool)
+    return;
+
+  stats->node_size = (int)pool->node_size;
+  stats->nodes_per_slab = pool->nodes_per_slab;
+  stats->slab_count = pool->slab_count;
+  stats->nodes_in_use = pool->nodes_in_use;
+  stats->nodes_free =
+      pool->slab_count * pool->nodes_per_slab - pool->nodes_in_use;
+  stats->bytes_reserved =
+      (long)pool->slab_count *
+      (long)(pool->slab_header + pool->node_size * pool->nodes_per_slab);
+}
+
+/**
+ * Destroy the pool and every node allocated from it
+ * Time Complexity: O(number of slabs)
+ */
+void pool_destroy(NodePool *pool) {
+  if (!pool)
+    return;
+
+  struct PoolSlab *slab = pool->slabs;
+  while (slab) {
+    struct PoolSlab *next = slab->next;
+    free(slab);
+    slab = next;
+  }
+
+  free(pool);
+}
+
+// ============================================================================
+// HELPER FUNCTIONS
+// ============================================================================
+
+static bool pool_add_slab(NodePool *pool) {
+  struct PoolSlab *slab = (struct PoolSlab *)malloc(
+      pool->slab_header + pool->node_size * pool->nodes_per_slab);
+  if (!slab)
+    return false;
+
+  slab->next = pool->slabs;
+  pool->slabs = slab;
+  pool->slab_count++;
+
+  pool->bump = (char *)slab + pool->slab_header;
+  pool->bump_left = pool->nodes_per_slab;
+  return true;
+}
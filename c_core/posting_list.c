@@ -0,0 +1,272 @@
+/**
+ * Posting List Implementation (Compressed Song ID Lists)
+ *
+ * Read-only encoding of ascending song ID lists for the on-disk search index
+ * IDs are stored as varint gaps in blocks of POSTING_BLOCK; each block opens
+ * with an absolute ID, and a skip table of (first ID, offset) pairs lets a
+ * lookup jump straight to the one block that can hold it. A list whose range
+ * is dense enough that one bit per ID in it is smaller is stored as a bitmap.
+ *
+ * Layout (varint unless noted):
+ *   kind (1 byte), count
+ *   POSTINGS_DELTA:  (blocks - 1) skip entries of two native uint32s - the
+ *                    block's first ID and its offset past the table - then
+ *                    the blocks
+ *   POSTINGS_BITMAP: first ID, bitmap bytes, bitmap (bit i: first ID + i)
+ *
+ * A list never needs alignment, so encoded lists are packed back to back.
+ */
+
+#include "music_queue_core.h"
+#include <stdint.h>
+
+#define POSTINGS_DELTA 0
+#define POSTINGS_BITMAP 1
+
+/**
+ * Output cursor; out == NULL only measures
+ */
+typedef struct {
+  unsigned char *out;
+  size_t pos;
+} PostingWriter;
+
+// Helper function prototypes
+static void put_byte(PostingWriter *writer, unsigned char byte);
+static void put_varint(PostingWriter *writer, uint32_t value);
+static void put_uint32(PostingWriter *writer, size_t at, uint32_t value);
+static uint32_t get_varint(const unsigned char **in);
+static uint32_t get_uint32(const unsigned char *in);
+static size_t encode_delta(const int *ids, int count, PostingWriter *writer);
+static int skip_to_block(const unsigned char *table, int blocks, int id);
+
+/**
+ * Encode count ascending IDs into out, in the smaller of the two layouts
+ * With out == NULL only the size is computed
+ * Time Complexity: O(count)
+ * Returns the encoded size in bytes
+ */
+size_t postings_encode(const int *ids, int count, unsigned char *out) {
+  PostingWriter measure = {NULL, 0};
+  size_t delta_size = encode_delta(ids, count, &measure);
+
+  PostingWriter writer = {out, 0};
+  if (count > 0) {
+    uint32_t span = (uint32_t)ids[count - 1] - (uint32_t)ids[0];
+    size_t bitmap_bytes = (size_t)(span >> 3) + 1;
+
+    PostingWriter header = {NULL, 0};
+    put_byte(&header, POSTINGS_BITMAP);
+    put_varint(&header, (uint32_t)count);
+    put_varint(&header, (uint32_t)ids[0]);
+    put_varint(&header, (uint32_t)bitmap_bytes);
+
+    if (header.pos + bitmap_bytes < delta_size) {
+      put_byte(&writer, POSTINGS_BITMAP);
+      put_varint(&writer, (uint32_t)count);
+      put_varint(&writer, (uint32_t)ids[0]);
+      put_varint(&writer, (uint32_t)bitmap_bytes);
+      if (out) {
+        unsigned char *bits = out + writer.pos;
+        memset(bits, 0, bitmap_bytes);
+        for (int i = 0; i < count; i++) {
+          uint32_t bit = (uint32_t)ids[i] - (uint32_t)ids[0];
+          bits[bit >> 3] |= (unsigned char)(1u << (bit & 7));
+        }
+      }
+      return writer.pos + bitmap_bytes;
+    }
+  }
+
+  return encode_delta(ids, count, &writer);
+}
+
+/**
+ * Number of IDs in an encoded list
+ * Time Complexity: O(1)
+ */
+int postings_count(const unsigned char *data) {
+  const unsigned char *in = data + 1;
+  return (int)get_varint(&in);
+}
+
+/**
+ * Decode an encoded list into out, which must hold postings_count IDs
+ * Time Complexity: O(count), O(range / 8) for bitmaps
+ * Returns the number of IDs written
+ */
+int postings_decode(const unsigned char *data, int *out) {
+  const unsigned char *in = data;
+  int kind = *in++;
+  int count = (int)get_varint(&in);
+
+  if (kind == POSTINGS_BITMAP) {
+    uint32_t first = get_varint(&in);
+    uint32_t bytes = get_varint(&in);
+    int written = 0;
+    for (uint32_t i = 0; i < bytes; i++) {
+      unsigned int byte = in[i];
+      for (int bit = 0; byte; bit++, byte >>= 1) {
+        if (byte & 1)
+          out[written++] = (int)(first + i * 8 + bit);
+      }
+    }
+    return written;
+  }
+
+  int blocks = (count + POSTING_BLOCK - 1) / POSTING_BLOCK;
+  if (blocks > 1)
+    in += (size_t)(blocks - 1) * 8;
+
+  uint32_t id = 0;
+  for (int i = 0; i < count; i++) {
+    uint32_t value = get_varint(&in);
+    id = i % POSTING_BLOCK == 0 ? value : id + value;
+    out[i] = (int)id;
+  }
+  return count;
+}
+
+/**
+ * Whether an encoded list holds some ID in [lo, hi)
+ * Time Complexity: O(log blocks + POSTING_BLOCK), O(hi - lo) for bitmaps
+ */
+bool postings_any_in(const unsigned char *data, int lo, int hi) {
+  const unsigned char *in = data;
+  int kind = *in++;
+  int count = (int)get_varint(&in);
+  if (count == 0 || lo >= hi)
+    return false;
+
+  if (kind == POSTINGS_BITMAP) {
+    int first = (int)get_varint(&in);
+    uint32_t bytes = get_varint(&in);
+    int64_t from = lo > first ? (int64_t)lo - first : 0;
+    int64_t to = (int64_t)hi - first;
+    if (to > (int64_t)bytes * 8)
+      to = (int64_t)bytes * 8;
+    for (int64_t bit = from; bit < to; bit++) {
+      if (in[bit >> 3] & (1u << (bit & 7)))
+        return true;
+    }
+    return false;
+  }
+
+  int blocks = (count + POSTING_BLOCK - 1) / POSTING_BLOCK;
+  const unsigned char *table = in;
+  const unsigned char *start = table + (size_t)(blocks - 1) * 8;
+  int block = skip_to_block(table, blocks, lo);
+  if (block > 0)
+    in = start + get_uint32(table + (size_t)(block - 1) * 8 + 4);
+  else
+    in = start;
+
+  // The block holding lo's successor is this one or, if lo is past all of
+  // its IDs, the first ID of the next
+  int end = count - block * POSTING_BLOCK;
+  if (end > 2 * POSTING_BLOCK)
+    end = 2 * POSTING_BLOCK;
+  uint32_t id = 0;
+  for (int i = 0; i < end; i++) {
+    uint32_t value = get_varint(&in);
+    id = i % POSTING_BLOCK == 0 ? value : id + value;
+    if ((int)id >= lo)
+      return (int)id < hi;
+  }
+  return false;
+}
+
+/**
+ * Whether an encoded list holds id
+ */
+bool postings_contains(const unsigned char *data, int id) {
+  return id < 0x7FFFFFFF ? postings_any_in(data, id, id + 1) : false;
+}
+
+// ============================================================================
+// HELPER FUNCTIONS
+// ============================================================================
+
+static void put_byte(PostingWriter *writer, unsigned char byte) {
+  if (writer->out)
+    writer->out[writer->pos] = byte;
+  writer->pos++;
+}
+
+/**
+ * LEB128: seven bits per byte, low bits first, high bit set on all but the
+ * last byte
+ */
+static void put_varint(PostingWriter *writer, uint32_t value) {
+  while (value >= 0x80) {
+    put_byte(writer, (unsigned char)(value | 0x80));
+    value >>= 7;
+  }
+  put_byte(writer, (unsigned char)value);
+}
+
+static void put_uint32(PostingWriter *writer, size_t at, uint32_t value) {
+  if (writer->out)
+    memcpy(writer->out + at, &value, sizeof(value));
+}
+
+static uint32_t get_varint(const unsigned char **in) {
+  const unsigned char *p = *in;
+  uint32_t value = *p & 0x7F;
+  int shift = 7;
+  while (*p++ & 0x80) {
+    value |= (uint32_t)(*p & 0x7F) << shift;
+    shift += 7;
+  }
+  *in = p;
+  return value;
+}
+
+static uint32_t get_uint32(const unsigned char *in) {
+  uint32_t value;
+  memcpy(&value, in, sizeof(value));
+  return value;
+}
+
+/**
+ * Write the delta layout; returns its size
+ */
+static size_t encode_delta(const int *ids, int count, PostingWriter *writer) {
+  put_byte(writer, POSTINGS_DELTA);
+  put_varint(writer, (uint32_t)count);
+
+  int blocks = (count + POSTING_BLOCK - 1) / POSTING_BLOCK;
+  size_t table = writer->pos;
+  size_t start = table + (blocks > 1 ? (size_t)(blocks - 1) * 8 : 0);
+  writer->pos = start;
+
+  for (int i = 0; i < count; i++) {
+    if (i % POSTING_BLOCK == 0) {
+      int block = i / POSTING_BLOCK;
+      if (block > 0) {
+        size_t entry = table + (size_t)(block - 1) * 8;
+        put_uint32(writer, entry, (uint32_t)ids[i]);
+        put_uint32(writer, entry + 4, (uint32_t)(writer->pos - start));
+      }
+      put_varint(writer, (uint32_t)ids[i]);
+    } else {
+      put_varint(writer, (uint32_t)ids[i] - (uint32_t)ids[i - 1]);
+    }
+  }
+  return writer->pos;
+}
+
+/**
+ * Last block whose first ID is at most id (0 if none)
+ */
+static int skip_to_block(const unsigned char *table, int blocks, int id) {
+  int lo = 0, hi = blocks - 1; // Entry e describes block e + 1
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if ((int)get_uint32(table + (size_t)mid * 8) <= id)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
@@ -7,6 +7,8 @@
 
 #include "music_queue_core.h"
 
+static void free_node(Queue* queue, QueueNode* node);
+
 /**
  * Create a new queue
  * Time Complexity: O(1)
@@ -18,6 +20,7 @@ Queue* queue_create() {
     queue->front = NULL;
     queue->rear = NULL;
     queue->size = 0;
+    queue->pool = NULL;
     
     return queue;
 }
@@ -29,7 +32,8 @@ Queue* queue_create() {
 bool queue_enqueue(Queue* queue, int song_id) {
     if (!queue) return false;
     
-    QueueNode* new_node = (QueueNode*)malloc(sizeof(QueueNode));
+    QueueNode* new_node = queue->pool ? (QueueNode*)pool_alloc(queue->pool)
+                                      : (QueueNode*)malloc(sizeof(QueueNode));
     if (!new_node) return false;
     
     new_node->song_id = song_id;
@@ -65,7 +69,7 @@ int queue_dequeue(Queue* queue) {
         queue->rear = NULL;
     }
     
-    free(temp);
+    free_node(queue, temp);
     queue->size--;
     
     return song_id;
@@ -107,7 +111,7 @@ void queue_clear(Queue* queue) {
     while (queue->front) {
         QueueNode* temp = queue->front;
         queue->front = queue->front->next;
-        free(temp);
+        free_node(queue, temp);
     }
     
     queue->rear = NULL;
@@ -121,6 +125,15 @@ void queue_clear(Queue* queue) {
 void queue_destroy(Queue* queue) {
     if (!queue) return;
     
-    queue_clear(queue);
+    // Pooled nodes are released with their slabs by the pool owner
+    if (!queue->pool) queue_clear(queue);
     free(queue);
 }
+
+/**
+ * Release a node to the pool, or to the system allocator
+ */
+static void free_node(Queue* queue, QueueNode* node) {
+    if (queue->pool) pool_free(queue->pool, node);
+    else free(node);
+}
@@ -1,41 +1,49 @@
 /**
  * Stack Implementation
- * 
+ *
  * Used for undo/redo functionality
  * Stores operation history for reversible actions
+ *
+ * Backed by a fixed-capacity ring buffer: once full, each push overwrites
+ * the oldest entry, so history memory is bounded by the capacity and
+ * push/pop never allocate.
  */
 
 #include "music_queue_core.h"
 
 /**
- * Create a new stack
+ * Create a new stack holding at most capacity operations
  * Time Complexity: O(1)
  */
-Stack* stack_create() {
+Stack* stack_create(int capacity) {
+    if (capacity <= 0) return NULL;
+
     Stack* stack = (Stack*)malloc(sizeof(Stack));
     if (!stack) return NULL;
-    
-    stack->top = NULL;
+
+    stack->ops = (Operation*)malloc(sizeof(Operation) * capacity);
+    if (!stack->ops) {
+        free(stack);
+        return NULL;
+    }
+    stack->capacity = capacity;
+    stack->top = 0;
     stack->size = 0;
-    
+
     return stack;
 }
 
 /**
- * Push an operation onto the stack
+ * Push an operation onto the stack, dropping the oldest if full
  * Time Complexity: O(1)
  */
 bool stack_push(Stack* stack, Operation op) {
     if (!stack) return false;
-    
-    StackNode* new_node = (StackNode*)malloc(sizeof(StackNode));
-    if (!new_node) return false;
-    
-    new_node->op = op;
-    new_node->next = stack->top;
-    stack->top = new_node;
-    stack->size++;
-    
+
+    stack->ops[stack->top] = op;
+    stack->top = (stack->top + 1) % stack->capacity;
+    if (stack->size < stack->capacity) stack->size++;
+
     return true;
 }
 
@@ -44,18 +52,14 @@ bool stack_push(Stack* stack, Operation op) {
  * Time Complexity: O(1)
  */
 Operation stack_pop(Stack* stack) {
-    Operation invalid = {OP_ADD, -1, -1, -1.0f};
-    
-    if (!stack || !stack->top) return invalid;
-    
-    StackNode* temp = stack->top;
-    Operation op = temp->op;
-    
-    stack->top = stack->top->next;
-    free(temp);
+    Operation invalid = {OP_ADD, -1, -1, -1.0f, -1, -1.0f, false, -1, -1};
+
+    if (!stack || stack->size == 0) return invalid;
+
+    stack->top = (stack->top + stack->capacity - 1) % stack->capacity;
     stack->size--;
-    
-    return op;
+
+    return stack->ops[stack->top];
 }
 
 /**
@@ -63,11 +67,25 @@ Operation stack_pop(Stack* stack) {
  * Time Complexity: O(1)
  */
 Operation stack_peek(Stack* stack) {
-    Operation invalid = {OP_ADD, -1, -1, -1.0f};
-    
-    if (!stack || !stack->top) return invalid;
-    
-    return stack->top->op;
+    Operation invalid = {OP_ADD, -1, -1, -1.0f, -1, -1.0f, false, -1, -1};
+
+    if (!stack || stack->size == 0) return invalid;
+
+    return stack->ops[(stack->top + stack->capacity - 1) % stack->capacity];
+}
+
+/**
+ * Peek at the operation depth entries below the top (0 is the top)
+ * Time Complexity: O(1)
+ */
+Operation stack_peek_at(Stack* stack, int depth) {
+    Operation invalid = {OP_ADD, -1, -1, -1.0f, -1, -1.0f, false, -1, -1};
+
+    if (!stack || depth < 0 || depth >= stack->size) return invalid;
+
+    int slot = stack->top - 1 - depth;
+    if (slot < 0) slot += stack->capacity;
+    return stack->ops[slot];
 }
 
 /**
@@ -75,7 +93,7 @@ Operation stack_peek(Stack* stack) {
  * Time Complexity: O(1)
  */
 bool stack_is_empty(Stack* stack) {
-    return !stack || stack->top == NULL;
+    return !stack || stack->size == 0;
 }
 
 /**
@@ -86,29 +104,51 @@ int stack_get_size(Stack* stack) {
     return stack ? stack->size : 0;
 }
 
+/**
+ * Change the capacity, keeping the newest operations that still fit
+ * Time Complexity: O(capacity)
+ */
+bool stack_set_capacity(Stack* stack, int capacity) {
+    if (!stack || capacity <= 0) return false;
+
+    Operation* ops = (Operation*)malloc(sizeof(Operation) * capacity);
+    if (!ops) return false;
+
+    // Copy oldest kept to newest so the ring starts at slot 0
+    int kept = stack->size < capacity ? stack->size : capacity;
+    int from = (stack->top + stack->capacity - kept) % stack->capacity;
+    for (int i = 0; i < kept; i++) {
+        ops[i] = stack->ops[from];
+        from = (from + 1) % stack->capacity;
+    }
+
+    free(stack->ops);
+    stack->ops = ops;
+    stack->capacity = capacity;
+    stack->size = kept;
+    stack->top = kept % capacity;
+
+    return true;
+}
+
 /**
  * Clear all operations from stack
- * Time Complexity: O(n)
+ * Time Complexity: O(1)
  */
 void stack_clear(Stack* stack) {
     if (!stack) return;
-    
-    while (stack->top) {
-        StackNode* temp = stack->top;
-        stack->top = stack->top->next;
-        free(temp);
-    }
-    
+
+    stack->top = 0;
     stack->size = 0;
 }
 
 /**
  * Destroy stack and free memory
- * Time Complexity: O(n)
+ * Time Complexity: O(1)
  */
 void stack_destroy(Stack* stack) {
     if (!stack) return;
-    
-    stack_clear(stack);
+
+    free(stack->ops);
     free(stack);
 }
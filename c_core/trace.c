@@ -0,0 +1,145 @@
+/**
+ * Tracing Implementation
+ *
+ * Per-thread single-producer/single-consumer rings of TraceRecord
+ * Each thread registers its ring once on a global lock-free list; the
+ * producer only ever touches its own ring, so recording takes no locks and
+ * makes no syscalls beyond reading the monotonic clock
+ */
+
+#include "trace.h"
+
+#ifdef MQ_ENABLE_TRACE
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef struct TraceRing {
+  TraceRecord records[TRACE_RING_CAPACITY];
+  _Atomic uint64_t head; // Next slot the owning thread writes
+  _Atomic uint64_t tail; // Next slot the reader drains
+  uint32_t thread_id;
+  struct TraceRing *next; // Registration list, never unlinked
+} TraceRing;
+
+static _Atomic(TraceRing *) rings = NULL;
+static _Atomic uint32_t next_thread_id = 0;
+static _Atomic long dropped = 0;
+static _Thread_local TraceRing *local_ring = NULL;
+
+// Helper function prototypes
+static TraceRing *trace_register_thread();
+
+bool trace_enabled() { return true; }
+
+/**
+ * Append a record to the calling thread's ring
+ * Time Complexity: O(1), wait-free
+ */
+void trace_record(TraceEvent event, int arg0, int arg1) {
+  TraceRing *ring = local_ring ? local_ring : trace_register_thread();
+  if (!ring)
+    return;
+
+  uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  if (head - tail >= TRACE_RING_CAPACITY) {
+    atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+    return;
+  }
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  TraceRecord *record = &ring->records[head & (TRACE_RING_CAPACITY - 1)];
+  record->timestamp_ns = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+  record->thread_id = ring->thread_id;
+  record->event = (uint16_t)event;
+  record->reserved = 0;
+  record->arg0 = arg0;
+  record->arg1 = arg1;
+
+  // Publish the record to the reader
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/**
+ * Move up to cap pending records from all threads into out
+ * Only one thread may drain at a time. Records are in order per thread;
+ * sort by timestamp_ns for a global order.
+ * Returns the number of records written
+ */
+int trace_drain(TraceRecord *out, int cap) {
+  if (!out || cap <= 0)
+    return 0;
+
+  int count = 0;
+  for (TraceRing *ring = atomic_load_explicit(&rings, memory_order_acquire);
+       ring && count < cap; ring = ring->next) {
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    while (tail < head && count < cap) {
+      out[count++] = ring->records[tail & (TRACE_RING_CAPACITY - 1)];
+      tail++;
+    }
+
+    // Hand the slots back to the producer
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+  }
+
+  return count;
+}
+
+/**
+ * Number of records discarded because a ring was full
+ */
+long trace_dropped_count() {
+  return atomic_load_explicit(&dropped, memory_order_relaxed);
+}
+
+// ============================================================================
+// HELPER FUNCTIONS
+// ============================================================================
+
+/**
+ * Allocate this thread's ring and push it onto the registration list
+ * Rings outlive their threads so late records can still be drained
+ */
+static TraceRing *trace_register_thread() {
+  TraceRing *ring = (TraceRing *)calloc(1, sizeof(TraceRing));
+  if (!ring)
+    return NULL;
+
+  ring->thread_id = atomic_fetch_add(&next_thread_id, 1);
+
+  TraceRing *first = atomic_load_explicit(&rings, memory_order_relaxed);
+  do {
+    ring->next = first;
+  } while (!atomic_compare_exchange_weak_explicit(
+      &rings, &first, ring, memory_order_release, memory_order_relaxed));
+
+  local_ring = ring;
+  return ring;
+}
+
+#else
+
+bool trace_enabled() { return false; }
+
+void trace_record(TraceEvent event, int arg0, int arg1) {
+  (void)event;
+  (void)arg0;
+  (void)arg1;
+}
+
+int trace_drain(TraceRecord *out, int cap) {
+  (void)out;
+  (void)cap;
+  return 0;
+}
+
+long trace_dropped_count() { return 0; }
+
+#endif // MQ_ENABLE_TRACE
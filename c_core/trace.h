@@ -0,0 +1,62 @@
+/**
+ * Music Queue Core - Tracing
+ *
+ * Queue hot paths record events through TRACE(), which compiles to nothing
+ * unless the library is built with -DMQ_ENABLE_TRACE (make trace).
+ *
+ * When enabled, each thread appends fixed-size binary records to its own
+ * lock-free ring buffer; a single out-of-band reader collects them with
+ * trace_drain(). A full ring drops new records rather than blocking.
+ */
+
+#ifndef MUSIC_QUEUE_TRACE_H
+#define MUSIC_QUEUE_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+  TRACE_DLL_INSERT,
+  TRACE_DLL_REMOVE,
+  TRACE_DLL_MOVE_UP,
+  TRACE_DLL_MOVE_DOWN,
+  TRACE_DLL_MOVE_TO,
+  TRACE_DLL_ROTATE,
+  TRACE_SKIP_NEXT,
+  TRACE_SKIP_PREV
+} TraceEvent;
+
+/**
+ * One trace record - 24 bytes, no pointers
+ */
+typedef struct {
+  uint64_t timestamp_ns; // CLOCK_MONOTONIC
+  uint32_t thread_id;    // Order in which the thread first traced
+  uint16_t event;        // TraceEvent
+  uint16_t reserved;
+  int32_t arg0;
+  int32_t arg1;
+} TraceRecord;
+
+// Records per thread ring; must be a power of two
+#define TRACE_RING_CAPACITY 4096
+
+// Trace Functions (always exported; inert when tracing is compiled out)
+bool trace_enabled();
+void trace_record(TraceEvent event, int arg0, int arg1);
+int trace_drain(TraceRecord *out, int cap);
+long trace_dropped_count();
+
+#ifdef MQ_ENABLE_TRACE
+#define TRACE(event, arg0, arg1) trace_record((event), (arg0), (arg1))
+#else
+// sizeof keeps the arguments "used" without evaluating them
+#define TRACE(event, arg0, arg1)                                               \
+  do {                                                                         \
+    (void)sizeof(event);                                                       \
+    (void)sizeof(arg0);                                                        \
+    (void)sizeof(arg1);                                                        \
+  } while (0)
+#endif
+
+#endif // MUSIC_QUEUE_TRACE_H
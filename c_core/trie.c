@@ -2,148 +2,3169 @@
  * Trie Implementation
  *
  * Provides prefix-based search for songs and artists
- * Case-insensitive support
+ * Keys are UTF-8, folded once at insert time: lowercased, with accents
+ * stripped from Latin and Greek letters ("Beyoncé" -> "beyonce"). Queries go
+ * through the same folding in stack buffers, so lookups never allocate.
+ *
+ * Text is indexed word by word: each word is a key whose node holds a
+ * sorted posting list of the songs containing it. A query matches songs that
+ * have, for every query term, some word starting with that term.
+ *
+ * Radix trie: chains of single-child nodes are merged into one node with a
+ * multi-character label, and children live in a small array sorted by the
+ * first byte of their label. Labels are carved from an append-only arena,
+ * so splitting a node only re-points into the existing label.
+ *
+ * Every node with more than TRIE_TOP_K postings below it caches the
+ * TRIE_TOP_K best songs of its subtree, ranked by the recommendation heap,
+ * so autocomplete costs O(|prefix| + k). Smaller subtrees, most of the
+ * nodes, keep no cache and are ranked when asked, at no more than
+ * TRIE_TOP_K postings each. Priority changes are pushed up from the nodes
+ * holding the song.
+ *
+ * Typo-tolerant search walks the trie with one Levenshtein DP row per
+ * character of the path, abandoning a subtree as soon as no extension of it
+ * can come within the edit budget.
+ *
+ * trie_save writes the index as a flat, pointer-free image that trie_load
+ * maps read-only. The mapped image is the base index; songs indexed after
+ * loading go to the in-memory trie, and queries combine the two. Each song
+ * lives wholly in one of them, so their results can simply be unioned.
+ *
+ * Removal prunes nodes left without songs and re-merges single-child chains,
+ * so the in-memory trie always matches a fresh build. The image cannot
+ * change; songs removed from it are listed and filtered out of its results
+ * until the next trie_save. Its caches hold the ranks at save time, so a
+ * song whose priority has moved since is re-indexed in memory instead.
  */
 
 #include "music_queue_core.h"
-#include <ctype.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <process.h>
+#include <windows.h>
+#define getpid _getpid
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define TRIE_LABEL_CHUNK_SIZE 4096
+
+// A query term is checked per candidate (via its terminal links) instead of
+// merged when its subtree holds this many times more postings than candidates
+#define TRIE_PROBE_RATIO 16
+
+// Longest folded form of one character, in UTF-8 bytes
+#define TRIE_FOLD_MAX 4
+
+// fuzzy_row outcomes
+#define FUZZY_CONTINUE 0
+#define FUZZY_MATCH 1
+#define FUZZY_PRUNE 2
+
+#define TRIE_IMAGE_MAGIC "MQTI"
+#define TRIE_IMAGE_VERSION 4
+#define TRIE_IMAGE_BYTE_ORDER 0x01020304u
 
 /**
- * Create a new Trie node
+ * Image file header
+ * The sections follow at 8-byte aligned offsets from the start of the file;
+ * all references are indices or offsets. Nodes are stored in preorder, so a
+ * subtree is a contiguous run of nodes and of posting lists. Each node's
+ * children are a run of child slots, sorted by first label byte. Posting
+ * lists and per-song node lists are stored compressed (see posting_list.c).
+ * Only nodes with more than TRIE_TOP_K postings below them store a top-K
+ * list; a smaller subtree is ranked from its postings when queried.
  */
-TrieNode *trie_create_node() {
-  TrieNode *node = (TrieNode *)malloc(sizeof(TrieNode));
-  if (!node)
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t byte_order; // TRIE_IMAGE_BYTE_ORDER as written
+  uint32_t top_k;      // Completions stored per node (TRIE_TOP_K)
+  uint32_t node_count;
+  uint32_t song_count;
+  uint64_t label_bytes;
+  uint64_t posting_total;
+  uint64_t posting_bytes;
+  uint64_t song_node_bytes;
+  uint64_t top_node_count; // Nodes with a stored top-K list
+  uint64_t file_size;
+  uint64_t nodes;      // TrieImageNode[node_count + 1], the last a sentinel
+  uint64_t keys;       // First label byte per child slot (node_count - 1)
+  uint64_t children;   // uint32 node index per child slot
+  uint64_t labels;     // Label bytes
+  uint64_t postings;   // Encoded song ID list per node, in node order
+  uint64_t top_nodes;  // uint32 node index per stored list, ascending
+  uint64_t tops;       // int32[top_node_count][top_k], best first
+  uint64_t songs;      // int32 indexed song IDs, ascending
+  uint64_t song_ranks; // float[song_count], each song's priority when saved
+  uint64_t song_spans; // uint32[song_count + 1] byte offsets into song_nodes
+  uint64_t song_nodes; // Encoded list of the nodes holding each song
+} TrieImageHeader;
+
+/**
+ * Labels, posting lists and child slots are laid out in node order, so each
+ * run ends where the next node's begins; lengths and counts are differences
+ * with the following record (see image_label_len and friends).
+ */
+typedef struct {
+  uint32_t label;        // Offset into labels
+  uint32_t postings;     // Byte offset into postings; the song ID if only one
+  uint32_t posting_rank; // Postings held by the nodes before this one
+  uint32_t subtree_end;  // Index one past the last node of the subtree
+  uint32_t first_child;  // Child slot of the first child
+} TrieImageNode;
+
+/**
+ * A mapped image and its sections
+ */
+struct TrieImage {
+  const unsigned char *data;
+  size_t size;
+  const TrieImageNode *nodes;
+  const unsigned char *keys;
+  const uint32_t *children;
+  const char *labels;
+  const unsigned char *postings;
+  const uint32_t *top_nodes;
+  const int *tops;
+  const int *songs;
+  const float *song_ranks;
+  const uint32_t *song_spans;
+  const unsigned char *song_nodes;
+  uint32_t node_count;
+  uint32_t song_count;
+  uint32_t top_node_count;
+};
+
+/**
+ * Query words, folded once and matched against both the image and the
+ * in-memory trie
+ */
+typedef struct {
+  char words[TRIE_MAX_TERMS][TRIE_MAX_WORD];
+  int lens[TRIE_MAX_TERMS];
+  int count;
+} QueryTerms;
+
+/**
+ * One query term being matched by trie_search_fuzzy
+ */
+typedef struct {
+  uint32_t term[TRIE_MAX_WORD]; // Folded code points
+  int term_len;
+  int max_edits;
+  int **buffer; // Postings of every matched subtree
+  int *capacity;
+  int count;
+  bool sorted;
+  bool failed;
+} FuzzyTerm;
+
+/**
+ * Label arena chunk; labels are never freed individually
+ */
+struct TrieLabelChunk {
+  struct TrieLabelChunk *next;
+  int capacity;
+  int used;
+  char data[];
+};
+
+// Helper function prototypes
+static TrieNode *trie_create_node(Trie *trie, TrieNode *parent);
+static void trie_destroy_node(Trie *trie, TrieNode *node);
+static bool trie_insert_key(Trie *trie, const char *key, int len,
+                            int song_id);
+static bool trie_remove_key(Trie *trie, const char *key, int len,
+                            int song_id);
+static void trie_remove_at(Trie *trie, TrieNode *node, int song_id);
+static void trie_prune(Trie *trie, TrieNode *node);
+static void trie_merge_child(Trie *trie, TrieNode *node);
+static void node_free(Trie *trie, TrieNode *node);
+static TrieNode *trie_find_node(Trie *trie, const char *key, int len,
+                                bool *exact);
+static uint32_t utf8_next(const char *text, int *pos);
+static int utf8_encode(uint32_t cp, char *out);
+static int fold_char(uint32_t cp, char *out);
+static bool is_ideograph(uint32_t cp);
+static int fold_key(const char *key, char *out);
+static int next_word(const char *text, int *pos, char *word);
+static int query_terms(const char *query, QueryTerms *terms);
+static int words_live(Trie *trie, const QueryTerms *terms);
+static int words_image(Trie *trie, const QueryTerms *terms);
+static int fuzzy_terms(Trie *trie, const QueryTerms *terms, int max_edits,
+                       bool image, int **buffer, int *capacity);
+static int emit_union(const int *a, int a_count, const int *b, int b_count,
+                      int *out_ids, int cap);
+static int rank_candidates(HeapNode *items, int size, int k, int *out_ids);
+static bool posting_add(TrieNode *node, int song_id);
+static bool posting_remove(TrieNode *node, int song_id);
+static void terminal_unlink(Trie *trie, int song_id, TrieNode *node);
+static int *ensure_buffer(int **buffer, int *capacity, int needed);
+static int collect_postings(TrieNode *node, int **buffer, int *capacity);
+static void gather_postings(TrieNode *node, int *out, int *count,
+                            bool *sorted);
+static int compare_ints(const void *a, const void *b);
+static int sort_unique(int *ids, int count);
+static int lower_bound(const int *ids, int count, int id);
+static int intersect_sorted(int *ids, int count, const int *other,
+                            int other_count);
+static int fuzzy_collect(Trie *trie, bool image, const char *word, int len,
+                         int max_edits, int **buffer, int *capacity);
+static void fuzzy_walk(FuzzyTerm *fuzzy, TrieNode *node, const int *row,
+                       uint32_t cp, int pending);
+static void fuzzy_walk_image(FuzzyTerm *fuzzy, const TrieImage *image,
+                             uint32_t index, const int *row, uint32_t cp,
+                             int pending);
+static bool fuzzy_take(FuzzyTerm *fuzzy, int needed);
+static int fuzzy_row(FuzzyTerm *fuzzy, const int *prev, int *next,
+                     uint32_t cp);
+static bool song_under(Trie *trie, int song_id, TrieNode *ancestor);
+static char *label_alloc(Trie *trie, int len);
+static int child_find(TrieNode *node, char c);
+static bool child_insert(TrieNode *node, TrieNode *child);
+static void child_remove(TrieNode *node, int index);
+static TrieNode *trie_add_leaf(Trie *trie, TrieNode *parent, const char *key,
+                               int len);
+static TrieNode *trie_split(Trie *trie, TrieNode *parent, TrieNode *child,
+                            int at);
+static void trie_stats_node(TrieNode *node, TrieStats *stats);
+static float trie_priority(Trie *trie, int song_id);
+static bool ranks_above(int a_id, float a_priority, int b_id,
+                        float b_priority);
+static void rank_move(HeapNode *top, int count, int from, int song_id,
+                      float priority);
+static void rank_offer(HeapNode *top, int *count, int song_id,
+                       float priority);
+static bool rank_cache(TrieNode *node);
+static void rank_drop(TrieNode *node);
+static void rank_gather(Trie *trie, TrieNode *node, HeapNode *top, int *count);
+static const HeapNode *rank_list(Trie *trie, TrieNode *node, HeapNode *scratch,
+                                 int *count);
+static void rank_path(Trie *trie, TrieNode *node, int song_id,
+                      float priority);
+static bool rank_step(Trie *trie, TrieNode *node, int song_id,
+                      float priority);
+static void rank_rebuild(Trie *trie, TrieNode *node, int song_id,
+                         float priority);
+static void rank_rebuild_subtree(Trie *trie, TrieNode *node);
+static void rank_forget(Trie *trie, TrieNode *node, int song_id);
+static int compare_ranked(const void *a, const void *b);
+static bool collect_ids(Trie *trie, TrieNode *node, HeapNode **items,
+                        int *count, int *capacity);
+static bool push_ranked(HeapNode **items, int *count, int *capacity,
+                        int song_id, float priority);
+static bool copy_live_keys(TrieNode *node, char *key, int len, Trie *dest);
+static bool copy_image_keys(Trie *trie, uint32_t index, char *key, int len,
+                            Trie *dest);
+static bool image_write(Trie *trie, const char *path);
+static TrieImage *image_open(const unsigned char *data, size_t size);
+static void image_close(TrieImage *image);
+static void image_order(TrieNode *node, TrieNode **order, int *ends,
+                        int *count);
+static int image_song_index(const TrieImage *image, int song_id);
+static bool image_song_under(const TrieImage *image, int song_id,
+                             uint32_t index);
+static bool image_holds(const TrieImage *image, uint32_t index, int song_id);
+static int image_key_of(const TrieImage *image, uint32_t index, char *key);
+static bool image_materialize(Trie *trie, int song_id);
+static bool image_rerank(Trie *trie);
+static bool image_top_candidates(Trie *trie, uint32_t index, HeapNode **items,
+                                 int *count, int *capacity);
+static bool is_removed(Trie *trie, int song_id);
+static bool tombstone(Trie *trie, int song_id);
+static int drop_removed(Trie *trie, int *ids, int count);
+static int image_find_node(const TrieImage *image, const char *key, int len,
+                           bool *exact);
+static int image_child_find(const TrieImage *image, const TrieImageNode *node,
+                            unsigned char key);
+static int image_collect_postings(const TrieImage *image, uint32_t index,
+                                  int **buffer, int *capacity);
+static void image_gather_postings(const TrieImage *image, uint32_t index,
+                                  int *out, int *count, bool *sorted);
+static bool image_collect_ids(Trie *trie, uint32_t index, HeapNode **items,
+                              int *count, int *capacity);
+static int image_postings(Trie *trie, uint32_t index);
+static uint32_t image_label_len(const TrieImageNode *node);
+static uint32_t image_posting_count(const TrieImageNode *node);
+static uint32_t image_child_count(const TrieImageNode *node);
+static uint32_t image_subtree_postings(const TrieImage *image, uint32_t index);
+static const int *image_top(const TrieImage *image, uint32_t index,
+                            int *count);
+static int image_decode(const TrieImage *image, const TrieImageNode *node,
+                        int *out);
+static size_t encoded_size(const TrieNode *node);
+static bool pad_to(FILE *out, uint64_t offset);
+static const unsigned char *map_file(const char *path, size_t *size);
+static void unmap_file(const unsigned char *data, size_t size);
+
+/**
+ * Initialize a new Trie
+ */
+Trie *trie_create() { return trie_create_pooled(NULL, NULL); }
+
+/**
+ * Initialize a new Trie whose nodes come from the given pools
+ * Either pool may be NULL to use malloc for that node type
+ */
+Trie *trie_create_pooled(NodePool *node_pool, NodePool *id_pool) {
+  Trie *trie = (Trie *)malloc(sizeof(Trie));
+  if (!trie)
     return NULL;
 
-  node->isEnd = false;
-  node->song_ids = NULL;
-  for (int i = 0; i < 26; i++) {
-    node->children[i] = NULL;
+  trie->node_pool = node_pool;
+  trie->id_pool = id_pool;
+  trie->ranking = NULL;
+  trie->labels = NULL;
+  trie->matches = NULL;
+  trie->match_capacity = 0;
+  trie->term_matches = NULL;
+  trie->term_capacity = 0;
+  trie->image = NULL;
+  trie->image_matches = NULL;
+  trie->image_capacity = 0;
+  trie->removed = NULL;
+  trie->removed_count = 0;
+  trie->removed_capacity = 0;
+  trie->terminals = hashmap_create(16);
+  trie->root = trie_create_node(trie, NULL);
+  if (!trie->terminals || !trie->root) {
+    trie_destroy(trie);
+    return NULL;
   }
 
-  return node;
+  return trie;
 }
 
 /**
- * Initialize a new Trie
+ * Insert a key into the Trie
+ * The key is folded as a whole; characters that separate words are skipped
  */
-TrieNode *trie_create() { return trie_create_node(); }
+void trie_insert(Trie *trie, const char *key, int song_id) {
+  if (!trie || !key)
+    return;
+
+  char folded[TRIE_MAX_WORD];
+  trie_insert_key(trie, folded, fold_key(key, folded), song_id);
+}
 
 /**
- * Insert a key into the Trie
- * Maps to lowercase and only allows a-z
+ * Index every word of text under song_id
+ * Words are runs of letters, digits and marks of any script; apostrophes are
+ * dropped ("Don't" -> "dont") and punctuation, symbols and spaces separate
+ * words. Han and kana characters are each a word of their own, since text in
+ * those scripts is not spaced.
  */
-void trie_insert(TrieNode *root, const char *key, int song_id) {
-  if (!root || !key)
+void trie_index_text(Trie *trie, const char *text, int song_id) {
+  if (!trie || !text)
     return;
 
-  TrieNode *current = root;
-  for (int i = 0; key[i] != '\0'; i++) {
-    char c = tolower(key[i]);
-    if (c < 'a' || c > 'z')
-      continue; // Skip non-alphabetic characters
+  char word[TRIE_MAX_WORD];
+  int pos = 0;
+  int len;
+  while ((len = next_word(text, &pos, word)) > 0)
+    trie_insert_key(trie, word, len, song_id);
+}
 
-    int index = c - 'a';
-    if (!current->children[index]) {
-      current->children[index] = trie_create_node();
-    }
-    current = current->children[index];
+/**
+ * Remove one key of song_id, the reverse of trie_insert
+ * Nodes left without songs are pruned and single-child chains re-merged, so
+ * the trie stays as if the key had never been inserted. A song in the mapped
+ * base is first copied into memory with its other keys, then dropped from
+ * the base.
+ * Time Complexity: O(|key| + depth * TRIE_TOP_K) for in-memory songs
+ * Returns false if song_id was not indexed under key
+ */
+bool trie_remove(Trie *trie, const char *key, int song_id) {
+  if (!trie || !key)
+    return false;
+
+  char folded[TRIE_MAX_WORD];
+  int len = fold_key(key, folded);
+
+  if (trie->image && !is_removed(trie, song_id)) {
+    bool exact;
+    int index = image_find_node(trie->image, folded, len, &exact);
+    if (index >= 0 && exact && image_holds(trie->image, index, song_id) &&
+        !image_materialize(trie, song_id))
+      return false;
   }
 
-  current->isEnd = true;
+  return trie_remove_key(trie, folded, len, song_id);
+}
+
+/**
+ * Remove every key of song_id, in memory and in the mapped base
+ * Use before re-indexing a song whose text changed.
+ * Time Complexity: O(keys of the song * depth * TRIE_TOP_K)
+ * Returns false if song_id was not indexed
+ */
+bool trie_remove_song(Trie *trie, int song_id) {
+  if (!trie)
+    return false;
 
-  // Add song_id to the list in this node
-  SongIdNode *new_id = (SongIdNode *)malloc(sizeof(SongIdNode));
-  if (new_id) {
-    new_id->song_id = song_id;
-    new_id->next = current->song_ids;
-    current->song_ids = new_id;
+  bool removed = false;
+  SongIdNode *link;
+  while ((link = (SongIdNode *)hashmap_get(trie->terminals, song_id))) {
+    trie_remove_at(trie, link->node, song_id);
+    removed = true;
   }
+
+  if (trie->image && !is_removed(trie, song_id) &&
+      image_song_index(trie->image, song_id) >= 0)
+    removed = tombstone(trie, song_id) || removed;
+  return removed;
 }
 
 /**
- * Search for a prefix in the Trie
- * Returns the SongIdNode list of the prefix node
+ * Copy the songs indexed under exactly this key into out_ids, ascending
+ * Writes at most cap IDs and returns the total number of matches
  */
-SongIdNode *trie_search_prefix(TrieNode *root, const char *prefix) {
-  if (!root || !prefix)
-    return NULL;
+int trie_search_prefix_into(Trie *trie, const char *prefix, int *out_ids,
+                            int cap) {
+  if (!trie || !prefix)
+    return 0;
 
-  TrieNode *current = root;
-  for (int i = 0; prefix[i] != '\0'; i++) {
-    char c = tolower(prefix[i]);
-    if (c < 'a' || c > 'z')
-      continue;
+  char folded[TRIE_MAX_WORD];
+  int len = fold_key(prefix, folded);
+  bool exact;
+  TrieNode *node = trie_find_node(trie, folded, len, &exact);
+  if (node && !exact)
+    node = NULL;
 
-    int index = c - 'a';
-    if (!current->children[index]) {
-      return NULL;
+  int base_count = 0;
+  if (trie->image) {
+    int index = image_find_node(trie->image, folded, len, &exact);
+    if (index >= 0 && exact) {
+      base_count = image_postings(trie, (uint32_t)index);
+      if (base_count < 0)
+        return 0;
+      base_count = drop_removed(trie, trie->image_matches, base_count);
     }
-    current = current->children[index];
   }
 
-  return current->song_ids;
+  return emit_union(node ? node->postings : NULL, node ? node->posting_count : 0,
+                    trie->image_matches, base_count, out_ids, cap);
 }
 
 /**
- * Collect all song IDs from a node and its children (Helper)
+ * Find songs matching every word of query, each word as a prefix
+ * ("blin lig" matches "Blinding Lights"). Results are ascending song IDs.
+ * Terms are processed rarest first; each further term is merged with the
+ * matches so far as a sorted posting list, or checked per remaining match
+ * when its posting lists are much longer. Only the first TRIE_MAX_TERMS
+ * words of the query are used.
+ * Writes at most cap IDs and returns the total number of matches
  */
-static void collect_ids(TrieNode *node, SongIdNode **results) {
-  if (!node)
+int trie_search_words(Trie *trie, const char *query, int *out_ids, int cap) {
+  if (!trie || !query)
+    return 0;
+
+  QueryTerms terms;
+  if (!query_terms(query, &terms))
+    return 0;
+
+  int count = words_live(trie, &terms);
+  int base = trie->image ? words_image(trie, &terms) : 0;
+  return emit_union(trie->matches, count, trie->image_matches, base, out_ids,
+                    cap);
+}
+
+/**
+ * Like trie_search_words, but each query word may be up to max_edits
+ * insertions, deletions or substitutions away from the start of a word
+ * ("beyonse" matches "Beyoncé"). Edits count folded characters, not bytes.
+ * Short words get fewer edits so they do not match everything: none up to 3
+ * characters, at most one up to 6. max_edits is clamped to
+ * [0, TRIE_MAX_EDITS]. Results are ascending song IDs.
+ * Time Complexity: O(term length) per trie node within reach of the edit
+ * budget, plus the postings of the matched subtrees
+ * Writes at most cap IDs and returns the total number of matches
+ */
+int trie_search_fuzzy(Trie *trie, const char *query, int max_edits,
+                      int *out_ids, int cap) {
+  if (!trie || !query)
+    return 0;
+  if (max_edits < 0)
+    max_edits = 0;
+  if (max_edits > TRIE_MAX_EDITS)
+    max_edits = TRIE_MAX_EDITS;
+
+  QueryTerms terms;
+  if (!query_terms(query, &terms))
+    return 0;
+
+  int count = fuzzy_terms(trie, &terms, max_edits, false, &trie->matches,
+                          &trie->match_capacity);
+  int base = trie->image
+                 ? fuzzy_terms(trie, &terms, max_edits, true,
+                               &trie->image_matches, &trie->image_capacity)
+                 : 0;
+  base = drop_removed(trie, trie->image_matches, base);
+  return emit_union(trie->matches, count, trie->image_matches, base, out_ids,
+                    cap);
+}
+
+/**
+ * Write the k best songs stored anywhere under prefix into out_ids
+ * Ranked by priority, highest first; each song appears once.
+ * Time Complexity: O(|prefix| + k) for k <= TRIE_TOP_K, otherwise a walk of
+ * the prefix subtree
+ * Returns the number of IDs written
+ */
+int trie_top_k(Trie *trie, const char *prefix, int k, int *out_ids) {
+  if (!trie || !prefix || !out_ids || k <= 0)
+    return 0;
+
+  char folded[TRIE_MAX_WORD];
+  int len = fold_key(prefix, folded);
+  TrieNode *node = trie_find_node(trie, folded, len, NULL);
+  int base = trie->image ? image_find_node(trie->image, folded, len, NULL) : -1;
+  if (!node && base < 0)
+    return 0;
+
+  // A cache that is not full already holds the whole subtree, as does a
+  // subtree too small to store one
+  HeapNode scratch[TRIE_TOP_K];
+  int top_count = 0;
+  const HeapNode *top = node ? rank_list(trie, node, scratch, &top_count) : NULL;
+  int image_top_count = 0;
+  if (base >= 0)
+    image_top(trie->image, (uint32_t)base, &image_top_count);
+  bool cached = k <= TRIE_TOP_K ||
+                ((!node || top_count < TRIE_TOP_K) &&
+                 (base < 0 || image_top_count < TRIE_TOP_K));
+
+  if (cached && base < 0) {
+    int count = k < top_count ? k : top_count;
+    for (int i = 0; i < count; i++)
+      out_ids[i] = top[i].song_id;
+    return count;
+  }
+
+  // Image caches were ranked when saved: re-rank them by current priority
+  HeapNode *items = NULL;
+  int size = 0;
+  int capacity = 0;
+  bool ok = true;
+  if (cached) {
+    for (int i = 0; ok && i < top_count; i++)
+      ok = push_ranked(&items, &size, &capacity, top[i].song_id,
+                       top[i].priority);
+    ok = ok &&
+         image_top_candidates(trie, (uint32_t)base, &items, &size, &capacity);
+  } else {
+    ok = (!node || collect_ids(trie, node, &items, &size, &capacity)) &&
+         (base < 0 ||
+          image_collect_ids(trie, (uint32_t)base, &items, &size, &capacity));
+  }
+  if (!ok) {
+    free(items);
+    return 0;
+  }
+
+  int count = rank_candidates(items, size, k, out_ids);
+  free(items);
+  return count;
+}
+
+/**
+ * Rank completions by the priorities in ranking and rebuild every cache
+ */
+void trie_set_ranking(Trie *trie, MaxHeap *ranking) {
+  if (!trie)
+    return;
+  trie->ranking = ranking;
+  trie_refresh_ranking(trie);
+}
+
+/**
+ * Push a song's new priority into the caches above each node holding it
+ * Call after the ranking heap has been updated. The image's caches are
+ * read-only, so a song ranked there is first moved into memory.
+ * Time Complexity: O(depth * TRIE_TOP_K) per node holding the song, plus
+ * a merge of child caches wherever the song falls out of a full cache
+ */
+void trie_update_priority(Trie *trie, int song_id, float priority) {
+  if (!trie)
     return;
 
-  // Add IDs from this node
-  SongIdNode *current_id = node->song_ids;
-  while (current_id) {
-    // Create a copy to avoid pointer issues with Trie destruction
-    SongIdNode *copy = (SongIdNode *)malloc(sizeof(SongIdNode));
-    if (copy) {
-      copy->song_id = current_id->song_id;
-      copy->next = *results;
-      *results = copy;
+  if (trie->image && !is_removed(trie, song_id)) {
+    int at = image_song_index(trie->image, song_id);
+    if (at >= 0 && trie->image->song_ranks[at] != priority) {
+      image_materialize(trie, song_id);
+      return;
     }
-    current_id = current_id->next;
   }
 
-  // Recurse for children
-  for (int i = 0; i < 26; i++) {
-    if (node->children[i]) {
-      collect_ids(node->children[i], results);
+  SongIdNode *link = (SongIdNode *)hashmap_get(trie->terminals, song_id);
+  for (; link; link = link->next)
+    rank_path(trie, link->node, song_id, priority);
+}
+
+/**
+ * Rebuild every cache from the ranking heap
+ * Use after the heap is replaced wholesale (e.g. heap_build_from_array)
+ * Time Complexity: O(nodes * TRIE_TOP_K)
+ */
+void trie_refresh_ranking(Trie *trie) {
+  if (!trie)
+    return;
+  image_rerank(trie);
+  rank_rebuild_subtree(trie, trie->root);
+}
+
+/**
+ * Report node count and memory use
+ * Time Complexity: O(nodes)
+ */
+void trie_get_stats(Trie *trie, TrieStats *stats) {
+  if (!stats)
+    return;
+  memset(stats, 0, sizeof(TrieStats));
+  if (!trie)
+    return;
+
+  trie_stats_node(trie->root, stats);
+  stats->node_bytes += (long)stats->node_count * (long)sizeof(TrieNode);
+  stats->entry_bytes += (long)stats->entry_count * (long)sizeof(SongIdNode);
+  for (TrieLabelChunk *chunk = trie->labels; chunk; chunk = chunk->next)
+    stats->label_bytes += (long)(sizeof(TrieLabelChunk) + chunk->capacity);
+  if (trie->image)
+    stats->image_bytes = (long)trie->image->size;
+}
+
+/**
+ * Write the whole index (mapped base and in-memory songs) to path as a flat
+ * image for trie_load. The file is written next to path and renamed into
+ * place, so readers never see a partial image.
+ * Time Complexity: O(nodes + postings); with a base loaded, the two are
+ * first merged into a temporary trie
+ */
+bool trie_save(Trie *trie, const char *path) {
+  if (!trie || !path)
+    return false;
+  if (!trie->image)
+    return image_write(trie, path);
+
+  Trie *merged = trie_create();
+  if (!merged)
+    return false;
+  merged->ranking = trie->ranking;
+
+  char key[TRIE_MAX_WORD];
+  bool ok = copy_image_keys(trie, 0, key, 0, merged) &&
+            copy_live_keys(trie->root, key, 0, merged) &&
+            image_write(merged, path);
+  trie_destroy(merged);
+  return ok;
+}
+
+/**
+ * Map an image written by trie_save read-only as the base index
+ * Replaces any previously loaded base; in-memory songs are kept. The pages
+ * are shared with every other process mapping the same file, and only the
+ * parts queries touch become resident.
+ * Time Complexity: O(1) - only the header is read
+ * Returns false if the file is missing or not a valid image for this build
+ */
+bool trie_load(Trie *trie, const char *path) {
+  if (!trie || !path)
+    return false;
+
+  size_t size;
+  const unsigned char *data = map_file(path, &size);
+  if (!data)
+    return false;
+
+  TrieImage *image = image_open(data, size);
+  if (!image) {
+    unmap_file(data, size);
+    return false;
+  }
+
+  image_close(trie->image);
+  trie->image = image;
+  trie->removed_count = 0;
+
+  // A song indexed in memory as well is served from memory only
+  if (hashmap_get_size(trie->terminals) > 0) {
+    for (uint32_t i = 0; i < image->song_count; i++) {
+      if (hashmap_get(trie->terminals, image->songs[i]))
+        tombstone(trie, image->songs[i]);
     }
   }
+  return image_rerank(trie);
+}
+
+/**
+ * Drop the mapped base index, keeping in-memory songs
+ */
+void trie_unload(Trie *trie) {
+  if (!trie)
+    return;
+  image_close(trie->image);
+  trie->image = NULL;
+  trie->removed_count = 0;
+}
+
+/**
+ * Whether song_id is indexed, in memory or in the mapped base
+ */
+bool trie_has_song(Trie *trie, int song_id) {
+  if (!trie)
+    return false;
+  if (hashmap_get(trie->terminals, song_id))
+    return true;
+  return trie->image && image_song_index(trie->image, song_id) >= 0 &&
+         !is_removed(trie, song_id);
 }
 
 /**
  * Display results (simplified for current requirements - returns all matching
  * IDs under prefix)
  */
-void trie_display_results(TrieNode *root, const char *prefix) {
+void trie_display_results(Trie *trie, const char *prefix) {
   // In a real implementation, this might print to stdout.
   // For our API, search_prefix is more useful.
+  (void)trie;
   printf("Trie search results for: %s\n", prefix);
 }
 
 /**
  * Destroy the Trie and free memory
  */
-void trie_destroy(TrieNode *root) {
-  if (!root)
+void trie_destroy(Trie *trie) {
+  if (!trie)
     return;
 
-  for (int i = 0; i < 26; i++) {
-    if (root->children[i]) {
-      trie_destroy(root->children[i]);
+  if (trie->root)
+    trie_destroy_node(trie, trie->root);
+
+  TrieLabelChunk *chunk = trie->labels;
+  while (chunk) {
+    TrieLabelChunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+
+  hashmap_destroy(trie->terminals);
+  image_close(trie->image);
+  free(trie->matches);
+  free(trie->term_matches);
+  free(trie->image_matches);
+  free(trie->removed);
+  free(trie);
+}
+
+// ============================================================================
+// HELPER FUNCTIONS
+// ============================================================================
+
+/**
+ * Create a new Trie node
+ */
+static TrieNode *trie_create_node(Trie *trie, TrieNode *parent) {
+  TrieNode *node = trie->node_pool ? (TrieNode *)pool_alloc(trie->node_pool)
+                                   : (TrieNode *)malloc(sizeof(TrieNode));
+  if (!node)
+    return NULL;
+
+  node->label = NULL;
+  node->label_len = 0;
+  node->child_count = 0;
+  node->child_capacity = 0;
+  node->child_keys = NULL;
+  node->children = NULL;
+  node->parent = parent;
+  node->isEnd = false;
+  node->postings = NULL;
+  node->posting_count = 0;
+  node->posting_capacity = 0;
+  node->subtree_postings = 0;
+  node->top_count = 0;
+  node->top = NULL;
+
+  return node;
+}
+
+static void trie_destroy_node(Trie *trie, TrieNode *node) {
+  for (int i = 0; i < node->child_count; i++) {
+    trie_destroy_node(trie, node->children[i]);
+  }
+  free(node->children);
+
+  // Free each song's terminal links the first time one of its nodes goes
+  for (int i = 0; i < node->posting_count; i++) {
+    int song_id = node->postings[i];
+    SongIdNode *link = (SongIdNode *)hashmap_get(trie->terminals, song_id);
+    hashmap_remove(trie->terminals, song_id);
+    while (link) {
+      SongIdNode *next = link->next;
+      if (trie->id_pool)
+        pool_free(trie->id_pool, link);
+      else
+        free(link);
+      link = next;
+    }
+  }
+  free(node->postings);
+  free(node->top);
+
+  if (trie->node_pool)
+    pool_free(trie->node_pool, node);
+  else
+    free(node);
+}
+
+/**
+ * Insert an already folded key of len bytes
+ * Returns false only if an allocation fails
+ */
+static bool trie_insert_key(Trie *trie, const char *key, int len,
+                            int song_id) {
+  TrieNode *current = trie->root;
+  int pos = 0;
+  while (pos < len) {
+    int index = child_find(current, key[pos]);
+    if (index == -1) {
+      // No edge starts with this byte: the rest of the key becomes one label
+      current = trie_add_leaf(trie, current, key + pos, len - pos);
+      if (!current)
+        return false;
+      break;
+    }
+
+    TrieNode *child = current->children[index];
+    int matched = 0;
+    while (pos < len && matched < child->label_len &&
+           key[pos] == child->label[matched]) {
+      matched++;
+      pos++;
+    }
+
+    // Key leaves the edge part-way: split it where they diverge
+    if (matched < child->label_len) {
+      child = trie_split(trie, current, child, matched);
+      if (!child)
+        return false;
+    }
+    current = child;
+  }
+
+  // Re-adding a song under the same key keeps a single entry
+  int lo = 0, hi = current->posting_count;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (current->postings[mid] < song_id)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo < current->posting_count && current->postings[lo] == song_id)
+    return true;
+
+  // Link the node from the song's terminal chain
+  SongIdNode *link = trie->id_pool ? (SongIdNode *)pool_alloc(trie->id_pool)
+                                   : (SongIdNode *)malloc(sizeof(SongIdNode));
+  if (!link)
+    return false;
+
+  link->song_id = song_id;
+  link->node = current;
+  link->next = (SongIdNode *)hashmap_get(trie->terminals, song_id);
+  if (!hashmap_put(trie->terminals, song_id, link) ||
+      !posting_add(current, song_id)) {
+    if (hashmap_get(trie->terminals, song_id) == link) {
+      if (link->next)
+        hashmap_put(trie->terminals, song_id, link->next);
+      else
+        hashmap_remove(trie->terminals, song_id);
+    }
+    if (trie->id_pool)
+      pool_free(trie->id_pool, link);
+    else
+      free(link);
+    return false;
+  }
+
+  current->isEnd = true;
+  for (TrieNode *node = current; node; node = node->parent)
+    node->subtree_postings++;
+
+  rank_path(trie, current, song_id, trie_priority(trie, song_id));
+  return true;
+}
+
+/**
+ * Remove song_id from the node reached by an already folded key
+ * Returns false if the key does not hold song_id
+ */
+static bool trie_remove_key(Trie *trie, const char *key, int len,
+                            int song_id) {
+  bool exact;
+  TrieNode *node = trie_find_node(trie, key, len, &exact);
+  if (!node || !exact)
+    return false;
+
+  int i = lower_bound(node->postings, node->posting_count, song_id);
+  if (i == node->posting_count || node->postings[i] != song_id)
+    return false;
+
+  trie_remove_at(trie, node, song_id);
+  return true;
+}
+
+/**
+ * Remove song_id, which node holds, and restore the trie's invariants:
+ * subtree counts, completion caches and path compression
+ */
+static void trie_remove_at(Trie *trie, TrieNode *node, int song_id) {
+  posting_remove(node, song_id);
+  terminal_unlink(trie, song_id, node);
+  node->isEnd = node->posting_count > 0;
+  for (TrieNode *up = node; up; up = up->parent) {
+    if (--up->subtree_postings <= TRIE_TOP_K)
+      rank_drop(up);
+  }
+
+  rank_forget(trie, node, song_id);
+  trie_prune(trie, node);
+}
+
+/**
+ * Free songless nodes from node upwards, then merge a songless node left
+ * with a single child into that child
+ */
+static void trie_prune(Trie *trie, TrieNode *node) {
+  while (node != trie->root && node->posting_count == 0) {
+    TrieNode *parent = node->parent;
+    if (node->child_count > 0) {
+      if (node->child_count == 1)
+        trie_merge_child(trie, node);
+      return;
+    }
+
+    child_remove(parent, child_find(parent, node->label[0]));
+    node_free(trie, node);
+    node = parent;
+  }
+}
+
+/**
+ * Replace node by its only child, prefixing node's label to the child's
+ * Labels cut by a split are still adjacent in the arena and are rejoined in
+ * place; otherwise the pair is copied. The caches already agree, since both
+ * nodes cover the same songs. On allocation failure node is kept.
+ */
+static void trie_merge_child(Trie *trie, TrieNode *node) {
+  TrieNode *child = node->children[0];
+  const char *label = node->label;
+  if (node->label + node->label_len != child->label) {
+    char *joined = label_alloc(trie, node->label_len + child->label_len);
+    if (!joined)
+      return;
+    memcpy(joined, node->label, node->label_len);
+    memcpy(joined + node->label_len, child->label, child->label_len);
+    label = joined;
+  }
+
+  TrieNode *parent = node->parent;
+  parent->children[child_find(parent, node->label[0])] = child;
+  child->parent = parent;
+  child->label = label;
+  child->label_len += node->label_len;
+  node_free(trie, node);
+}
+
+/**
+ * Free a single node that holds no songs; its children are not touched
+ */
+static void node_free(Trie *trie, TrieNode *node) {
+  free(node->children);
+  free(node->postings);
+  free(node->top);
+  if (trie->node_pool)
+    pool_free(trie->node_pool, node);
+  else
+    free(node);
+}
+
+/**
+ * Walk a folded key of len bytes from the root; NULL if no key starts with it
+ * exact (optional) is set when the key ends on the node itself rather than
+ * part-way along its label
+ */
+static TrieNode *trie_find_node(Trie *trie, const char *key, int len,
+                                bool *exact) {
+  TrieNode *current = trie->root;
+  int pos = 0;
+  int matched = 0;
+  while (pos < len) {
+    int index = child_find(current, key[pos]);
+    if (index == -1)
+      return NULL;
+
+    current = current->children[index];
+    matched = 0;
+    while (pos < len && matched < current->label_len) {
+      if (key[pos] != current->label[matched])
+        return NULL;
+      matched++;
+      pos++;
+    }
+  }
+
+  if (exact)
+    *exact = matched == current->label_len;
+  return current;
+}
+
+/**
+ * Decode the UTF-8 character at *pos and advance past it; 0 at the end
+ * A malformed byte decodes to U+FFFD and is skipped on its own.
+ */
+static uint32_t utf8_next(const char *text, int *pos) {
+  const unsigned char *s = (const unsigned char *)text + *pos;
+  if (s[0] < 0x80) {
+    if (s[0])
+      (*pos)++;
+    return s[0];
+  }
+
+  int len;
+  uint32_t cp;
+  if ((s[0] & 0xE0) == 0xC0) {
+    len = 2;
+    cp = s[0] & 0x1F;
+  } else if ((s[0] & 0xF0) == 0xE0) {
+    len = 3;
+    cp = s[0] & 0x0F;
+  } else if ((s[0] & 0xF8) == 0xF0) {
+    len = 4;
+    cp = s[0] & 0x07;
+  } else {
+    (*pos)++;
+    return 0xFFFD;
+  }
+
+  // A NUL fails the continuation test, so this never reads past the end
+  for (int i = 1; i < len; i++) {
+    if ((s[i] & 0xC0) != 0x80) {
+      (*pos)++;
+      return 0xFFFD;
+    }
+    cp = (cp << 6) | (s[i] & 0x3F);
+  }
+
+  // Reject overlong forms, surrogates and values past U+10FFFF
+  static const uint32_t min_cp[] = {0, 0, 0x80, 0x800, 0x10000};
+  if (cp < min_cp[len] || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) {
+    (*pos)++;
+    return 0xFFFD;
+  }
+
+  *pos += len;
+  return cp;
+}
+
+/**
+ * Write cp as UTF-8; returns the byte count
+ */
+static int utf8_encode(uint32_t cp, char *out) {
+  if (cp < 0x80) {
+    out[0] = (char)cp;
+    return 1;
+  }
+  if (cp < 0x800) {
+    out[0] = (char)(0xC0 | (cp >> 6));
+    out[1] = (char)(0x80 | (cp & 0x3F));
+    return 2;
+  }
+  if (cp < 0x10000) {
+    out[0] = (char)(0xE0 | (cp >> 12));
+    out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[2] = (char)(0x80 | (cp & 0x3F));
+    return 3;
+  }
+  out[0] = (char)(0xF0 | (cp >> 18));
+  out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+  out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+  out[3] = (char)(0x80 | (cp & 0x3F));
+  return 4;
+}
+
+/**
+ * Latin-1 Supplement and Latin Extended-A (U+00C0 - U+017F), lowercased with
+ * diacritics removed; letters without a decomposition use their usual
+ * transliteration. NULL marks the two symbols in the range.
+ */
+static const char *const latin_fold[0x180 - 0xC0] = {
+    "a", "a", "a", "a", "a", "a", "ae", "c",  // U+00C0
+    "e", "e", "e", "e", "i", "i", "i", "i",   // U+00C8
+    "d", "n", "o", "o", "o", "o", "o", NULL,  // U+00D0
+    "o", "u", "u", "u", "u", "y", "th", "ss", // U+00D8
+    "a", "a", "a", "a", "a", "a", "ae", "c",  // U+00E0
+    "e", "e", "e", "e", "i", "i", "i", "i",   // U+00E8
+    "d", "n", "o", "o", "o", "o", "o", NULL,  // U+00F0
+    "o", "u", "u", "u", "u", "y", "th", "y",  // U+00F8
+    "a", "a", "a", "a", "a", "a", "c", "c",   // U+0100
+    "c", "c", "c", "c", "c", "c", "d", "d",   // U+0108
+    "d", "d", "e", "e", "e", "e", "e", "e",   // U+0110
+    "e", "e", "e", "e", "g", "g", "g", "g",   // U+0118
+    "g", "g", "g", "g", "h", "h", "h", "h",   // U+0120
+    "i", "i", "i", "i", "i", "i", "i", "i",   // U+0128
+    "i", "i", "ij", "ij", "j", "j", "k", "k", // U+0130
+    "k", "l", "l", "l", "l", "l", "l", "l",   // U+0138
+    "l", "l", "l", "n", "n", "n", "n", "n",   // U+0140
+    "n", "n", "n", "n", "o", "o", "o", "o",   // U+0148
+    "o", "o", "oe", "oe", "r", "r", "r", "r", // U+0150
+    "r", "r", "s", "s", "s", "s", "s", "s",   // U+0158
+    "s", "s", "t", "t", "t", "t", "t", "t",   // U+0160
+    "u", "u", "u", "u", "u", "u", "u", "u",   // U+0168
+    "u", "u", "u", "u", "w", "w", "y", "y",   // U+0170
+    "y", "z", "z", "z", "z", "z", "z", "s",   // U+0178
+};
+
+/**
+ * Greek and Coptic letters U+0386 - U+03CE, lowercased without tonos or
+ * dialytika; final sigma folds to sigma. 0 marks non-letters.
+ */
+static const uint16_t greek_fold[0x3CF - 0x386] = {
+    0x03B1, 0x0000, 0x03B5, 0x03B7, 0x03B9, 0x0000, 0x03BF, 0x0000, // U+0386
+    0x03C5, 0x03C9, 0x03B9, 0x03B1, 0x03B2, 0x03B3, 0x03B4, 0x03B5, // U+038E
+    0x03B6, 0x03B7, 0x03B8, 0x03B9, 0x03BA, 0x03BB, 0x03BC, 0x03BD, // U+0396
+    0x03BE, 0x03BF, 0x03C0, 0x03C1, 0x0000, 0x03C3, 0x03C4, 0x03C5, // U+039E
+    0x03C6, 0x03C7, 0x03C8, 0x03C9, 0x03B9, 0x03C5, 0x03B1, 0x03B5, // U+03A6
+    0x03B7, 0x03B9, 0x03C5, 0x03B1, 0x03B2, 0x03B3, 0x03B4, 0x03B5, // U+03AE
+    0x03B6, 0x03B7, 0x03B8, 0x03B9, 0x03BA, 0x03BB, 0x03BC, 0x03BD, // U+03B6
+    0x03BE, 0x03BF, 0x03C0, 0x03C1, 0x03C3, 0x03C3, 0x03C4, 0x03C5, // U+03BE
+    0x03C6, 0x03C7, 0x03C8, 0x03C9, 0x03B9, 0x03C5, 0x03BF, 0x03C5, // U+03C6
+    0x03C9,                                                         // U+03CE
+};
+
+/**
+ * Fold one character for the index: lowercase, accents stripped
+ * Writes up to TRIE_FOLD_MAX bytes of UTF-8 to out and returns the count:
+ * 0 for marks that vanish inside a word (combining accents, apostrophes),
+ * -1 for separators. Scripts without case (Devanagari, CJK, ...) pass
+ * through unchanged.
+ */
+static int fold_char(uint32_t cp, char *out) {
+  if (cp < 0x80) {
+    if (cp >= 'A' && cp <= 'Z')
+      cp += 'a' - 'A';
+    if ((cp >= 'a' && cp <= 'z') || (cp >= '0' && cp <= '9')) {
+      out[0] = (char)cp;
+      return 1;
     }
+    return cp == '\'' ? 0 : -1;
+  }
+
+  // C1 controls, no-break space, Latin-1 punctuation and symbols
+  if (cp < 0xC0)
+    return -1;
+
+  if (cp < 0x180) {
+    const char *folded = latin_fold[cp - 0xC0];
+    if (!folded)
+      return -1;
+    int len = (int)strlen(folded);
+    memcpy(out, folded, len);
+    return len;
+  }
+
+  if (cp >= 0x386 && cp <= 0x3CE) {
+    cp = greek_fold[cp - 0x386];
+    if (!cp)
+      return -1;
+  } else if (cp >= 0x400 && cp <= 0x40F) {
+    cp += 0x50;
+  } else if (cp >= 0x410 && cp <= 0x42F) {
+    cp += 0x20;
+  } else if (cp >= 0xFF10 && cp <= 0xFF19) {
+    cp = '0' + (cp - 0xFF10); // Fullwidth digits and letters
+  } else if (cp >= 0xFF21 && cp <= 0xFF3A) {
+    cp = 'a' + (cp - 0xFF21);
+  } else if (cp >= 0xFF41 && cp <= 0xFF5A) {
+    cp = 'a' + (cp - 0xFF41);
   }
 
-  // Free song ID list
-  SongIdNode *current = root->song_ids;
-  while (current) {
-    SongIdNode *next = current->next;
-    free(current);
-    current = next;
+  // Cyrillic io and ie with grave read as ie
+  if (cp == 0x450 || cp == 0x451)
+    cp = 0x435;
+
+  // Combining marks, variation selectors and typographic apostrophes
+  if ((cp >= 0x300 && cp <= 0x36F) || (cp >= 0x1AB0 && cp <= 0x1AFF) ||
+      (cp >= 0x1DC0 && cp <= 0x1DFF) || (cp >= 0x20D0 && cp <= 0x20FF) ||
+      (cp >= 0xFE00 && cp <= 0xFE0F) || (cp >= 0xFE20 && cp <= 0xFE2F) ||
+      cp == 0x2BC || cp == 0x2018 || cp == 0x2019)
+    return 0;
+
+  // Punctuation and symbol blocks, Devanagari dandas, specials and emoji
+  if (cp == 0x37E || cp == 0x387 || cp == 0x964 || cp == 0x965 ||
+      (cp >= 0x2000 && cp <= 0x2BFF) || (cp >= 0x3000 && cp <= 0x303F) ||
+      (cp >= 0xFE30 && cp <= 0xFE6F) || (cp >= 0xFF00 && cp <= 0xFF65) ||
+      (cp >= 0xFFF0 && cp <= 0xFFFF) || (cp >= 0x1F000 && cp <= 0x1FAFF))
+    return -1;
+
+  return utf8_encode(cp, out);
+}
+
+/**
+ * Han ideographs and kana, which are indexed one character per word
+ */
+static bool is_ideograph(uint32_t cp) {
+  return (cp >= 0x3040 && cp <= 0x30FF) || (cp >= 0x3400 && cp <= 0x4DBF) ||
+         (cp >= 0x4E00 && cp <= 0x9FFF) || (cp >= 0xF900 && cp <= 0xFAFF) ||
+         (cp >= 0x20000 && cp <= 0x3134F);
+}
+
+/**
+ * Fold a whole key into out (TRIE_MAX_WORD bytes), dropping separators
+ * Returns the folded length in bytes.
+ */
+static int fold_key(const char *key, char *out) {
+  int len = 0;
+  int pos = 0;
+  uint32_t cp;
+  while ((cp = utf8_next(key, &pos)) != 0) {
+    char folded[TRIE_FOLD_MAX];
+    int n = fold_char(cp, folded);
+    if (n <= 0)
+      continue;
+    if (len + n >= TRIE_MAX_WORD)
+      break;
+    memcpy(out + len, folded, n);
+    len += n;
   }
 
-  free(root);
+  out[len] = '\0';
+  return len;
+}
+
+/**
+ * Fold the next word of text from *pos into word
+ * word must hold TRIE_MAX_WORD bytes. Returns its length in bytes, 0 at the
+ * end.
+ */
+static int next_word(const char *text, int *pos, char *word) {
+  int len = 0;
+  bool full = false;
+  while (text[*pos] != '\0') {
+    int start = *pos;
+    uint32_t cp = utf8_next(text, pos);
+    char folded[TRIE_FOLD_MAX];
+    int n = fold_char(cp, folded);
+    if (n < 0) {
+      if (len > 0)
+        break;
+      continue;
+    }
+
+    if (is_ideograph(cp)) {
+      // Ends the current word, or is the whole word
+      if (len > 0) {
+        *pos = start;
+      } else {
+        memcpy(word, folded, n);
+        len = n;
+      }
+      break;
+    }
+
+    // Stop at the first character that does not fit
+    if (!full && len + n < TRIE_MAX_WORD) {
+      memcpy(word + len, folded, n);
+      len += n;
+    } else {
+      full = true;
+    }
+  }
+
+  word[len] = '\0';
+  return len;
+}
+
+/**
+ * Fold the first TRIE_MAX_TERMS words of query; returns how many there are
+ */
+static int query_terms(const char *query, QueryTerms *terms) {
+  int pos = 0;
+  terms->count = 0;
+  while (terms->count < TRIE_MAX_TERMS) {
+    int len = next_word(query, &pos, terms->words[terms->count]);
+    if (len == 0)
+      break;
+    terms->lens[terms->count++] = len;
+  }
+  return terms->count;
+}
+
+/**
+ * Word search over the in-memory trie into trie->matches
+ * Terms are processed rarest first; each further term is merged with the
+ * matches so far as a sorted posting list, or checked per remaining match
+ * when its posting lists are much longer. Returns the match count.
+ */
+static int words_live(Trie *trie, const QueryTerms *terms) {
+  TrieNode *nodes[TRIE_MAX_TERMS];
+  for (int t = 0; t < terms->count; t++) {
+    TrieNode *node =
+        trie_find_node(trie, terms->words[t], terms->lens[t], NULL);
+    if (!node)
+      return 0;
+
+    // Rarest term first
+    int i = t;
+    while (i > 0 && nodes[i - 1]->subtree_postings > node->subtree_postings) {
+      nodes[i] = nodes[i - 1];
+      i--;
+    }
+    nodes[i] = node;
+  }
+
+  int count = collect_postings(nodes[0], &trie->matches, &trie->match_capacity);
+  for (int t = 1; t < terms->count && count > 0; t++) {
+    int *matches = trie->matches;
+    int kept = 0;
+
+    if ((long)count * TRIE_PROBE_RATIO < nodes[t]->subtree_postings) {
+      for (int i = 0; i < count; i++) {
+        if (song_under(trie, matches[i], nodes[t]))
+          matches[kept++] = matches[i];
+      }
+    } else {
+      int other_count = collect_postings(nodes[t], &trie->term_matches,
+                                         &trie->term_capacity);
+      if (other_count < 0)
+        return 0;
+      kept = intersect_sorted(matches, count, trie->term_matches, other_count);
+    }
+    count = kept;
+  }
+  return count < 0 ? 0 : count;
+}
+
+/**
+ * Word search over the mapped image into trie->image_matches
+ * Same strategy as words_live, probing through the image's per-song node
+ * lists. Returns the match count.
+ */
+static int words_image(Trie *trie, const QueryTerms *terms) {
+  const TrieImage *image = trie->image;
+  uint32_t nodes[TRIE_MAX_TERMS];
+  for (int t = 0; t < terms->count; t++) {
+    int index =
+        image_find_node(image, terms->words[t], terms->lens[t], NULL);
+    if (index < 0)
+      return 0;
+
+    uint32_t postings = image_subtree_postings(image, (uint32_t)index);
+    int i = t;
+    while (i > 0 && image_subtree_postings(image, nodes[i - 1]) > postings) {
+      nodes[i] = nodes[i - 1];
+      i--;
+    }
+    nodes[i] = (uint32_t)index;
+  }
+
+  int count = image_collect_postings(image, nodes[0], &trie->image_matches,
+                                     &trie->image_capacity);
+  for (int t = 1; t < terms->count && count > 0; t++) {
+    int *matches = trie->image_matches;
+    int kept = 0;
+
+    if ((long)count * TRIE_PROBE_RATIO <
+        image_subtree_postings(image, nodes[t])) {
+      for (int i = 0; i < count; i++) {
+        if (image_song_under(image, matches[i], nodes[t]))
+          matches[kept++] = matches[i];
+      }
+    } else {
+      int other_count = image_collect_postings(image, nodes[t],
+                                               &trie->term_matches,
+                                               &trie->term_capacity);
+      if (other_count < 0)
+        return 0;
+      kept = intersect_sorted(matches, count, trie->term_matches, other_count);
+    }
+    count = kept;
+  }
+  return count < 0 ? 0 : drop_removed(trie, trie->image_matches, count);
+}
+
+/**
+ * Fuzzy search of every term over the image or the in-memory trie, into
+ * *buffer. Returns the match count.
+ */
+static int fuzzy_terms(Trie *trie, const QueryTerms *terms, int max_edits,
+                       bool image, int **buffer, int *capacity) {
+  int count = 0;
+  for (int t = 0; t < terms->count; t++) {
+    if (t == 0) {
+      count = fuzzy_collect(trie, image, terms->words[t], terms->lens[t],
+                            max_edits, buffer, capacity);
+    } else {
+      int other_count =
+          fuzzy_collect(trie, image, terms->words[t], terms->lens[t],
+                        max_edits, &trie->term_matches, &trie->term_capacity);
+      count = other_count > 0 ? intersect_sorted(*buffer, count,
+                                                 trie->term_matches,
+                                                 other_count)
+                              : 0;
+    }
+    if (count <= 0)
+      return 0;
+  }
+  return count;
+}
+
+/**
+ * Write the union of two ascending ID lists to out_ids, at most cap IDs
+ * Returns the size of the union
+ */
+static int emit_union(const int *a, int a_count, const int *b, int b_count,
+                      int *out_ids, int cap) {
+  if (b_count == 0 || a_count == 0) {
+    const int *ids = a_count ? a : b;
+    int count = a_count ? a_count : b_count;
+    int written = count < cap ? count : cap;
+    if (out_ids && written > 0)
+      memcpy(out_ids, ids, sizeof(int) * written);
+    return count;
+  }
+
+  int total = 0;
+  int i = 0, j = 0;
+  while (i < a_count || j < b_count) {
+    int id;
+    if (j == b_count || (i < a_count && a[i] < b[j])) {
+      id = a[i++];
+    } else if (i == a_count || b[j] < a[i]) {
+      id = b[j++];
+    } else {
+      id = a[i++];
+      j++;
+    }
+    if (out_ids && total < cap)
+      out_ids[total] = id;
+    total++;
+  }
+  return total;
+}
+
+/**
+ * Sort (song_id, priority) candidates by rank and write the first k distinct
+ * IDs to out_ids. Returns the number written.
+ */
+static int rank_candidates(HeapNode *items, int size, int k, int *out_ids) {
+  if (size == 0)
+    return 0;
+  qsort(items, size, sizeof(HeapNode), compare_ranked);
+
+  // Equal IDs carry equal priorities, so duplicates end up adjacent
+  int count = 0;
+  for (int i = 0; i < size && count < k; i++) {
+    if (i > 0 && items[i].song_id == items[i - 1].song_id)
+      continue;
+    out_ids[count++] = items[i].song_id;
+  }
+  return count;
+}
+
+/**
+ * Insert song_id into node's ascending posting list
+ */
+static bool posting_add(TrieNode *node, int song_id) {
+  if (node->posting_count == node->posting_capacity) {
+    int capacity = node->posting_capacity ? node->posting_capacity * 2 : 2;
+    int *grown = (int *)realloc(node->postings, sizeof(int) * capacity);
+    if (!grown)
+      return false;
+    node->postings = grown;
+    node->posting_capacity = capacity;
+  }
+
+  int i = node->posting_count++;
+  while (i > 0 && node->postings[i - 1] > song_id) {
+    node->postings[i] = node->postings[i - 1];
+    i--;
+  }
+  node->postings[i] = song_id;
+  return true;
+}
+
+/**
+ * Delete song_id from node's posting list; false if it is not there
+ */
+static bool posting_remove(TrieNode *node, int song_id) {
+  int i = lower_bound(node->postings, node->posting_count, song_id);
+  if (i == node->posting_count || node->postings[i] != song_id)
+    return false;
+
+  memmove(node->postings + i, node->postings + i + 1,
+          sizeof(int) * (node->posting_count - i - 1));
+  node->posting_count--;
+  return true;
+}
+
+/**
+ * Drop the terminal link from song_id to node
+ */
+static void terminal_unlink(Trie *trie, int song_id, TrieNode *node) {
+  SongIdNode *head = (SongIdNode *)hashmap_get(trie->terminals, song_id);
+  SongIdNode *prev = NULL;
+  SongIdNode *link = head;
+  while (link && link->node != node) {
+    prev = link;
+    link = link->next;
+  }
+  if (!link)
+    return;
+
+  if (prev)
+    prev->next = link->next;
+  else if (link->next)
+    hashmap_put(trie->terminals, song_id, link->next);
+  else
+    hashmap_remove(trie->terminals, song_id);
+
+  if (trie->id_pool)
+    pool_free(trie->id_pool, link);
+  else
+    free(link);
+}
+
+/**
+ * Grow a reusable query buffer to hold at least needed IDs
+ */
+static int *ensure_buffer(int **buffer, int *capacity, int needed) {
+  if (needed > *capacity) {
+    int new_capacity = *capacity ? *capacity : 64;
+    while (new_capacity < needed)
+      new_capacity *= 2;
+    int *grown = (int *)realloc(*buffer, sizeof(int) * new_capacity);
+    if (!grown)
+      return NULL;
+    *buffer = grown;
+    *capacity = new_capacity;
+  }
+  return *buffer;
+}
+
+/**
+ * Union of the posting lists at and below node into *buffer, ascending and
+ * without duplicates. Returns the count, or -1 if the buffer cannot grow.
+ */
+static int collect_postings(TrieNode *node, int **buffer, int *capacity) {
+  if (!ensure_buffer(buffer, capacity, node->subtree_postings))
+    return -1;
+
+  int count = 0;
+  bool sorted = true;
+  gather_postings(node, *buffer, &count, &sorted);
+  return sorted ? count : sort_unique(*buffer, count);
+}
+
+/**
+ * Append every posting at and below node; sorted stays true only while a
+ * single non-empty list has been appended
+ */
+static void gather_postings(TrieNode *node, int *out, int *count,
+                            bool *sorted) {
+  if (node->posting_count > 0) {
+    if (*count > 0)
+      *sorted = false;
+    memcpy(out + *count, node->postings, sizeof(int) * node->posting_count);
+    *count += node->posting_count;
+  }
+
+  for (int i = 0; i < node->child_count; i++)
+    gather_postings(node->children[i], out, count, sorted);
+}
+
+static int compare_ints(const void *a, const void *b) {
+  int x = *(const int *)a;
+  int y = *(const int *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * Sort ids ascending and drop duplicates; returns the new count
+ */
+static int sort_unique(int *ids, int count) {
+  qsort(ids, count, sizeof(int), compare_ints);
+  int unique = 0;
+  for (int i = 0; i < count; i++) {
+    if (unique == 0 || ids[unique - 1] != ids[i])
+      ids[unique++] = ids[i];
+  }
+  return unique;
+}
+
+/**
+ * Index of the first of count ascending ids that is not below id
+ */
+static int lower_bound(const int *ids, int count, int id) {
+  int lo = 0, hi = count;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (ids[mid] < id)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/**
+ * Keep the IDs of ids that also appear in other; both ascending
+ * Returns the new count
+ */
+static int intersect_sorted(int *ids, int count, const int *other,
+                            int other_count) {
+  int kept = 0;
+  int i = 0, j = 0;
+  while (i < count && j < other_count) {
+    if (ids[i] < other[j]) {
+      i++;
+    } else if (ids[i] > other[j]) {
+      j++;
+    } else {
+      ids[kept++] = ids[i];
+      i++;
+      j++;
+    }
+  }
+  return kept;
+}
+
+/**
+ * Union of the postings of every word within the edit budget of one folded
+ * query word into *buffer, ascending and without duplicates
+ * Returns the count, or -1 if the buffer cannot grow
+ */
+static int fuzzy_collect(Trie *trie, bool image, const char *word, int len,
+                         int max_edits, int **buffer, int *capacity) {
+  FuzzyTerm fuzzy;
+  fuzzy.term_len = 0;
+  int pos = 0;
+  while (pos < len)
+    fuzzy.term[fuzzy.term_len++] = utf8_next(word, &pos);
+
+  int short_limit = (fuzzy.term_len - 1) / 3;
+  fuzzy.max_edits = max_edits < short_limit ? max_edits : short_limit;
+  fuzzy.buffer = buffer;
+  fuzzy.capacity = capacity;
+  fuzzy.count = 0;
+  fuzzy.sorted = true;
+  fuzzy.failed = false;
+
+  // Distance from the empty prefix: delete the first j query characters
+  int row[TRIE_MAX_WORD];
+  for (int j = 0; j <= fuzzy.term_len; j++)
+    row[j] = j;
+
+  if (image)
+    fuzzy_walk_image(&fuzzy, trie->image, 0, row, 0, 0);
+  else
+    fuzzy_walk(&fuzzy, trie->root, row, 0, 0);
+  if (fuzzy.failed)
+    return -1;
+  return fuzzy.sorted ? fuzzy.count : sort_unique(*buffer, fuzzy.count);
+}
+
+/**
+ * Extend row (edit distances for the path down to node) along each child
+ * label. Labels may split a character, so the partly decoded code point cp
+ * and its pending continuation bytes carry over between nodes. A child is
+ * collected whole once the full term is within budget, and skipped once no
+ * cell of the row is.
+ */
+static void fuzzy_walk(FuzzyTerm *fuzzy, TrieNode *node, const int *row,
+                       uint32_t cp, int pending) {
+  for (int c = 0; c < node->child_count && !fuzzy->failed; c++) {
+    int rows[2][TRIE_MAX_WORD];
+    const int *prev = row;
+    uint32_t child_cp = cp;
+    int child_pending = pending;
+    int step = 0;
+    int start = 0;
+    int state = FUZZY_CONTINUE;
+
+    // A one-byte first character is tried from the child key alone, so
+    // children that fail at once are never loaded
+    unsigned char key = node->child_keys[c];
+    if (pending == 0 && key < 0x80) {
+      int *next = rows[step++ & 1];
+      state = fuzzy_row(fuzzy, prev, next, key);
+      if (state == FUZZY_PRUNE)
+        continue;
+      prev = next;
+      child_cp = key;
+      start = 1;
+    }
+
+    TrieNode *child = node->children[c];
+    for (int i = start; i < child->label_len && state == FUZZY_CONTINUE;
+         i++) {
+      unsigned char byte = (unsigned char)child->label[i];
+      if (child_pending > 0) {
+        child_cp = (child_cp << 6) | (byte & 0x3F);
+        child_pending--;
+      } else if (byte < 0x80) {
+        child_cp = byte;
+      } else {
+        // Folded keys are valid UTF-8: the lead byte gives the length
+        child_pending = byte >= 0xF0 ? 3 : byte >= 0xE0 ? 2 : 1;
+        child_cp = byte & (0x3F >> child_pending);
+      }
+      if (child_pending > 0)
+        continue;
+
+      int *next = rows[step++ & 1];
+      state = fuzzy_row(fuzzy, prev, next, child_cp);
+      prev = next;
+    }
+
+    if (state == FUZZY_MATCH) {
+      // Every word below starts within budget of the term
+      if (!fuzzy_take(fuzzy, child->subtree_postings))
+        return;
+      gather_postings(child, *fuzzy->buffer, &fuzzy->count, &fuzzy->sorted);
+    } else if (state == FUZZY_CONTINUE) {
+      fuzzy_walk(fuzzy, child, prev, child_cp, child_pending);
+    }
+  }
+}
+
+/**
+ * fuzzy_walk over the mapped image, from node index
+ */
+static void fuzzy_walk_image(FuzzyTerm *fuzzy, const TrieImage *image,
+                             uint32_t index, const int *row, uint32_t cp,
+                             int pending) {
+  const TrieImageNode *node = &image->nodes[index];
+  uint32_t child_count = image_child_count(node);
+  for (uint32_t c = 0; c < child_count && !fuzzy->failed; c++) {
+    uint32_t slot = node->first_child + c;
+    int rows[2][TRIE_MAX_WORD];
+    const int *prev = row;
+    uint32_t child_cp = cp;
+    int child_pending = pending;
+    int step = 0;
+    int start = 0;
+    int state = FUZZY_CONTINUE;
+
+    unsigned char key = image->keys[slot];
+    if (pending == 0 && key < 0x80) {
+      int *next = rows[step++ & 1];
+      state = fuzzy_row(fuzzy, prev, next, key);
+      if (state == FUZZY_PRUNE)
+        continue;
+      prev = next;
+      child_cp = key;
+      start = 1;
+    }
+
+    uint32_t child_index = image->children[slot];
+    const TrieImageNode *child = &image->nodes[child_index];
+    const char *label = image->labels + child->label;
+    int label_len = (int)image_label_len(child);
+    for (int i = start; i < label_len && state == FUZZY_CONTINUE; i++) {
+      unsigned char byte = (unsigned char)label[i];
+      if (child_pending > 0) {
+        child_cp = (child_cp << 6) | (byte & 0x3F);
+        child_pending--;
+      } else if (byte < 0x80) {
+        child_cp = byte;
+      } else {
+        child_pending = byte >= 0xF0 ? 3 : byte >= 0xE0 ? 2 : 1;
+        child_cp = byte & (0x3F >> child_pending);
+      }
+      if (child_pending > 0)
+        continue;
+
+      int *next = rows[step++ & 1];
+      state = fuzzy_row(fuzzy, prev, next, child_cp);
+      prev = next;
+    }
+
+    if (state == FUZZY_MATCH) {
+      if (!fuzzy_take(fuzzy, (int)image_subtree_postings(image, child_index)))
+        return;
+      image_gather_postings(image, child_index, *fuzzy->buffer, &fuzzy->count,
+                            &fuzzy->sorted);
+    } else if (state == FUZZY_CONTINUE) {
+      fuzzy_walk_image(fuzzy, image, child_index, prev, child_cp,
+                       child_pending);
+    }
+  }
+}
+
+/**
+ * Make room for needed more postings in the walk's buffer
+ * Marks the walk failed if the buffer cannot grow
+ */
+static bool fuzzy_take(FuzzyTerm *fuzzy, int needed) {
+  if (!ensure_buffer(fuzzy->buffer, fuzzy->capacity, fuzzy->count + needed)) {
+    fuzzy->failed = true;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Compute next, the DP row after appending cp to the path of prev
+ * Cells more than max_edits off the diagonal can never get back within
+ * budget, so only that band is computed and the cells bordering it read as
+ * max_edits + 1. Cell 0 is the path length.
+ * Returns FUZZY_MATCH when the whole term is within budget, FUZZY_PRUNE when
+ * no cell is, FUZZY_CONTINUE otherwise.
+ */
+static int fuzzy_row(FuzzyTerm *fuzzy, const int *prev, int *next,
+                     uint32_t cp) {
+  int n = fuzzy->term_len;
+  int edits = fuzzy->max_edits;
+  next[0] = prev[0] + 1;
+  int lo = next[0] - edits > 1 ? next[0] - edits : 1;
+  int hi = next[0] + edits < n ? next[0] + edits : n;
+  if (lo > 1)
+    next[lo - 1] = edits + 1;
+  if (hi < n)
+    next[hi + 1] = edits + 1;
+
+  int best = next[0];
+  for (int j = lo; j <= hi; j++) {
+    int value = prev[j - 1] + (fuzzy->term[j - 1] != cp);
+    if (prev[j] + 1 < value)
+      value = prev[j] + 1;
+    if (next[j - 1] + 1 < value)
+      value = next[j - 1] + 1;
+    if (value > edits + 1)
+      value = edits + 1;
+    next[j] = value;
+    if (value < best)
+      best = value;
+  }
+
+  if (hi == n && next[n] <= edits)
+    return FUZZY_MATCH;
+  return best > edits ? FUZZY_PRUNE : FUZZY_CONTINUE;
+}
+
+/**
+ * Whether song_id has a key at or below ancestor
+ * Time Complexity: O(keys of the song * depth)
+ */
+static bool song_under(Trie *trie, int song_id, TrieNode *ancestor) {
+  SongIdNode *link = (SongIdNode *)hashmap_get(trie->terminals, song_id);
+  for (; link; link = link->next) {
+    for (TrieNode *node = link->node; node; node = node->parent) {
+      if (node == ancestor)
+        return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Reserve len bytes of label storage
+ */
+static char *label_alloc(Trie *trie, int len) {
+  TrieLabelChunk *chunk = trie->labels;
+  if (!chunk || chunk->capacity - chunk->used < len) {
+    int capacity = len > TRIE_LABEL_CHUNK_SIZE ? len : TRIE_LABEL_CHUNK_SIZE;
+    chunk = (TrieLabelChunk *)malloc(sizeof(TrieLabelChunk) + capacity);
+    if (!chunk)
+      return NULL;
+    chunk->capacity = capacity;
+    chunk->used = 0;
+    chunk->next = trie->labels;
+    trie->labels = chunk;
+  }
+
+  char *label = chunk->data + chunk->used;
+  chunk->used += len;
+  return label;
+}
+
+/**
+ * Index of the child whose label starts with c, or -1
+ */
+static int child_find(TrieNode *node, char c) {
+  unsigned char key = (unsigned char)c;
+  for (int i = 0; i < node->child_count; i++) {
+    if (node->child_keys[i] == key)
+      return i;
+    if (node->child_keys[i] > key)
+      break;
+  }
+  return -1;
+}
+
+/**
+ * Insert child into node's sorted child array, growing it by doubling
+ * Pointers and keys share one allocation: pointers first, then keys
+ */
+static bool child_insert(TrieNode *node, TrieNode *child) {
+  if (node->child_count == node->child_capacity) {
+    int capacity = node->child_capacity ? node->child_capacity * 2 : 2;
+    if (capacity > 256)
+      capacity = 256;
+
+    TrieNode **children = (TrieNode **)malloc(
+        capacity * (sizeof(TrieNode *) + sizeof(unsigned char)));
+    if (!children)
+      return false;
+    unsigned char *keys = (unsigned char *)(children + capacity);
+
+    if (node->child_count) {
+      memcpy(children, node->children,
+             node->child_count * sizeof(TrieNode *));
+      memcpy(keys, node->child_keys, node->child_count);
+    }
+    free(node->children);
+    node->children = children;
+    node->child_keys = keys;
+    node->child_capacity = capacity;
+  }
+
+  unsigned char key = (unsigned char)child->label[0];
+  int index = node->child_count;
+  while (index > 0 && node->child_keys[index - 1] > key)
+    index--;
+
+  memmove(node->children + index + 1, node->children + index,
+          (node->child_count - index) * sizeof(TrieNode *));
+  memmove(node->child_keys + index + 1, node->child_keys + index,
+          node->child_count - index);
+  node->children[index] = child;
+  node->child_keys[index] = key;
+  node->child_count++;
+  return true;
+}
+
+/**
+ * Remove the child at index, keeping the array sorted
+ */
+static void child_remove(TrieNode *node, int index) {
+  memmove(node->children + index, node->children + index + 1,
+          (node->child_count - index - 1) * sizeof(TrieNode *));
+  memmove(node->child_keys + index, node->child_keys + index + 1,
+          node->child_count - index - 1);
+  node->child_count--;
+}
+
+/**
+ * Hang a new leaf under parent labelled with the len bytes of key
+ */
+static TrieNode *trie_add_leaf(Trie *trie, TrieNode *parent, const char *key,
+                               int len) {
+  char *label = label_alloc(trie, len);
+  TrieNode *leaf = label ? trie_create_node(trie, parent) : NULL;
+  if (!leaf)
+    return NULL;
+
+  memcpy(label, key, len);
+  leaf->label = label;
+  leaf->label_len = len;
+
+  if (!child_insert(parent, leaf)) {
+    trie_destroy_node(trie, leaf);
+    return NULL;
+  }
+  return leaf;
+}
+
+/**
+ * Split child's label after its first at characters
+ * A new node takes that part of the label and replaces child under parent;
+ * child keeps the remainder below it. Returns the new node.
+ */
+static TrieNode *trie_split(Trie *trie, TrieNode *parent, TrieNode *child,
+                            int at) {
+  TrieNode *mid = trie_create_node(trie, parent);
+  if (!mid)
+    return NULL;
+
+  int index = child_find(parent, child->label[0]);
+  mid->label = child->label;
+  mid->label_len = at;
+  child->label += at;
+  child->label_len -= at;
+  if (!child_insert(mid, child)) {
+    child->label -= at;
+    child->label_len += at;
+    trie_destroy_node(trie, mid);
+    return NULL;
+  }
+
+  // Same subtree, so the same postings and completions
+  mid->subtree_postings = child->subtree_postings;
+  if (child->top && rank_cache(mid)) {
+    mid->top_count = child->top_count;
+    memcpy(mid->top, child->top, sizeof(HeapNode) * child->top_count);
+  }
+
+  parent->children[index] = mid;
+  child->parent = mid;
+  return mid;
+}
+
+static void trie_stats_node(TrieNode *node, TrieStats *stats) {
+  stats->node_count++;
+  stats->label_chars += node->label_len;
+  stats->child_bytes += (long)node->child_capacity *
+                        (long)(sizeof(TrieNode *) + sizeof(unsigned char));
+  if (node->isEnd)
+    stats->key_count++;
+  stats->entry_count += node->posting_count;
+  stats->entry_bytes += (long)node->posting_capacity * (long)sizeof(int);
+  if (node->top)
+    stats->node_bytes += (long)(TRIE_TOP_K * sizeof(HeapNode));
+
+  for (int i = 0; i < node->child_count; i++)
+    trie_stats_node(node->children[i], stats);
+}
+
+static float trie_priority(Trie *trie, int song_id) {
+  return trie->ranking ? heap_get_priority(trie->ranking, song_id) : 0.0f;
+}
+
+/**
+ * Ranking order: higher priority first, lower song_id breaks ties
+ */
+static bool ranks_above(int a_id, float a_priority, int b_id,
+                        float b_priority) {
+  return a_priority > b_priority || (a_priority == b_priority && a_id < b_id);
+}
+
+/**
+ * Store (song_id, priority) in slot from of a list of count entries, then
+ * shift it into order
+ */
+static void rank_move(HeapNode *top, int count, int from, int song_id,
+                      float priority) {
+  int i = from;
+  while (i > 0 && ranks_above(song_id, priority, top[i - 1].song_id,
+                              top[i - 1].priority)) {
+    top[i] = top[i - 1];
+    i--;
+  }
+  while (i < count - 1 &&
+         ranks_above(top[i + 1].song_id, top[i + 1].priority, song_id,
+                     priority)) {
+    top[i] = top[i + 1];
+    i++;
+  }
+  top[i].song_id = song_id;
+  top[i].priority = priority;
+}
+
+/**
+ * Add a candidate to a list of *count entries unless present or outranked
+ */
+static void rank_offer(HeapNode *top, int *count, int song_id,
+                       float priority) {
+  for (int i = 0; i < *count; i++) {
+    if (top[i].song_id == song_id)
+      return;
+  }
+
+  if (*count < TRIE_TOP_K) {
+    (*count)++;
+    rank_move(top, *count, *count - 1, song_id, priority);
+  } else {
+    HeapNode *last = &top[TRIE_TOP_K - 1];
+    if (ranks_above(song_id, priority, last->song_id, last->priority))
+      rank_move(top, TRIE_TOP_K, TRIE_TOP_K - 1, song_id, priority);
+  }
+}
+
+/**
+ * Give node an empty cache; false if one cannot be allocated
+ */
+static bool rank_cache(TrieNode *node) {
+  if (!node->top) {
+    node->top = (HeapNode *)malloc(sizeof(HeapNode) * TRIE_TOP_K);
+    if (!node->top)
+      return false;
+  }
+  node->top_count = 0;
+  return true;
+}
+
+/**
+ * Free the cache of a node whose subtree is now small enough to rank on
+ * demand
+ */
+static void rank_drop(TrieNode *node) {
+  free(node->top);
+  node->top = NULL;
+  node->top_count = 0;
+}
+
+/**
+ * Offer node's own songs and its children's best songs to a list
+ * A child without a cache has at most TRIE_TOP_K postings below it, which
+ * are walked instead.
+ */
+static void rank_gather(Trie *trie, TrieNode *node, HeapNode *top,
+                        int *count) {
+  for (int i = 0; i < node->posting_count; i++) {
+    rank_offer(top, count, node->postings[i],
+               trie_priority(trie, node->postings[i]));
+  }
+
+  for (int c = 0; c < node->child_count; c++) {
+    TrieNode *child = node->children[c];
+    if (!child->top) {
+      rank_gather(trie, child, top, count);
+      continue;
+    }
+    for (int i = 0; i < child->top_count; i++)
+      rank_offer(top, count, child->top[i].song_id, child->top[i].priority);
+  }
+}
+
+/**
+ * Best songs under node: its cache, or one ranked into scratch
+ */
+static const HeapNode *rank_list(Trie *trie, TrieNode *node, HeapNode *scratch,
+                                 int *count) {
+  if (node->top) {
+    *count = node->top_count;
+    return node->top;
+  }
+  *count = 0;
+  rank_gather(trie, node, scratch, count);
+  return scratch;
+}
+
+/**
+ * Update the caches from node up to the root after song_id changed rank
+ */
+static void rank_path(Trie *trie, TrieNode *node, int song_id,
+                      float priority) {
+  for (; node; node = node->parent) {
+    if (!rank_step(trie, node, song_id, priority))
+      return;
+  }
+}
+
+/**
+ * Update one node's cache for song_id's new priority
+ * A node that has just outgrown TRIE_TOP_K postings gets its cache here.
+ * Returns false when the song is outranked by a full cache it is not in: no
+ * ancestor can then rank it through this node.
+ */
+static bool rank_step(Trie *trie, TrieNode *node, int song_id,
+                      float priority) {
+  if (!node->top) {
+    if (node->subtree_postings > TRIE_TOP_K && rank_cache(node))
+      rank_rebuild(trie, node, song_id, priority);
+    return true;
+  }
+
+  int index = -1;
+  for (int i = 0; i < node->top_count; i++) {
+    if (node->top[i].song_id == song_id) {
+      index = i;
+      break;
+    }
+  }
+
+  bool full = node->top_count == TRIE_TOP_K;
+  HeapNode *last = full ? &node->top[TRIE_TOP_K - 1] : NULL;
+
+  if (index != -1) {
+    // Still cached if it rose, or still beats the last other entry
+    if (!full || priority >= node->top[index].priority ||
+        (&node->top[index] != last &&
+         ranks_above(song_id, priority, last->song_id, last->priority))) {
+      rank_move(node->top, node->top_count, index, song_id, priority);
+    } else {
+      rank_rebuild(trie, node, song_id, priority);
+    }
+  } else if (!full) {
+    rank_offer(node->top, &node->top_count, song_id, priority);
+  } else if (ranks_above(song_id, priority, last->song_id, last->priority)) {
+    rank_move(node->top, TRIE_TOP_K, TRIE_TOP_K - 1, song_id, priority);
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * Recompute a node's cache from its own songs and its children's lists
+ * A song stored under several keys can leave children on other paths still
+ * caching song_id at its old priority; those are brought up to date first,
+ * since they may be missing the entry that song_id's drop lets in.
+ */
+static void rank_rebuild(Trie *trie, TrieNode *node, int song_id,
+                         float priority) {
+  for (int c = 0; c < node->child_count; c++) {
+    TrieNode *child = node->children[c];
+    for (int i = 0; child->top && i < child->top_count; i++) {
+      if (child->top[i].song_id == song_id &&
+          child->top[i].priority != priority) {
+        rank_step(trie, child, song_id, priority);
+        break;
+      }
+    }
+  }
+
+  node->top_count = 0;
+  rank_gather(trie, node, node->top, &node->top_count);
+}
+
+/**
+ * Rebuild caches bottom-up below and including node
+ */
+static void rank_rebuild_subtree(Trie *trie, TrieNode *node) {
+  for (int c = 0; c < node->child_count; c++)
+    rank_rebuild_subtree(trie, node->children[c]);
+
+  // -1 matches no song, so every priority comes from the ranking
+  if (node->subtree_postings > TRIE_TOP_K && rank_cache(node))
+    rank_rebuild(trie, node, -1, 0.0f);
+}
+
+/**
+ * Update the caches from node up to the root after song_id lost a key at
+ * node. A cache without song_id is unaffected, and so is every cache above;
+ * nodes without one are ranked on demand and skipped.
+ */
+static void rank_forget(Trie *trie, TrieNode *node, int song_id) {
+  for (; node; node = node->parent) {
+    if (!node->top)
+      continue;
+    int i = 0;
+    while (i < node->top_count && node->top[i].song_id != song_id)
+      i++;
+    if (i == node->top_count)
+      return;
+    rank_rebuild(trie, node, -1, 0.0f);
+  }
+}
+
+static int compare_ranked(const void *a, const void *b) {
+  const HeapNode *x = (const HeapNode *)a;
+  const HeapNode *y = (const HeapNode *)b;
+  if (ranks_above(x->song_id, x->priority, y->song_id, y->priority))
+    return -1;
+  if (ranks_above(y->song_id, y->priority, x->song_id, x->priority))
+    return 1;
+  return 0;
+}
+
+/**
+ * Collect (song_id, priority) for every song stored at or below node
+ * Grows *items as needed; returns false if an allocation fails
+ */
+static bool collect_ids(Trie *trie, TrieNode *node, HeapNode **items,
+                        int *count, int *capacity) {
+  for (int p = 0; p < node->posting_count; p++) {
+    int song_id = node->postings[p];
+    if (!push_ranked(items, count, capacity, song_id,
+                     trie_priority(trie, song_id)))
+      return false;
+  }
+
+  for (int i = 0; i < node->child_count; i++) {
+    if (!collect_ids(trie, node->children[i], items, count, capacity))
+      return false;
+  }
+
+  return true;
+}
+
+/**
+ * Append (song_id, priority) to *items, growing it by doubling
+ */
+static bool push_ranked(HeapNode **items, int *count, int *capacity,
+                        int song_id, float priority) {
+  if (*count == *capacity) {
+    int new_capacity = *capacity ? *capacity * 2 : 64;
+    HeapNode *grown =
+        (HeapNode *)realloc(*items, sizeof(HeapNode) * new_capacity);
+    if (!grown)
+      return false;
+    *items = grown;
+    *capacity = new_capacity;
+  }
+  (*items)[*count].song_id = song_id;
+  (*items)[*count].priority = priority;
+  (*count)++;
+  return true;
+}
+
+/**
+ * Insert every key at and below node into dest
+ * key holds the len bytes spelling the path down to node's parent
+ */
+static bool copy_live_keys(TrieNode *node, char *key, int len, Trie *dest) {
+  if (len + node->label_len >= TRIE_MAX_WORD)
+    return false;
+  if (node->label_len > 0)
+    memcpy(key + len, node->label, node->label_len);
+  len += node->label_len;
+
+  for (int p = 0; p < node->posting_count; p++) {
+    if (!trie_insert_key(dest, key, len, node->postings[p]))
+      return false;
+  }
+  for (int i = 0; i < node->child_count; i++) {
+    if (!copy_live_keys(node->children[i], key, len, dest))
+      return false;
+  }
+  return true;
+}
+
+/**
+ * copy_live_keys for the image node at index, skipping removed songs
+ */
+static bool copy_image_keys(Trie *trie, uint32_t index, char *key, int len,
+                            Trie *dest) {
+  const TrieImage *image = trie->image;
+  const TrieImageNode *node = &image->nodes[index];
+  int label_len = (int)image_label_len(node);
+  if (len + label_len >= TRIE_MAX_WORD)
+    return false;
+  memcpy(key + len, image->labels + node->label, label_len);
+  len += label_len;
+
+  int count = image_postings(trie, index);
+  if (count < 0)
+    return false;
+  for (int p = 0; p < count; p++) {
+    if (!is_removed(trie, trie->image_matches[p]) &&
+        !trie_insert_key(dest, key, len, trie->image_matches[p]))
+      return false;
+  }
+  uint32_t child_count = image_child_count(node);
+  for (uint32_t i = 0; i < child_count; i++) {
+    if (!copy_image_keys(trie, image->children[node->first_child + i], key,
+                         len, dest))
+      return false;
+  }
+  return true;
+}
+
+/**
+ * Serialize the in-memory trie (no base) to path via a temporary file
+ */
+static bool image_write(Trie *trie, const char *path) {
+  TrieStats stats;
+  trie_get_stats(trie, &stats);
+  int node_count = stats.node_count;
+  int posting_total = stats.entry_count;
+
+  TrieNode **order = (TrieNode **)malloc(sizeof(TrieNode *) * node_count);
+  int *ends = (int *)malloc(sizeof(int) * node_count);
+  int *songs = (int *)malloc(sizeof(int) * (posting_total + 1));
+  uint32_t *spans = (uint32_t *)calloc(posting_total + 2, sizeof(uint32_t));
+  uint32_t *song_nodes =
+      (uint32_t *)malloc(sizeof(uint32_t) * (posting_total + 1));
+  if (!order || !ends || !songs || !spans || !song_nodes) {
+    free(order);
+    free(ends);
+    free(songs);
+    free(spans);
+    free(song_nodes);
+    return false;
+  }
+
+  int count = 0;
+  image_order(trie->root, order, ends, &count);
+
+  int song_count = 0;
+  for (int i = 0; i < node_count; i++) {
+    if (order[i]->posting_count > 0)
+      memcpy(songs + song_count, order[i]->postings,
+             sizeof(int) * order[i]->posting_count);
+    song_count += order[i]->posting_count;
+  }
+  song_count = sort_unique(songs, song_count);
+
+  // Nodes holding each song, bucketed by song; preorder keeps each ascending
+  for (int i = 0; i < node_count; i++) {
+    for (int p = 0; p < order[i]->posting_count; p++) {
+      int at = lower_bound(songs, song_count, order[i]->postings[p]);
+      spans[at + 1]++;
+    }
+  }
+  for (int i = 0; i < song_count; i++)
+    spans[i + 1] += spans[i];
+  for (int i = 0; i < node_count; i++) {
+    for (int p = 0; p < order[i]->posting_count; p++) {
+      int at = lower_bound(songs, song_count, order[i]->postings[p]);
+      song_nodes[spans[at]++] = (uint32_t)i;
+    }
+  }
+  memmove(spans + 1, spans, sizeof(uint32_t) * song_count);
+  spans[0] = 0;
+
+  // Encoded sizes; song spans become byte offsets into the encoded lists
+  uint64_t posting_bytes = 0, song_node_bytes = 0;
+  size_t largest = 0;
+  for (int i = 0; i < node_count; i++) {
+    size_t size = encoded_size(order[i]);
+    posting_bytes += size;
+    if (size > largest)
+      largest = size;
+  }
+  uint32_t *offsets = (uint32_t *)malloc(sizeof(uint32_t) * (song_count + 1));
+  for (int i = 0; offsets && i < song_count; i++) {
+    size_t size = postings_encode((const int *)song_nodes + spans[i],
+                                  (int)(spans[i + 1] - spans[i]), NULL);
+    offsets[i] = (uint32_t)song_node_bytes;
+    song_node_bytes += size;
+    if (size > largest)
+      largest = size;
+  }
+  if (offsets)
+    offsets[song_count] = (uint32_t)song_node_bytes;
+  unsigned char *encoded = (unsigned char *)malloc(largest);
+  uint32_t top_node_count = 0;
+  for (int i = 0; i < node_count; i++) {
+    if (order[i]->subtree_postings > TRIE_TOP_K)
+      top_node_count++;
+  }
+  if (!offsets || !encoded || posting_bytes > UINT32_MAX ||
+      song_node_bytes > UINT32_MAX || (uint64_t)posting_total > UINT32_MAX) {
+    free(offsets);
+    free(encoded);
+    free(order);
+    free(ends);
+    free(songs);
+    free(spans);
+    free(song_nodes);
+    return false;
+  }
+
+  TrieImageHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, TRIE_IMAGE_MAGIC, 4);
+  header.version = TRIE_IMAGE_VERSION;
+  header.byte_order = TRIE_IMAGE_BYTE_ORDER;
+  header.top_k = TRIE_TOP_K;
+  header.node_count = (uint32_t)node_count;
+  header.song_count = (uint32_t)song_count;
+  header.label_bytes = (uint64_t)stats.label_chars;
+  header.posting_total = (uint64_t)posting_total;
+  header.posting_bytes = posting_bytes;
+  header.song_node_bytes = song_node_bytes;
+  header.top_node_count = top_node_count;
+
+  uint64_t slots = (uint64_t)node_count - 1;
+#define ALIGN8(x) (((x) + 7) & ~(uint64_t)7)
+  header.nodes = ALIGN8(sizeof(TrieImageHeader));
+  header.keys =
+      ALIGN8(header.nodes + sizeof(TrieImageNode) * ((uint64_t)node_count + 1));
+  header.children = ALIGN8(header.keys + slots);
+  header.labels = ALIGN8(header.children + sizeof(uint32_t) * slots);
+  header.postings = ALIGN8(header.labels + header.label_bytes);
+  header.top_nodes = ALIGN8(header.postings + posting_bytes);
+  header.tops =
+      ALIGN8(header.top_nodes + sizeof(uint32_t) * (uint64_t)top_node_count);
+  header.songs = ALIGN8(header.tops +
+                        sizeof(int) * (uint64_t)top_node_count * TRIE_TOP_K);
+  header.song_ranks = ALIGN8(header.songs + sizeof(int) * (uint64_t)song_count);
+  header.song_spans =
+      ALIGN8(header.song_ranks + sizeof(float) * (uint64_t)song_count);
+  header.song_nodes = ALIGN8(header.song_spans +
+                             sizeof(uint32_t) * ((uint64_t)song_count + 1));
+  header.file_size = header.song_nodes + song_node_bytes;
+#undef ALIGN8
+
+  size_t tmp_len = strlen(path) + 32;
+  char *tmp = (char *)malloc(tmp_len);
+  FILE *out = NULL;
+  if (tmp) {
+    snprintf(tmp, tmp_len, "%s.%ld.tmp", path, (long)getpid());
+    out = fopen(tmp, "wb");
+  }
+  bool ok = out && fwrite(&header, sizeof(header), 1, out) == 1 &&
+            pad_to(out, header.nodes);
+
+  // The sentinel after the last node closes its label, postings and slots
+  uint32_t label = 0, postings = 0, rank = 0, slot = 0;
+  for (int i = 0; ok && i <= node_count; i++) {
+    TrieNode *node = i < node_count ? order[i] : NULL;
+    TrieImageNode flat;
+    flat.label = label;
+    flat.postings = node && node->posting_count == 1
+                        ? (uint32_t)node->postings[0]
+                        : postings;
+    flat.posting_rank = rank;
+    flat.subtree_end = node ? (uint32_t)ends[i] : (uint32_t)node_count;
+    flat.first_child = slot;
+    if (node) {
+      label += node->label_len;
+      postings += (uint32_t)encoded_size(node);
+      rank += (uint32_t)node->posting_count;
+      slot += node->child_count;
+    }
+    ok = fwrite(&flat, sizeof(flat), 1, out) == 1;
+  }
+
+  // Children are slotted in node order; in preorder each child's subtree
+  // ends where the next child starts
+  ok = ok && pad_to(out, header.keys);
+  for (int i = 0; ok && i < node_count; i++) {
+    for (int c = 0; ok && c < order[i]->child_count; c++)
+      ok = fputc((unsigned char)order[i]->children[c]->label[0], out) != EOF;
+  }
+
+  ok = ok && pad_to(out, header.children);
+  for (int i = 0; ok && i < node_count; i++) {
+    uint32_t child = (uint32_t)i + 1;
+    for (int c = 0; ok && c < order[i]->child_count; c++) {
+      ok = fwrite(&child, sizeof(child), 1, out) == 1;
+      child = (uint32_t)ends[child];
+    }
+  }
+
+  ok = ok && pad_to(out, header.labels);
+  for (int i = 0; ok && i < node_count; i++)
+    ok = order[i]->label_len == 0 ||
+         fwrite(order[i]->label, 1, order[i]->label_len, out) ==
+             (size_t)order[i]->label_len;
+
+  ok = ok && pad_to(out, header.postings);
+  for (int i = 0; ok && i < node_count; i++) {
+    if (encoded_size(order[i]) == 0)
+      continue;
+    size_t size = postings_encode(order[i]->postings, order[i]->posting_count,
+                                  encoded);
+    ok = fwrite(encoded, 1, size, out) == size;
+  }
+
+  ok = ok && pad_to(out, header.top_nodes);
+  for (int i = 0; ok && i < node_count; i++) {
+    uint32_t index = (uint32_t)i;
+    if (order[i]->subtree_postings > TRIE_TOP_K)
+      ok = fwrite(&index, sizeof(index), 1, out) == 1;
+  }
+
+  ok = ok && pad_to(out, header.tops);
+  for (int i = 0; ok && i < node_count; i++) {
+    if (order[i]->subtree_postings <= TRIE_TOP_K)
+      continue;
+    HeapNode scratch[TRIE_TOP_K];
+    int top_count;
+    const HeapNode *list = rank_list(trie, order[i], scratch, &top_count);
+    int top[TRIE_TOP_K];
+    for (int t = 0; t < TRIE_TOP_K; t++)
+      top[t] = t < top_count ? list[t].song_id : -1;
+    ok = fwrite(top, sizeof(int), TRIE_TOP_K, out) == TRIE_TOP_K;
+  }
+
+  ok = ok && pad_to(out, header.songs) &&
+       (song_count == 0 ||
+        fwrite(songs, sizeof(int), song_count, out) == (size_t)song_count);
+  ok = ok && pad_to(out, header.song_ranks);
+  for (int i = 0; ok && i < song_count; i++) {
+    float rank = trie_priority(trie, songs[i]);
+    ok = fwrite(&rank, sizeof(rank), 1, out) == 1;
+  }
+  ok = ok && pad_to(out, header.song_spans) &&
+       fwrite(offsets, sizeof(uint32_t), song_count + 1, out) ==
+           (size_t)song_count + 1;
+  ok = ok && pad_to(out, header.song_nodes);
+  for (int i = 0; ok && i < song_count; i++) {
+    size_t size = postings_encode((const int *)song_nodes + spans[i],
+                                  (int)(spans[i + 1] - spans[i]), encoded);
+    ok = fwrite(encoded, 1, size, out) == size;
+  }
+
+  if (out && fclose(out) != 0)
+    ok = false;
+
+  // Replace the old image in one step; Windows cannot rename over a file
+  if (ok && rename(tmp, path) != 0) {
+    remove(path);
+    ok = rename(tmp, path) == 0;
+  }
+  if (!ok && out)
+    remove(tmp);
+
+  free(tmp);
+  free(order);
+  free(ends);
+  free(songs);
+  free(spans);
+  free(song_nodes);
+  free(offsets);
+  free(encoded);
+  return ok;
+}
+
+/**
+ * Validate an image header and locate its sections
+ * Node contents are trusted: the file is only ever written by trie_save
+ */
+static TrieImage *image_open(const unsigned char *data, size_t size) {
+  if (size < sizeof(TrieImageHeader))
+    return NULL;
+
+  const TrieImageHeader *header = (const TrieImageHeader *)data;
+  if (memcmp(header->magic, TRIE_IMAGE_MAGIC, 4) != 0 ||
+      header->version != TRIE_IMAGE_VERSION ||
+      header->byte_order != TRIE_IMAGE_BYTE_ORDER ||
+      header->top_k != TRIE_TOP_K || header->file_size != size ||
+      header->node_count == 0 || header->top_node_count > header->node_count)
+    return NULL;
+
+  uint64_t nodes = header->node_count;
+  uint64_t songs = header->song_count;
+  uint64_t tops = header->top_node_count;
+  const uint64_t offsets[] = {header->nodes,      header->keys,
+                              header->children,   header->labels,
+                              header->postings,   header->top_nodes,
+                              header->tops,       header->songs,
+                              header->song_ranks, header->song_spans,
+                              header->song_nodes};
+  const uint64_t lengths[] = {(nodes + 1) * sizeof(TrieImageNode),
+                              nodes - 1,
+                              (nodes - 1) * sizeof(uint32_t),
+                              header->label_bytes,
+                              header->posting_bytes,
+                              tops * sizeof(uint32_t),
+                              tops * TRIE_TOP_K * sizeof(int),
+                              songs * sizeof(int),
+                              songs * sizeof(float),
+                              (songs + 1) * sizeof(uint32_t),
+                              header->song_node_bytes};
+  for (int i = 0; i < 11; i++) {
+    if (offsets[i] % 8 != 0 || offsets[i] > size ||
+        lengths[i] > size - offsets[i])
+      return NULL;
+  }
+
+  // Lengths are read off the sentinel, so it must close every section
+  const TrieImageNode *sentinel =
+      (const TrieImageNode *)(data + header->nodes) + nodes;
+  if (sentinel->label != header->label_bytes ||
+      sentinel->posting_rank != header->posting_total ||
+      sentinel->first_child != nodes - 1)
+    return NULL;
+
+  TrieImage *image = (TrieImage *)malloc(sizeof(TrieImage));
+  if (!image)
+    return NULL;
+
+  image->data = data;
+  image->size = size;
+  image->nodes = (const TrieImageNode *)(data + header->nodes);
+  image->keys = data + header->keys;
+  image->children = (const uint32_t *)(data + header->children);
+  image->labels = (const char *)(data + header->labels);
+  image->postings = data + header->postings;
+  image->top_nodes = (const uint32_t *)(data + header->top_nodes);
+  image->tops = (const int *)(data + header->tops);
+  image->songs = (const int *)(data + header->songs);
+  image->song_ranks = (const float *)(data + header->song_ranks);
+  image->song_spans = (const uint32_t *)(data + header->song_spans);
+  image->song_nodes = data + header->song_nodes;
+  image->node_count = header->node_count;
+  image->song_count = header->song_count;
+  image->top_node_count = header->top_node_count;
+  return image;
+}
+
+static void image_close(TrieImage *image) {
+  if (!image)
+    return;
+  unmap_file(image->data, image->size);
+  free(image);
+}
+
+/**
+ * trie_find_node over the image; returns the node index, or -1
+ */
+static int image_find_node(const TrieImage *image, const char *key, int len,
+                           bool *exact) {
+  uint32_t current = 0;
+  const TrieImageNode *node = &image->nodes[0];
+  int pos = 0;
+  int matched = 0;
+  while (pos < len) {
+    int index = image_child_find(image, node, (unsigned char)key[pos]);
+    if (index == -1)
+      return -1;
+
+    current = (uint32_t)index;
+    node = &image->nodes[current];
+    const char *label = image->labels + node->label;
+    int label_len = (int)image_label_len(node);
+    matched = 0;
+    while (pos < len && matched < label_len) {
+      if (key[pos] != label[matched])
+        return -1;
+      matched++;
+      pos++;
+    }
+  }
+
+  if (exact)
+    *exact = matched == (int)image_label_len(node);
+  return (int)current;
+}
+
+/**
+ * Index of node's child whose label starts with key, or -1
+ */
+static int image_child_find(const TrieImage *image, const TrieImageNode *node,
+                            unsigned char key) {
+  int lo = (int)node->first_child;
+  int end = lo + (int)image_child_count(node);
+  int hi = end;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (image->keys[mid] < key)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo < end && image->keys[lo] == key)
+    return (int)image->children[lo];
+  return -1;
+}
+
+/**
+ * collect_postings for the image node at index
+ */
+static int image_collect_postings(const TrieImage *image, uint32_t index,
+                                  int **buffer, int *capacity) {
+  if (!ensure_buffer(buffer, capacity,
+                     (int)image_subtree_postings(image, index)))
+    return -1;
+
+  int count = 0;
+  bool sorted = true;
+  image_gather_postings(image, index, *buffer, &count, &sorted);
+  return sorted ? count : sort_unique(*buffer, count);
+}
+
+/**
+ * gather_postings for the image node at index
+ * The subtree is the run of nodes [index, subtree_end), so its lists are
+ * decoded in order without following child links
+ */
+static void image_gather_postings(const TrieImage *image, uint32_t index,
+                                  int *out, int *count, bool *sorted) {
+  const TrieImageNode *node = &image->nodes[index];
+  uint32_t subtree_postings = image_subtree_postings(image, index);
+  if (subtree_postings == 0)
+    return;
+  if (*count > 0 || subtree_postings != image_posting_count(node))
+    *sorted = false;
+  for (uint32_t i = index; i < node->subtree_end; i++) {
+    *count += image_decode(image, &image->nodes[i], out + *count);
+  }
+}
+
+/**
+ * Decode the image node at index's own postings into trie->image_matches
+ * Returns the count, or -1 if out of memory
+ */
+static int image_postings(Trie *trie, uint32_t index) {
+  const TrieImageNode *node = &trie->image->nodes[index];
+  uint32_t posting_count = image_posting_count(node);
+  if (posting_count == 0)
+    return 0;
+  if (!ensure_buffer(&trie->image_matches, &trie->image_capacity,
+                     (int)posting_count))
+    return -1;
+  return image_decode(trie->image, node, trie->image_matches);
+}
+
+/**
+ * Decode the postings of an image node into out; returns the count
+ * Single postings are held inline and empty lists take no bytes
+ */
+static int image_decode(const TrieImage *image, const TrieImageNode *node,
+                        int *out) {
+  uint32_t posting_count = image_posting_count(node);
+  if (posting_count == 1)
+    out[0] = (int)node->postings;
+  if (posting_count <= 1)
+    return (int)posting_count;
+  return postings_decode(image->postings + node->postings, out);
+}
+
+/**
+ * Length of node's label; labels are stored in node order
+ */
+static uint32_t image_label_len(const TrieImageNode *node) {
+  return node[1].label - node->label;
+}
+
+/**
+ * Number of songs node holds itself
+ */
+static uint32_t image_posting_count(const TrieImageNode *node) {
+  return node[1].posting_rank - node->posting_rank;
+}
+
+/**
+ * Number of node's children; child slots are stored in node order
+ */
+static uint32_t image_child_count(const TrieImageNode *node) {
+  return node[1].first_child - node->first_child;
+}
+
+/**
+ * Postings held in the subtree at index, the node's own included
+ */
+static uint32_t image_subtree_postings(const TrieImage *image,
+                                       uint32_t index) {
+  const TrieImageNode *node = &image->nodes[index];
+  return image->nodes[node->subtree_end].posting_rank - node->posting_rank;
+}
+
+/**
+ * Stored top-K list of the image node at index, best first, with its length
+ * in count; NULL (and count 0) for a subtree too small to store one
+ */
+static const int *image_top(const TrieImage *image, uint32_t index,
+                            int *count) {
+  uint32_t lo = 0, hi = image->top_node_count;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (image->top_nodes[mid] < index)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  *count = 0;
+  if (lo == image->top_node_count || image->top_nodes[lo] != index)
+    return NULL;
+
+  const int *top = image->tops + (size_t)lo * TRIE_TOP_K;
+  while (*count < TRIE_TOP_K && top[*count] >= 0)
+    (*count)++;
+  return top;
+}
+
+/**
+ * Bytes node's postings take in the image's postings section
+ */
+static size_t encoded_size(const TrieNode *node) {
+  if (node->posting_count <= 1)
+    return 0;
+  return postings_encode(node->postings, node->posting_count, NULL);
+}
+
+/**
+ * collect_ids for the image node at index, ranked by current priority
+ */
+static bool image_collect_ids(Trie *trie, uint32_t index, HeapNode **items,
+                              int *count, int *capacity) {
+  uint32_t end = trie->image->nodes[index].subtree_end;
+  for (uint32_t i = index; i < end; i++) {
+    int found = image_postings(trie, i);
+    if (found < 0)
+      return false;
+    for (int p = 0; p < found; p++) {
+      int song_id = trie->image_matches[p];
+      if (!is_removed(trie, song_id) &&
+          !push_ranked(items, count, capacity, song_id,
+                       trie_priority(trie, song_id)))
+        return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Number node's subtree in preorder into order, recording in ends the index
+ * one past each node's last descendant
+ */
+static void image_order(TrieNode *node, TrieNode **order, int *ends,
+                        int *count) {
+  int index = (*count)++;
+  order[index] = node;
+  for (int i = 0; i < node->child_count; i++)
+    image_order(node->children[i], order, ends, count);
+  ends[index] = *count;
+}
+
+/**
+ * Position of song_id in the image's song list, or -1
+ */
+static int image_song_index(const TrieImage *image, int song_id) {
+  int count = (int)image->song_count;
+  int at = lower_bound(image->songs, count, song_id);
+  return at < count && image->songs[at] == song_id ? at : -1;
+}
+
+/**
+ * song_under for the image: whether a node holding song_id lies in the
+ * subtree at index, i.e. within [index, subtree_end)
+ */
+static bool image_song_under(const TrieImage *image, int song_id,
+                             uint32_t index) {
+  int at = image_song_index(image, song_id);
+  return at >= 0 &&
+         postings_any_in(image->song_nodes + image->song_spans[at], (int)index,
+                         (int)image->nodes[index].subtree_end);
+}
+
+/**
+ * Whether the image node at index holds song_id itself
+ */
+static bool image_holds(const TrieImage *image, uint32_t index, int song_id) {
+  const TrieImageNode *node = &image->nodes[index];
+  uint32_t posting_count = image_posting_count(node);
+  if (posting_count <= 1)
+    return posting_count == 1 && (int)node->postings == song_id;
+  return postings_contains(image->postings + node->postings, song_id);
+}
+
+/**
+ * Spell the key of the image node at index into key; returns its length
+ * The image has no parent links, but in preorder the child to descend into
+ * is the last one starting at or before index.
+ */
+static int image_key_of(const TrieImage *image, uint32_t index, char *key) {
+  uint32_t current = 0;
+  int len = 0;
+  while (current != index) {
+    const TrieImageNode *node = &image->nodes[current];
+    uint32_t lo = node->first_child;
+    uint32_t hi = lo + image_child_count(node);
+    while (hi - lo > 1) {
+      uint32_t mid = lo + (hi - lo) / 2;
+      if (image->children[mid] <= index)
+        lo = mid;
+      else
+        hi = mid;
+    }
+
+    current = image->children[lo];
+    const TrieImageNode *child = &image->nodes[current];
+    int label_len = (int)image_label_len(child);
+    if (len + label_len >= TRIE_MAX_WORD)
+      return -1;
+    memcpy(key + len, image->labels + child->label, label_len);
+    len += label_len;
+  }
+  return len;
+}
+
+/**
+ * Move song_id out of the image: index all its image keys in memory and
+ * mark its image copy removed
+ */
+static bool image_materialize(Trie *trie, int song_id) {
+  const TrieImage *image = trie->image;
+  int at = image_song_index(image, song_id);
+  if (at < 0)
+    return true;
+
+  const unsigned char *list = image->song_nodes + image->song_spans[at];
+  int count = postings_count(list);
+  if (!ensure_buffer(&trie->image_matches, &trie->image_capacity, count))
+    return false;
+  postings_decode(list, trie->image_matches);
+
+  char key[TRIE_MAX_WORD];
+  for (int i = 0; i < count; i++) {
+    int len = image_key_of(image, (uint32_t)trie->image_matches[i], key);
+    if (len < 0 || !trie_insert_key(trie, key, len, song_id))
+      return false;
+  }
+  return tombstone(trie, song_id);
+}
+
+/**
+ * Move every image song whose priority changed since the image was saved
+ * into memory, so no stale image cache ranks it
+ */
+static bool image_rerank(Trie *trie) {
+  const TrieImage *image = trie->image;
+  if (!image || !trie->ranking)
+    return true;
+
+  for (uint32_t i = 0; i < image->song_count; i++) {
+    int song_id = image->songs[i];
+    if (image->song_ranks[i] != trie_priority(trie, song_id) &&
+        !is_removed(trie, song_id) && !image_materialize(trie, song_id))
+      return false;
+  }
+  return true;
+}
+
+/**
+ * Completion candidates for the image subtree at index
+ * A cache without removed songs stands for its subtree; otherwise the
+ * node's own songs and its children's candidates replace it. A subtree
+ * without a cache has at most TRIE_TOP_K postings, all of them candidates.
+ */
+static bool image_top_candidates(Trie *trie, uint32_t index, HeapNode **items,
+                                 int *count, int *capacity) {
+  const TrieImage *image = trie->image;
+  const TrieImageNode *node = &image->nodes[index];
+  int top_count;
+  const int *top = image_top(image, index, &top_count);
+  if (!top)
+    return image_collect_ids(trie, index, items, count, capacity);
+
+  bool stale = false;
+  for (int i = 0; i < top_count && !stale; i++)
+    stale = is_removed(trie, top[i]);
+
+  if (!stale || top_count < TRIE_TOP_K) {
+    for (int i = 0; i < top_count; i++) {
+      if (!is_removed(trie, top[i]) &&
+          !push_ranked(items, count, capacity, top[i],
+                       trie_priority(trie, top[i])))
+        return false;
+    }
+    return true;
+  }
+
+  // The decoded postings are used up before the children reuse the buffer
+  int found = image_postings(trie, index);
+  if (found < 0)
+    return false;
+  for (int p = 0; p < found; p++) {
+    int song_id = trie->image_matches[p];
+    if (!is_removed(trie, song_id) &&
+        !push_ranked(items, count, capacity, song_id,
+                     trie_priority(trie, song_id)))
+      return false;
+  }
+  uint32_t child_count = image_child_count(node);
+  for (uint32_t i = 0; i < child_count; i++) {
+    if (!image_top_candidates(trie, image->children[node->first_child + i],
+                              items, count, capacity))
+      return false;
+  }
+  return true;
+}
+
+/**
+ * Whether song_id's image copy has been removed
+ */
+static bool is_removed(Trie *trie, int song_id) {
+  int at = lower_bound(trie->removed, trie->removed_count, song_id);
+  return at < trie->removed_count && trie->removed[at] == song_id;
+}
+
+/**
+ * Mark song_id's image copy removed; false if already marked or out of
+ * memory
+ */
+static bool tombstone(Trie *trie, int song_id) {
+  int at = lower_bound(trie->removed, trie->removed_count, song_id);
+  if (at < trie->removed_count && trie->removed[at] == song_id)
+    return false;
+  if (!ensure_buffer(&trie->removed, &trie->removed_capacity,
+                     trie->removed_count + 1))
+    return false;
+
+  memmove(trie->removed + at + 1, trie->removed + at,
+          sizeof(int) * (trie->removed_count - at));
+  trie->removed[at] = song_id;
+  trie->removed_count++;
+  return true;
+}
+
+/**
+ * Filter removed songs out of count ascending ids; returns the new count
+ */
+static int drop_removed(Trie *trie, int *ids, int count) {
+  if (trie->removed_count == 0 || count <= 0)
+    return count;
+
+  int kept = 0;
+  int j = 0;
+  for (int i = 0; i < count; i++) {
+    while (j < trie->removed_count && trie->removed[j] < ids[i])
+      j++;
+    if (j == trie->removed_count || trie->removed[j] != ids[i])
+      ids[kept++] = ids[i];
+  }
+  return kept;
+}
+
+/**
+ * Write zero bytes up to file offset
+ */
+static bool pad_to(FILE *out, uint64_t offset) {
+  long pos = ftell(out);
+  if (pos < 0)
+    return false;
+  for (; (uint64_t)pos < offset; pos++) {
+    if (fputc(0, out) == EOF)
+      return false;
+  }
+  return true;
+}
+
+/**
+ * Map a whole file read-only; NULL if it cannot be opened or is empty
+ */
+static const unsigned char *map_file(const char *path, size_t *size) {
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path, GENERIC_READ,
+                            FILE_SHARE_READ | FILE_SHARE_DELETE, NULL,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return NULL;
+
+  LARGE_INTEGER length;
+  const unsigned char *data = NULL;
+  if (GetFileSizeEx(file, &length) && length.QuadPart > 0) {
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping) {
+      data = (const unsigned char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0,
+                                                  0);
+      CloseHandle(mapping); // The view keeps the mapping alive
+    }
+  }
+  CloseHandle(file);
+  if (data)
+    *size = (size_t)length.QuadPart;
+  return data;
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  struct stat st;
+  void *data = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0)
+    data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd); // The mapping keeps the file alive
+  if (data == MAP_FAILED)
+    return NULL;
+
+  // Lookups jump around the file; read-ahead would only inflate residency
+  posix_madvise(data, (size_t)st.st_size, POSIX_MADV_RANDOM);
+  *size = (size_t)st.st_size;
+  return (const unsigned char *)data;
+#endif
+}
+
+static void unmap_file(const unsigned char *data, size_t size) {
+#ifdef _WIN32
+  (void)size;
+  UnmapViewOfFile(data);
+#else
+  munmap((void *)data, size);
+#endif
 }
@@ -0,0 +1,478 @@
+/**
+ * Write-Ahead Log Implementation
+ *
+ * Makes the queue durable at O(1) bytes per mutation: every recorded
+ * operation is appended to dir/queue.log as one fixed-size record, and
+ * recovery replays the log on top of the last checkpoint (dir/queue.ckpt,
+ * the whole queue as of some moment).
+ *
+ * Each record is written to the file as soon as it is appended, so a crash
+ * of the process loses nothing. Flushing to disk is the expensive part and
+ * is shared: one fsync covers every record appended since the previous one
+ * (group commit, see WAL_GROUP_RECORDS and WAL_GROUP_WINDOW_MS). Groups are
+ * only closed by appends, so a caller that must not leave records pending,
+ * e.g. before answering a request, calls wal_sync.
+ *
+ * Records of one atomic group (a batch, or a batch undo) are flagged
+ * WAL_CONTINUED except the last; recovery drops a group whose last record
+ * never made it to disk. A torn or corrupt record ends the log.
+ *
+ * Log layout (native uint32s):
+ *   header: magic "MQWL", version, generation
+ *   record: type | was_ranked << 8 | flags << 16, song_id, old_position,
+ *           old_priority, new_position, new_priority, old_current,
+ *           new_current, checksum of the previous eight
+ *
+ * Checkpoint layout (native uint32s):
+ *   magic "MQCP", version, generation, count, current, count song IDs,
+ *   checksum of all of the above
+ *
+ * A checkpoint is written next to its path and renamed into place, then the
+ * log is restarted under the checkpoint's generation. A log whose generation
+ * differs from the checkpoint's was already folded into it.
+ *
+ * Only one process may own a directory: wal_lock takes a non-blocking
+ * exclusive lock on dir/queue.lock, held until wal_close, so a second
+ * process fails to open the log instead of truncating the first's records.
+ */
+
+#include "music_queue_core.h"
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <process.h>
+#include <sys/locking.h>
+#include <sys/stat.h>
+#include <windows.h>
+#define getpid _getpid
+#define fsync _commit
+#define ftruncate _chsize
+#define FILE_MODE (_S_IREAD | _S_IWRITE)
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+#define FILE_MODE 0644
+#endif
+
+#define WAL_MAGIC 0x4C57514Du  // "MQWL"
+#define CKPT_MAGIC 0x5043514Du // "MQCP"
+#define WAL_VERSION 1
+
+#define WAL_HEADER_WORDS 3
+#define WAL_RECORD_WORDS 9
+#define WAL_HEADER_BYTES (WAL_HEADER_WORDS * sizeof(uint32_t))
+#define WAL_RECORD_BYTES (WAL_RECORD_WORDS * sizeof(uint32_t))
+
+// Helper function prototypes
+static void wal_path(char *out, size_t size, const char *dir,
+                     const char *name);
+static uint32_t checksum(uint32_t hash, const void *data, size_t size);
+static void record_encode(const Operation *op, int flags, uint32_t *words);
+static bool record_decode(const uint32_t *words, WalRecord *record);
+static bool write_all(int fd, const void *data, size_t size);
+static bool log_restart(WriteAheadLog *log, unsigned int generation);
+static bool lock_exclusive(int fd);
+static void sync_dir(const char *dir);
+static long long now_ms(void);
+
+/**
+ * Read the checkpoint in dir
+ * Stores its generation (0 if there is none), a malloc'd array of its queue
+ * (NULL if empty) and the current song's position (or -1).
+ * Returns the queue length, 0 if there is no checkpoint, or -1 if it is
+ * unreadable
+ */
+int wal_read_checkpoint(const char *dir, unsigned int *out_generation,
+                        int **out_ids, int *out_current) {
+  *out_generation = 0;
+  *out_ids = NULL;
+  *out_current = -1;
+
+  char path[1024];
+  wal_path(path, sizeof(path), dir, "queue.ckpt");
+  FILE *in = fopen(path, "rb");
+  if (!in)
+    return 0;
+
+  uint32_t header[5];
+  if (fread(header, sizeof(header), 1, in) != 1 || header[0] != CKPT_MAGIC ||
+      header[1] != WAL_VERSION || header[3] > (uint32_t)INT32_MAX ||
+      (int32_t)header[4] < -1 || (int32_t)header[4] >= (int32_t)header[3]) {
+    fclose(in);
+    return -1;
+  }
+
+  int count = (int)header[3];
+  int *ids = (int *)malloc(sizeof(int) * (count > 0 ? count : 1));
+  uint32_t stored;
+  bool ok = ids && fread(ids, sizeof(int), count, in) == (size_t)count &&
+            fread(&stored, sizeof(stored), 1, in) == 1;
+  fclose(in);
+
+  uint32_t hash = checksum(2166136261u, header, sizeof(header));
+  if (!ok || checksum(hash, ids, sizeof(int) * count) != stored) {
+    free(ids);
+    return -1;
+  }
+
+  *out_generation = header[2];
+  *out_current = (int32_t)header[4];
+  if (count > 0)
+    *out_ids = ids;
+  else
+    free(ids);
+  return count;
+}
+
+/**
+ * Read the records of dir's log, if it belongs to generation
+ * Reading stops at the first torn or corrupt record.
+ * Returns a malloc'd array (NULL if there are none) of out_count records
+ */
+WalRecord *wal_read(const char *dir, unsigned int generation, int *out_count) {
+  *out_count = 0;
+
+  char path[1024];
+  wal_path(path, sizeof(path), dir, "queue.log");
+  FILE *in = fopen(path, "rb");
+  if (!in)
+    return NULL;
+
+  uint32_t header[WAL_HEADER_WORDS];
+  if (fread(header, sizeof(header), 1, in) != 1 || header[0] != WAL_MAGIC ||
+      header[1] != WAL_VERSION || header[2] != generation) {
+    fclose(in);
+    return NULL;
+  }
+
+  WalRecord *records = NULL;
+  int count = 0, capacity = 0;
+  uint32_t words[WAL_RECORD_WORDS];
+  while (fread(words, sizeof(words), 1, in) == 1) {
+    if (count == capacity) {
+      int grown_capacity = capacity ? capacity * 2 : 256;
+      WalRecord *grown = (WalRecord *)realloc(
+          records, sizeof(WalRecord) * grown_capacity);
+      if (!grown)
+        break;
+      records = grown;
+      capacity = grown_capacity;
+    }
+    if (!record_decode(words, &records[count]))
+      break;
+    count++;
+  }
+  fclose(in);
+
+  *out_count = count;
+  return records;
+}
+
+/**
+ * Take ownership of dir's log before reading or opening it
+ * Fails without waiting if another process holds it. Released by wal_close.
+ */
+bool wal_lock(WriteAheadLog *log, const char *dir) {
+  if (!log || !dir || log->open || log->locked)
+    return false;
+
+  char path[1024];
+  wal_path(path, sizeof(path), dir, "queue.lock");
+  int fd = open(path, O_RDWR | O_CREAT | O_BINARY, FILE_MODE);
+  if (fd < 0)
+    return false;
+  if (!lock_exclusive(fd)) {
+    close(fd);
+    return false;
+  }
+
+  memset(log, 0, sizeof(*log));
+  log->locked = true;
+  log->lock_fd = fd;
+  return true;
+}
+
+/**
+ * Open dir's log for appending under generation
+ * The first keep records of a log of that generation are kept and anything
+ * after them is cut off; any other log is started afresh. Takes dir's lock
+ * first unless wal_lock already has.
+ */
+bool wal_open(WriteAheadLog *log, const char *dir, unsigned int generation,
+              int keep) {
+  if (!log || !dir || log->open || keep < 0)
+    return false;
+  if (!log->locked && !wal_lock(log, dir))
+    return false;
+
+  size_t dir_len = strlen(dir);
+  char *copy = (char *)malloc(dir_len + 1);
+  if (!copy)
+    return false;
+  memcpy(copy, dir, dir_len + 1);
+
+  char path[1024];
+  wal_path(path, sizeof(path), dir, "queue.log");
+  int fd = open(path, O_RDWR | O_CREAT | O_BINARY, FILE_MODE);
+  if (fd < 0) {
+    free(copy);
+    wal_close(log);
+    return false;
+  }
+
+  log->fd = fd;
+  log->dir = copy;
+  log->open = true;
+
+  bool ok;
+  if (keep > 0) {
+    long size = (long)(WAL_HEADER_BYTES + (size_t)keep * WAL_RECORD_BYTES);
+    ok = ftruncate(fd, size) == 0 && lseek(fd, size, SEEK_SET) == size;
+    log->generation = generation;
+    log->records = keep;
+  } else {
+    ok = log_restart(log, generation);
+  }
+
+  if (!ok) {
+    wal_close(log);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Append one record and write it through to the file
+ * The record is synced with its group: when WAL_GROUP_RECORDS are pending
+ * or, at this append, the oldest pending one is WAL_GROUP_WINDOW_MS old. A
+ * group flagged WAL_CONTINUED is never synced part-way.
+ * Time Complexity: O(1)
+ */
+bool wal_append(WriteAheadLog *log, const Operation *op, int flags) {
+  if (!log || !log->open || log->failed)
+    return false;
+
+  uint32_t words[WAL_RECORD_WORDS];
+  record_encode(op, flags, words);
+  if (!write_all(log->fd, words, sizeof(words))) {
+    log->failed = true;
+    return false;
+  }
+  log->records++;
+
+  long long now = now_ms();
+  if (log->pending++ == 0)
+    log->first_pending_ms = now;
+  if (flags & WAL_CONTINUED)
+    return true;
+  if (log->pending >= WAL_GROUP_RECORDS ||
+      now - log->first_pending_ms >= WAL_GROUP_WINDOW_MS)
+    return wal_sync(log);
+  return true;
+}
+
+/**
+ * Make every appended record durable
+ * Returns false if any write to the log has failed
+ */
+bool wal_sync(WriteAheadLog *log) {
+  if (!log || !log->open || log->failed)
+    return false;
+  if (log->pending == 0)
+    return true;
+  if (fsync(log->fd) != 0) {
+    log->failed = true;
+    return false;
+  }
+  log->pending = 0;
+  return true;
+}
+
+/**
+ * Write the queue as the new checkpoint and start an empty log
+ * A crash at any point leaves either the old checkpoint and its log or the
+ * new checkpoint, so nothing is replayed twice.
+ * Time Complexity: O(count)
+ */
+bool wal_checkpoint(WriteAheadLog *log, const int *ids, int count,
+                    int current) {
+  if (!log || !log->open || log->failed || count < 0 || (count > 0 && !ids))
+    return false;
+
+  char path[1024], tmp[1024 + 32];
+  wal_path(path, sizeof(path), log->dir, "queue.ckpt");
+  snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)getpid());
+
+  unsigned int generation = log->generation + 1;
+  uint32_t header[5] = {CKPT_MAGIC, WAL_VERSION, generation, (uint32_t)count,
+                        (uint32_t)current};
+  uint32_t hash = checksum(2166136261u, header, sizeof(header));
+  hash = checksum(hash, ids, sizeof(int) * count);
+
+  FILE *out = fopen(tmp, "wb");
+  bool ok = out && fwrite(header, sizeof(header), 1, out) == 1 &&
+            fwrite(ids, sizeof(int), count, out) == (size_t)count &&
+            fwrite(&hash, sizeof(hash), 1, out) == 1 && fflush(out) == 0 &&
+            fsync(fileno(out)) == 0;
+  if (out && fclose(out) != 0)
+    ok = false;
+
+  // Replace the old checkpoint in one step; Windows cannot rename over a file
+  if (ok && rename(tmp, path) != 0) {
+    remove(path);
+    ok = rename(tmp, path) == 0;
+  }
+  if (!ok) {
+    remove(tmp);
+    return false;
+  }
+  sync_dir(log->dir);
+
+  // The old log is now redundant; failing to restart it loses nothing
+  // already written, but later records could not be recovered
+  if (!log_restart(log, generation)) {
+    log->failed = true;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Sync and close the log, and release its directory's lock
+ */
+void wal_close(WriteAheadLog *log) {
+  if (!log)
+    return;
+  if (log->open) {
+    wal_sync(log);
+    close(log->fd);
+    free(log->dir);
+  }
+  if (log->locked)
+    close(log->lock_fd);
+  memset(log, 0, sizeof(*log));
+}
+
+// ============================================================================
+// HELPER FUNCTIONS
+// ============================================================================
+
+static void wal_path(char *out, size_t size, const char *dir,
+                     const char *name) {
+  snprintf(out, size, "%s/%s", dir, name);
+}
+
+/**
+ * FNV-1a, continued from hash
+ */
+static uint32_t checksum(uint32_t hash, const void *data, size_t size) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static void record_encode(const Operation *op, int flags, uint32_t *words) {
+  words[0] = (uint32_t)op->type | (op->was_ranked ? 0x100u : 0u) |
+             ((uint32_t)flags << 16);
+  words[1] = (uint32_t)op->song_id;
+  words[2] = (uint32_t)op->old_position;
+  memcpy(&words[3], &op->old_priority, sizeof(float));
+  words[4] = (uint32_t)op->new_position;
+  memcpy(&words[5], &op->new_priority, sizeof(float));
+  words[6] = (uint32_t)op->old_current;
+  words[7] = (uint32_t)op->new_current;
+  words[8] = checksum(2166136261u, words, 8 * sizeof(uint32_t));
+}
+
+static bool record_decode(const uint32_t *words, WalRecord *record) {
+  if (checksum(2166136261u, words, 8 * sizeof(uint32_t)) != words[8])
+    return false;
+
+  Operation *op = &record->op;
+  memset(op, 0, sizeof(*op));
+  op->type = (OperationType)(words[0] & 0xFF);
+  op->was_ranked = (words[0] & 0x100u) != 0;
+  op->song_id = (int32_t)words[1];
+  op->old_position = (int32_t)words[2];
+  memcpy(&op->old_priority, &words[3], sizeof(float));
+  op->new_position = (int32_t)words[4];
+  memcpy(&op->new_priority, &words[5], sizeof(float));
+  op->old_current = (int32_t)words[6];
+  op->new_current = (int32_t)words[7];
+  record->flags = (int)(words[0] >> 16);
+  return op->type < OP_BATCH;
+}
+
+static bool write_all(int fd, const void *data, size_t size) {
+  const char *bytes = (const char *)data;
+  while (size > 0) {
+    int written = (int)write(fd, bytes, (unsigned int)size);
+    if (written <= 0)
+      return false;
+    bytes += written;
+    size -= (size_t)written;
+  }
+  return true;
+}
+
+/**
+ * Empty the log and give it a durable header for generation
+ */
+static bool log_restart(WriteAheadLog *log, unsigned int generation) {
+  uint32_t header[WAL_HEADER_WORDS] = {WAL_MAGIC, WAL_VERSION, generation};
+  if (ftruncate(log->fd, 0) != 0 || lseek(log->fd, 0, SEEK_SET) != 0 ||
+      !write_all(log->fd, header, sizeof(header)) || fsync(log->fd) != 0)
+    return false;
+
+  log->generation = generation;
+  log->records = 0;
+  log->pending = 0;
+  return true;
+}
+
+/**
+ * Lock fd's file for this process without waiting; closing fd releases it
+ */
+static bool lock_exclusive(int fd) {
+#ifdef _WIN32
+  return _locking(fd, _LK_NBLCK, 1) == 0;
+#else
+  return flock(fd, LOCK_EX | LOCK_NB) == 0;
+#endif
+}
+
+/**
+ * Make a rename in dir durable (POSIX only; NTFS journals it)
+ */
+static void sync_dir(const char *dir) {
+#ifdef _WIN32
+  (void)dir;
+#else
+  int fd = open(dir, O_RDONLY);
+  if (fd >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+#endif
+}
+
+static long long now_ms(void) {
+#ifdef _WIN32
+  return (long long)GetTickCount64();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
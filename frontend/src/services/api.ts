@@ -23,6 +23,7 @@ export const musicApi = {
     skipPrev: () => api.post('/queue/skip/prev'),
     moveUp: (songId: number) => api.post('/queue/move-up', { song_id: songId }),
     moveDown: (songId: number) => api.post('/queue/move-down', { song_id: songId }),
+    moveTo: (songId: number, position: number) => api.post('/queue/move', { song_id: songId, position }),
     // Undo/Redo
     undo: () => api.post('/undo'),
     redo: () => api.post('/redo'),